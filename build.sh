@@ -1,8 +1,17 @@
 echo cleaning...
-rm program
+rm program headless batch tracedump aot disasm filterbench libchip8.a
 
 echo compiling...
-gcc src/main.c -o program -I/usr/include/SDL2/ -ISDL2 -lSDL2 -lm -Wall -Werror
+gcc -O2 -c src/core.c -o core.o -Wall -Werror
+ar rcs libchip8.a core.o
+rm core.o
+gcc -O2 src/main.c -o program -I/usr/include/SDL2/ -ISDL2 -L. -lchip8 -lSDL2 -lm -pthread -Wall -Werror
+gcc -O2 src/headless.c -o headless -L. -lchip8 -lm -pthread -Wall -Werror
+gcc -O2 src/batch.c -o batch -L. -lchip8 -lm -pthread -Wall -Werror
+gcc -O2 src/tools/tracedump.c -o tracedump -Wall -Werror
+gcc -O2 src/tools/aot.c -o aot -L. -lchip8 -lm -pthread -Wall -Werror
+gcc -O2 src/tools/disasm.c -o disasm -L. -lchip8 -lm -pthread -Wall -Werror
+gcc -O2 src/tools/filterbench.c -o filterbench -L. -lchip8 -lm -pthread -Wall -Werror
 
 echo running...
 ./program 5-quirks.ch8
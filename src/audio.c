@@ -0,0 +1,176 @@
+// Audio. The emulation thread pushes every buzzer edge into a lock-free single producer/single consumer
+// queue, stamped with the instruction it happened at, and the frontend's audio callback turns the queue into
+// samples with AudioRender, which never locks, waits or allocates. While the buzzer is on it plays a 1-bit
+// pattern the way XO-CHIP does: 128 bits looped at 4000*2^((pitch-64)/48) bits per second. Every edge carries
+// the pattern and pitch to play, the classic buzzer is AUDIO_BUZZER_PATTERN at pitch 64, a 500Hz square.
+//
+// The callback plays emulated time: it keeps a cursor in instructions that trails the newest instruction the
+// emulator has run by a device buffer and a timer tick, as the emulator runs in batches up to a tick apart
+// when it idles, and applies each edge at the sample its instruction falls on.
+// The cursor holds instead of running past the emulator, and jumps forward if it falls too far behind.
+// Instructions can run backwards (rewind, loading a state), edges are stamped on a clock that never does.
+#include <stdatomic.h>
+#include <math.h>
+
+#define AUDIO_QUEUE_SIZE 1024 // Edges, must be a power of two
+#define AUDIO_QUEUE_MASK (AUDIO_QUEUE_SIZE - 1)
+#define AUDIO_BUZZER_PATTERN 0xF0 // Every byte of the pattern
+#define AUDIO_AMPLITUDE 4000
+#define AUDIO_FRACTION 16 // Fraction bits of the cursor and the pattern position
+
+typedef struct {
+    uint64_t cycle; // On the audio clock
+    uint64_t pushed; // Host time in ns, for measuring latency
+    bool on;
+    uint8_t pitch;
+    uint8_t pattern[16];
+} audioEdge;
+
+struct {
+    bool enabled;
+    uint32_t sampleRate;
+    uint32_t buffer; // Samples the device plays between two callbacks
+    uint64_t trail; // How far the cursor stays behind the emulator, in fixed point instructions
+
+    audioEdge queue[AUDIO_QUEUE_SIZE];
+    _Atomic uint32_t head; // Next slot the emulator writes, only advanced by the emulator
+    _Atomic uint32_t tail; // Next slot the callback reads, only advanced by the callback
+    _Atomic uint64_t now; // Audio clock the emulator has run to
+
+    // Emulator's side
+    bool buzzer;
+    uint64_t clock; // Instructions run, never goes back
+    uint64_t lastCycles; // Machine's instruction count when the clock was last advanced
+    uint64_t dropped; // Edges lost to a full queue
+
+    // Callback's side
+    bool started;
+    uint64_t cursor; // Audio clock in fixed point
+    uint64_t step; // Instructions per sample in fixed point
+    bool playing;
+    uint8_t pattern[16];
+    uint32_t position; // Bit of the pattern in fixed point
+    uint32_t rate; // Pattern bits per sample in fixed point
+    uint64_t samples;
+    uint64_t heldSamples; // Samples played while waiting for the emulator to get further
+    uint64_t resyncs; // Times the cursor fell too far behind and jumped forward
+    uint64_t edges;
+    uint64_t latencyTotal; // ns from push to leaving the speaker, summed over the edges
+    uint64_t latencyMax;
+} audioState;
+
+static uint64_t AudioTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// `buffer` is the device's buffer in samples, `clockHz` the rate instructions are played back at
+bool AudioStart(uint32_t sampleRate, uint32_t buffer, uint32_t clockHz)
+{
+    if (sampleRate == 0 || buffer == 0)
+    {
+        printf("[ERROR]: Audio needs a sample rate and a buffer above 0.\n");
+        return false;
+    }
+    memset(&audioState, 0, sizeof(audioState));
+    audioState.sampleRate = sampleRate;
+    audioState.buffer = buffer;
+    audioState.step = ((uint64_t)clockHz << AUDIO_FRACTION) / sampleRate;
+    audioState.trail = buffer * audioState.step + ((uint64_t)(clockHz / TIMER_HZ) << AUDIO_FRACTION);
+    audioState.lastCycles = UINT64_MAX; // Picked up from the first machine to run
+    audioState.enabled = true;
+    return true;
+}
+
+void AudioStop()
+{
+    if (!audioState.enabled) return;
+    audioState.enabled = false;
+    printf("Audio: %lu edges played, average latency %.2fms, max %.2fms, %lu dropped, %.2f%% of samples held for the emulator, %lu resyncs\n",
+        audioState.edges, audioState.edges ? audioState.latencyTotal / 1e6 / audioState.edges : 0.0, audioState.latencyMax / 1e6,
+        audioState.dropped, audioState.samples ? 100.0 * audioState.heldSamples / audioState.samples : 0.0, audioState.resyncs);
+}
+
+// Advances the audio clock to the machine's instruction count and queues an edge if the buzzer changed.
+// Only ever called from the emulation thread.
+static void AudioUpdate(const chip8* cpu)
+{
+    if (cpu->cycles >= audioState.lastCycles) audioState.clock += cpu->cycles - audioState.lastCycles;
+    audioState.lastCycles = cpu->cycles;
+
+    bool on = cpu->soundTimer > 0;
+    if (on != audioState.buzzer)
+    {
+        uint32_t head = atomic_load_explicit(&audioState.head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&audioState.tail, memory_order_acquire) == AUDIO_QUEUE_SIZE) audioState.dropped++;
+        else
+        {
+            audioEdge* edge = &audioState.queue[head & AUDIO_QUEUE_MASK];
+            edge->cycle = audioState.clock;
+            edge->pushed = AudioTime();
+            edge->on = on;
+            edge->pitch = 64;
+            memset(edge->pattern, AUDIO_BUZZER_PATTERN, sizeof(edge->pattern));
+            atomic_store_explicit(&audioState.head, head + 1, memory_order_release);
+            audioState.buzzer = on;
+        }
+    }
+    atomic_store_explicit(&audioState.now, audioState.clock, memory_order_release);
+}
+
+// Whether the instruction just run was FX18. Cores end their run on it while audio is on, so the edge it
+// makes is stamped on its own instruction, timer ticks already end a run.
+static inline bool AudioEdgeOpcode(uint16_t opcode)
+{
+    return (opcode & 0xF0FF) == (OPCODE_F | OPCODE_SET_SOUND_TIMER) && audioState.enabled;
+}
+
+// Fills `out` with the next `count` mono samples. Only ever called from the audio callback.
+void AudioRender(int16_t* out, uint32_t count)
+{
+    uint64_t called = AudioTime();
+    uint64_t now = atomic_load_explicit(&audioState.now, memory_order_acquire) << AUDIO_FRACTION;
+    if (!audioState.started || now - audioState.cursor > 2 * audioState.trail)
+    {
+        if (audioState.started) audioState.resyncs++;
+        audioState.cursor = (now > audioState.trail) ? now - audioState.trail : 0;
+        audioState.started = true;
+    }
+
+    for (uint32_t i=0; i<count; i++)
+    {
+        for (;;)
+        {
+            uint32_t tail = atomic_load_explicit(&audioState.tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&audioState.head, memory_order_acquire)) break;
+            const audioEdge* edge = &audioState.queue[tail & AUDIO_QUEUE_MASK];
+            if (edge->cycle << AUDIO_FRACTION > audioState.cursor) break;
+
+            audioState.playing = edge->on;
+            memcpy(audioState.pattern, edge->pattern, sizeof(audioState.pattern));
+            audioState.rate = 4000.0 * pow(2.0, (edge->pitch - 64) / 48.0) * (1 << AUDIO_FRACTION) / audioState.sampleRate;
+            if (edge->on) audioState.position = 0;
+
+            // Heard once the buffer playing now and the samples in front of it in this one have played
+            uint64_t latency = called - edge->pushed + (uint64_t)(audioState.buffer + i) * 1000000000ull / audioState.sampleRate;
+            audioState.latencyTotal += latency;
+            if (latency > audioState.latencyMax) audioState.latencyMax = latency;
+            audioState.edges++;
+            atomic_store_explicit(&audioState.tail, tail + 1, memory_order_release);
+        }
+
+        if (audioState.playing)
+        {
+            uint32_t bit = (audioState.position >> AUDIO_FRACTION) & 127;
+            out[i] = ((audioState.pattern[bit / 8] >> (7 - bit % 8)) & 1) ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+            audioState.position += audioState.rate;
+        }
+        else out[i] = 0;
+
+        if (audioState.cursor + audioState.step <= now) audioState.cursor += audioState.step;
+        else audioState.heldSamples++;
+    }
+    audioState.samples += count;
+}
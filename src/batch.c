@@ -0,0 +1,392 @@
+// Batch runner over the core library. Hosts many independent machines in one process and runs them on a
+// pool of threads in slices of a fixed number of instructions. Every thread has its own deque of machines:
+// it takes work from the bottom of its own and, once that is empty, steals from the top of the others.
+//
+// The job file has one machine per line, blank lines and lines starting with '#' are skipped:
+//
+//     rom.ch8 cycles [seed] [movie]
+//
+// A movie supplies the keypad input, its seed, clock rate and quirk profile, and with cycles 0 also its length.
+// Other machines use the profile given with --profile, or the one detected from the ROM.
+//
+// Each ROM is read from disk once, into the core's ROM cache, however many jobs run it. --preload fills the
+// cache from a whole directory up front.
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+#define BATCH_SLICE 100000 // Default instructions per slice
+#define BATCH_MAX_THREADS 256
+
+typedef struct {
+    char rom[256];
+    char moviePath[256];
+    uint64_t cycles;
+    uint64_t seed;
+} batchJob;
+
+// Only ever touched by the thread that is running it, aligned so neighbours don't share a cache line
+typedef struct {
+    _Alignas(64) chip8* cpu;
+    const romImage* rom;
+    movie script;
+    uint32_t nextEvent;
+    uint64_t target; // Instruction count to stop at
+    bool finished;
+} batchInstance;
+
+// Each deque is guarded by its own spinlock, the owner only contends with thieves
+typedef struct {
+    _Alignas(64) atomic_flag lock;
+    uint32_t* items;
+    uint32_t top; // Thieves take from here
+    uint32_t bottom; // The owner pushes and pops here
+    uint32_t capacity;
+
+    uint64_t slices;
+    uint64_t steals;
+} workQueue;
+
+struct {
+    const core* cpuCore;
+    const profile* quirkProfile; // NULL to detect it per ROM
+    uint64_t slice;
+
+    batchJob* jobs;
+    uint32_t jobCount;
+
+    batchInstance* instances;
+    workQueue queues[BATCH_MAX_THREADS];
+    int threads;
+    _Alignas(64) _Atomic uint32_t remaining; // Instances that haven't finished yet
+} batch;
+
+static double Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void Lock(workQueue* q) { while (atomic_flag_test_and_set_explicit(&q->lock, memory_order_acquire)) sched_yield(); }
+static void Unlock(workQueue* q) { atomic_flag_clear_explicit(&q->lock, memory_order_release); }
+
+static void PushBottom(workQueue* q, uint32_t item)
+{
+    Lock(q);
+    q->items[q->bottom++ % q->capacity] = item;
+    Unlock(q);
+}
+
+static bool PopBottom(workQueue* q, uint32_t* item)
+{
+    Lock(q);
+    bool found = q->bottom != q->top;
+    if (found) *item = q->items[--q->bottom % q->capacity];
+    Unlock(q);
+    return found;
+}
+
+static bool StealTop(workQueue* q, uint32_t* item)
+{
+    Lock(q);
+    bool found = q->bottom != q->top;
+    if (found) *item = q->items[q->top++ % q->capacity];
+    Unlock(q);
+    return found;
+}
+
+// Runs one slice, stopping at every movie event to update the keypad
+static void RunSlice(batchInstance* instance)
+{
+    chip8* cpu = instance->cpu;
+    uint64_t end = cpu->cycles + batch.slice;
+    if (end > instance->target) end = instance->target;
+
+    while (cpu->cycles < end && !cpu->halted)
+    {
+        uint64_t stop = end;
+        if (instance->nextEvent < instance->script.count && instance->script.events[instance->nextEvent].cycle < stop)
+        {
+            stop = instance->script.events[instance->nextEvent].cycle;
+        }
+        ExecuteCycles(cpu, stop - cpu->cycles);
+
+        while (instance->nextEvent < instance->script.count && instance->script.events[instance->nextEvent].cycle <= cpu->cycles)
+        {
+            SetKeypad(cpu, instance->script.events[instance->nextEvent++].keys);
+        }
+    }
+    instance->finished = cpu->halted || cpu->cycles >= instance->target;
+}
+
+static void* Worker(void* arg)
+{
+    int self = (int)(intptr_t)arg;
+    workQueue* own = &batch.queues[self];
+    for (;;)
+    {
+        uint32_t item;
+        bool found = PopBottom(own, &item);
+        for (int i=1; i<batch.threads && !found; i++)
+        {
+            found = StealTop(&batch.queues[(self + i) % batch.threads], &item);
+            if (found) own->steals++;
+        }
+
+        if (!found)
+        {
+            if (atomic_load_explicit(&batch.remaining, memory_order_acquire) == 0) break;
+            sched_yield(); // Everything left is being run by other threads right now
+            continue;
+        }
+
+        batchInstance* instance = &batch.instances[item];
+        RunSlice(instance);
+        own->slices++;
+
+        if (instance->finished) atomic_fetch_sub_explicit(&batch.remaining, 1, memory_order_release);
+        else PushBottom(own, item);
+    }
+    return NULL;
+}
+
+static bool LoadJobs(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("[ERROR]: Failed to open job file: '%s'\n", path);
+        return false;
+    }
+
+    uint32_t capacity = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        batchJob job = { 0 };
+        job.seed = batch.jobCount;
+        char first = 0;
+        if (sscanf(line, " %c", &first) != 1 || first == '#') continue;
+        if (sscanf(line, "%255s %lu %lu %255s", job.rom, &job.cycles, &job.seed, job.moviePath) < 2)
+        {
+            printf("[ERROR]: Bad job on line %u of '%s': %s", batch.jobCount + 1, path, line);
+            fclose(file);
+            return false;
+        }
+
+        if (batch.jobCount == capacity)
+        {
+            capacity = (capacity) ? capacity * 2 : 64;
+            batch.jobs = realloc(batch.jobs, capacity * sizeof(batchJob));
+        }
+        batch.jobs[batch.jobCount++] = job;
+    }
+    fclose(file);
+    return true;
+}
+
+static bool CreateInstances()
+{
+    batch.instances = aligned_alloc(64, batch.jobCount * sizeof(batchInstance));
+    memset(batch.instances, 0, batch.jobCount * sizeof(batchInstance));
+    for (uint32_t i=0; i<batch.jobCount; i++)
+    {
+        batchJob* job = &batch.jobs[i];
+        batchInstance* instance = &batch.instances[i];
+        instance->cpu = CreateMachine(batch.cpuCore);
+        if (!LoadRom(instance->cpu, job->rom)) return false;
+        instance->rom = LoadRomImage(job->rom); // Cached by LoadRom
+        if (job->moviePath[0] && !LoadMovie(&instance->script, job->moviePath)) return false;
+    }
+    return true;
+}
+
+// Puts every machine back at power on from its ROM's cached image, ready for another run
+static void ResetInstances()
+{
+    for (uint32_t i=0; i<batch.jobCount; i++)
+    {
+        batchJob* job = &batch.jobs[i];
+        batchInstance* instance = &batch.instances[i];
+        chip8* cpu = instance->cpu;
+        ResetMachine(cpu, instance->rom);
+        const profile* quirkProfile = (batch.quirkProfile != NULL) ? batch.quirkProfile : DetectProfile(instance->rom->hash);
+        SetProfile(cpu, (quirkProfile != NULL) ? quirkProfile : &profiles[0]);
+        SeedRandom(cpu, job->seed);
+        cpu->clockHz = CLOCK_HZ;
+        instance->target = job->cycles;
+        instance->nextEvent = 0;
+        instance->finished = false;
+
+        if (job->moviePath[0])
+        {
+            SeedRandom(cpu, instance->script.seed);
+            SetProfile(cpu, instance->script.profile);
+            cpu->clockHz = instance->script.clockHz;
+            if (instance->target == 0) instance->target = instance->script.endCycle;
+        }
+    }
+}
+
+static void FreeInstances()
+{
+    for (uint32_t i=0; i<batch.jobCount; i++)
+    {
+        if (batch.instances[i].cpu) DestroyMachine(batch.instances[i].cpu);
+        FreeMovie(&batch.instances[i].script);
+    }
+    free(batch.instances);
+    batch.instances = NULL;
+}
+
+// Runs the whole batch on `threads` threads, returns the wall time
+static double RunBatch(int threads)
+{
+    batch.threads = threads;
+    for (int t=0; t<threads; t++)
+    {
+        workQueue* q = &batch.queues[t];
+        free(q->items);
+        *q = (workQueue){ .lock = ATOMIC_FLAG_INIT, .capacity = batch.jobCount + 1 };
+        q->items = malloc(q->capacity * sizeof(uint32_t));
+    }
+
+    // Deal the instances out round robin, stealing evens out whatever imbalance is left
+    uint32_t remaining = 0;
+    for (uint32_t i=0; i<batch.jobCount; i++)
+    {
+        if (batch.instances[i].target == 0) continue;
+        PushBottom(&batch.queues[i % threads], i);
+        remaining++;
+    }
+    atomic_store(&batch.remaining, remaining);
+
+    pthread_t workers[BATCH_MAX_THREADS];
+    double start = Now();
+    for (int t=1; t<threads; t++) pthread_create(&workers[t], NULL, Worker, (void*)(intptr_t)t);
+    Worker((void*)0);
+    for (int t=1; t<threads; t++) pthread_join(workers[t], NULL);
+    return Now() - start;
+}
+
+static uint64_t TotalCycles()
+{
+    uint64_t total = 0;
+    for (uint32_t i=0; i<batch.jobCount; i++) total += batch.instances[i].cpu->cycles;
+    return total;
+}
+
+static uint64_t CombinedHash() // Order dependent, so it also catches machines swapping results
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (uint32_t i=0; i<batch.jobCount; i++) hash = (hash ^ HashDisplay(batch.instances[i].cpu)) * 0x100000001b3;
+    return hash;
+}
+
+int main(int argc, char* args[])
+{
+    char* jobPath = NULL;
+    char* coreName = "threaded";
+    char* profileName = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool scaling = false;
+    bool quiet = false;
+    char* preloadPath = NULL;
+    batch.slice = BATCH_SLICE;
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(args[i], "--threads") && i+1 < argc) threads = atoi(args[++i]);
+        else if (!strcmp(args[i], "--slice") && i+1 < argc) batch.slice = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--core") && i+1 < argc) coreName = args[++i];
+        else if (!strcmp(args[i], "--profile") && i+1 < argc) profileName = args[++i];
+        else if (!strcmp(args[i], "--scaling")) scaling = true;
+        else if (!strcmp(args[i], "--quiet")) quiet = true;
+        else if (!strcmp(args[i], "--preload") && i+1 < argc) preloadPath = args[++i];
+        else if (jobPath == NULL) jobPath = args[i];
+        else printf("[WARNING]: Too many arguments. Ignoring '%s'.\n", args[i]);
+    }
+
+    if (jobPath == NULL)
+    {
+        printf("[ERROR]: Not enough arguments.\n");
+        printf("Usage: %s [--threads n] [--slice cycles] [--core name] [--profile name] [--scaling] [--quiet] [--preload romdir] jobs.txt\n", args[0]);
+        return -1;
+    }
+    if (threads < 1 || threads > BATCH_MAX_THREADS || batch.slice == 0)
+    {
+        printf("[ERROR]: Threads must be between 1 and %d and the slice above 0.\n", BATCH_MAX_THREADS);
+        return -1;
+    }
+    batch.cpuCore = FindCore(coreName);
+    if (batch.cpuCore == NULL)
+    {
+        printf("[ERROR]: Unknown core '%s'.\n", coreName);
+        return -1;
+    }
+    batch.quirkProfile = (profileName != NULL) ? FindProfile(profileName) : NULL;
+    if (profileName != NULL && batch.quirkProfile == NULL)
+    {
+        printf("[ERROR]: Unknown profile '%s'.\n", profileName);
+        return -1;
+    }
+    if (preloadPath != NULL && PreloadRoms(preloadPath) < 0) return -1;
+    if (!LoadJobs(jobPath)) return -1;
+    if (batch.jobCount == 0)
+    {
+        printf("[ERROR]: No jobs in '%s'.\n", jobPath);
+        return -1;
+    }
+
+    // With --scaling the batch runs again from scratch at 1, 2, 4... threads up to the requested count,
+    // every machine reset from its ROM's cached image before each run
+    if (!CreateInstances()) return -1;
+    double baseline = 0;
+    uint64_t expectedHash = 0;
+    for (int count = (scaling) ? 1 : threads; ; count = (count*2 < threads) ? count*2 : threads)
+    {
+        ResetInstances();
+        double seconds = RunBatch(count);
+        uint64_t total = TotalCycles();
+        double ips = total / seconds;
+        if (baseline == 0) baseline = ips / count;
+
+        uint64_t slices = 0;
+        uint64_t steals = 0;
+        for (int t=0; t<count; t++)
+        {
+            slices += batch.queues[t].slices;
+            steals += batch.queues[t].steals;
+        }
+
+        printf("%3d threads: %u machines, %lu instructions in %.3fs, %.2f M instructions/sec", count, batch.jobCount, total, seconds, ips / 1e6);
+        if (scaling) printf(", %.0f%% scaling efficiency", 100.0 * ips / (baseline * count));
+        printf(", %lu slices, %lu steals\n", slices, steals);
+
+        // Every thread count has to produce the same machines
+        uint64_t hash = CombinedHash();
+        if (expectedHash && hash != expectedHash) printf("[ERROR]: Results differ from the previous run.\n");
+        expectedHash = hash;
+
+        if (count == threads)
+        {
+            if (!quiet)
+            {
+                for (uint32_t i=0; i<batch.jobCount; i++)
+                {
+                    chip8* cpu = batch.instances[i].cpu;
+                    printf("%u %s: %lu instructions, pc: %03x display hash: %016lx%s\n", i, batch.jobs[i].rom, cpu->cycles,
+                        cpu->pc, HashDisplay(cpu), (cpu->halted) ? " (halted)" : "");
+                }
+            }
+            break;
+        }
+    }
+    FreeInstances();
+    free(batch.jobs);
+    return 0;
+}
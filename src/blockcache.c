@@ -0,0 +1,197 @@
+// Basic block cache. Straight-line runs of instructions are decoded once, keyed by their start address,
+// and then executed without going back through the fetch path. A block ends after any instruction that
+// can change the flow of the program or writes to memory, so a block never outlives its own invalidation.
+
+#define BLOCK_MAX_LENGTH 32 // Instructions
+#define BLOCK_POOL_SIZE 1024
+#define BLOCK_CODE_SIZE sizeof(((chip8*)0)->memory)
+
+typedef struct block {
+    uint16_t start;
+    uint16_t end; // One past the last byte of the block
+    uint8_t length;
+    struct block* nextFree;
+    const decodedOp* ops[BLOCK_MAX_LENGTH];
+
+    // Only used by the JIT core
+    uint16_t runs;
+    uint8_t jitState;
+    uint8_t* native; // Entry of the block's native code, see jit.c
+} block;
+
+struct blockCache {
+    block* blocks[BLOCK_CODE_SIZE]; // Indexed by start address
+    uint8_t coverage[BLOCK_CODE_SIZE]; // Number of blocks that include each byte
+
+    block pool[BLOCK_POOL_SIZE];
+    block* freeList;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    uint64_t flushes;
+
+    // Executable buffer for the JIT core, blocks leak their code until the next flush
+    uint8_t* code;
+    size_t codeUsed;
+    uint64_t (*enterNative)(chip8* cpu, const uint8_t* native, uint64_t budget); // Returns the instructions run
+    uint8_t* exitNative; // Every block leaves through here
+    uint8_t* lastExit; // Exit the native code last left through, if RunJit may link it to its target
+
+    struct {
+        uint64_t compiled;
+        uint64_t links; // Exits patched into jumps to the next block
+        uint64_t nativeRuns; // Entries from RunJit, each goes on through any number of linked blocks
+        uint64_t nativeInstructions;
+        uint64_t calls; // Instructions the native code calls the core for
+        uint64_t interpretedInstructions;
+    } jitStats;
+};
+
+static void JitUnlink(block* b);
+
+static void FlushBlocks(struct blockCache* cache)
+{
+    memset(cache->blocks, 0, sizeof(cache->blocks));
+    memset(cache->coverage, 0, sizeof(cache->coverage));
+    cache->codeUsed = 0;
+
+    cache->freeList = NULL;
+    for (int i=BLOCK_POOL_SIZE-1; i>=0; i--)
+    {
+        cache->pool[i].nextFree = cache->freeList;
+        cache->freeList = &cache->pool[i];
+    }
+}
+
+struct blockCache* CreateBlockCache()
+{
+    struct blockCache* cache = calloc(1, sizeof(struct blockCache));
+    FlushBlocks(cache);
+    return cache;
+}
+
+static bool EndsBlock(uint8_t op)
+{
+    switch (op)
+    {
+        case OP_INVALID:
+        case OP_EXIT:
+        case OP_RETURN_SUBROUTINE:
+        case OP_JUMP:
+        case OP_CALL_SUBROUTINE:
+        case OP_REG_IS_VALUE:
+        case OP_REG_IS_NOT_VALUE:
+        case OP_REG_IS_REG:
+        case OP_REG_IS_NOT_REG:
+        case OP_JUMP_OFFSET:
+        case OP_SKIP_IF_KEY:
+        case OP_SKIP_IF_NOT_KEY:
+        case OP_AWAIT_KEY:
+        case OP_CONVERT_DECIMAL:
+        case OP_STORE_MEMORY:
+        case OP_SET_SOUND_TIMER: // Runs end on it while audio is on
+            return true;
+    }
+    return false;
+}
+
+static block* BuildBlock(chip8* cpu, struct blockCache* cache, uint16_t start)
+{
+    if (cache->freeList == NULL)
+    {
+        FlushBlocks(cache);
+        cache->flushes++;
+    }
+
+    block* b = cache->freeList;
+    cache->freeList = b->nextFree;
+
+    b->start = start;
+    b->length = 0;
+    b->runs = 0;
+    b->jitState = 0;
+    b->native = NULL;
+    uint16_t pc = start;
+    while (b->length < BLOCK_MAX_LENGTH && pc+1 < BLOCK_CODE_SIZE)
+    {
+        const decodedOp* d = &decodeTable[cpu->memory[pc] << 8 | cpu->memory[pc+1]];
+        b->ops[b->length++] = d;
+        pc += 2;
+        if (EndsBlock(d->op)) break;
+    }
+    b->end = pc;
+
+    for (int i=start; i<b->end; i++) cache->coverage[i]++;
+    cache->blocks[start] = b;
+    return b;
+}
+
+// Drops every block that includes a byte in [address, address+length)
+void InvalidateBlocks(struct blockCache* cache, uint16_t address, uint16_t length)
+{
+    uint32_t last = address + length;
+    if (last > BLOCK_CODE_SIZE) last = BLOCK_CODE_SIZE;
+
+    bool covered = false;
+    for (uint32_t i=address; i<last; i++) covered |= cache->coverage[i] != 0;
+    if (!covered) return;
+
+    // A block that covers `address` starts at most BLOCK_MAX_LENGTH instructions before it
+    int first = address - BLOCK_MAX_LENGTH*2 + 1;
+    if (first < 0) first = 0;
+    for (uint32_t start=first; start<last; start++)
+    {
+        block* b = cache->blocks[start];
+        if (b == NULL || b->end <= address) continue;
+
+        for (int i=b->start; i<b->end; i++) cache->coverage[i]--;
+        if (b->native != NULL) JitUnlink(b); // Blocks linked to it could still jump in
+        cache->blocks[start] = NULL;
+        b->nextFree = cache->freeList;
+        cache->freeList = b;
+        cache->invalidations++;
+    }
+}
+
+// One copy of blocks.inc per quirk profile, declared from PROFILE_LIST like RunThreaded
+#define BLOCKS_INSTANCE(id, quirks) static uint64_t RunBlocks##id(chip8* cpu, uint64_t cycles);
+PROFILE_LIST(BLOCKS_INSTANCE)
+
+static uint64_t RunBlocksModern(chip8* cpu, uint64_t cycles)
+{
+    const uint32_t quirks = QUIRKS_MODERN;
+    #include "blocks.inc"
+}
+
+static uint64_t RunBlocksVip(chip8* cpu, uint64_t cycles)
+{
+    const uint32_t quirks = QUIRKS_VIP;
+    #include "blocks.inc"
+}
+
+static uint64_t RunBlocksSchip(chip8* cpu, uint64_t cycles)
+{
+    const uint32_t quirks = QUIRKS_SCHIP;
+    #include "blocks.inc"
+}
+
+static uint64_t RunBlocksXoChip(chip8* cpu, uint64_t cycles)
+{
+    const uint32_t quirks = QUIRKS_XOCHIP;
+    #include "blocks.inc"
+}
+
+uint64_t RunBlocks(chip8* cpu, uint64_t cycles)
+{
+    #define BLOCKS_ENTRY(id, quirks) RunBlocks##id,
+    static uint64_t (*const instances[PROFILE_COUNT])(chip8*, uint64_t) = { PROFILE_LIST(BLOCKS_ENTRY) };
+    return instances[PROFILE_INDEX(cpu)](cpu, cycles);
+}
+
+void PrintBlockCacheStats(struct blockCache* cache)
+{
+    uint64_t lookups = cache->hits + cache->misses;
+    printf("Block cache: %lu hits, %lu misses (%.2f%% hit rate), %lu invalidations, %lu flushes\n",
+        cache->hits, cache->misses, lookups ? 100.0 * cache->hits / lookups : 0.0, cache->invalidations, cache->flushes);
+}
@@ -0,0 +1,306 @@
+// Frame capture. Every emulated frame (every timer tick) is copied into the next slot of a lock-free single
+// producer/single consumer ring, the same scheme as the trace, and a background thread streams it to the
+// capture files. The emulator only ever copies the packed bit planes, the writer scales lo-res frames up to
+// SCREEN_WIDTH x SCREEN_HEIGHT and turns them into pixels, each colour picked by its bit in the two planes.
+// The format of each file comes from its extension:
+//
+//     .y4m   YUV4MPEG2, 4:4:4 at 60 fps, plays in most video tools
+//     .rgba  Raw RGBA frames, SCREEN_WIDTH x SCREEN_HEIGHT x 4 bytes each, no header
+//     .bits  Raw packed frames, each plane in turn as rows of SCREEN_WIDTH/8 bytes with x=0 in the top bit
+//     .rle   Packed frames as [uint32_t size][delta], each delta the XOR against the frame before in the
+//            rewind's run-length format (savestate.c), the first against a blank frame, after a "C8FRAMES 2"
+//            line. An unchanged frame costs 8 bytes.
+//
+// When the writer falls behind, the emulator either waits for a free slot or, with `dropFrames`, skips the
+// frame and carries on so the disk never holds up emulation.
+//
+// The display is copied into its slot the way PublishFrame copies it into the render thread's back buffer.
+// The machine keeps drawing into its own display, so each frame has to land somewhere the writer owns, and
+// unlike the renderer's triple buffer a capture can't just keep the newest frame. That's 2kB, about 60ns,
+// per tick, next to the ~5us the writer spends on the same frame.
+#include <sched.h>
+#include <stdatomic.h>
+
+#define CAPTURE_RING_SIZE 256 // Frames, must be a power of two
+#define CAPTURE_RING_MASK (CAPTURE_RING_SIZE - 1)
+#define CAPTURE_FRAME_BYTES (SCREEN_WIDTH / 8 * SCREEN_HEIGHT * DISPLAY_PLANES)
+
+typedef enum {
+    CAPTURE_Y4M,
+    CAPTURE_RGBA,
+    CAPTURE_BITS,
+    CAPTURE_RLE,
+} captureFormat;
+
+typedef struct {
+    FILE* file;
+    captureFormat format;
+    uint64_t bytes;
+} captureFile;
+
+struct {
+    bool enabled;
+    bool dropFrames;
+
+    captureFile files[CAPTURE_MAX_FILES];
+    int fileCount;
+
+    framebuffer* ring;
+    _Atomic uint32_t head; // Next slot the emulator writes, only advanced by the emulator
+    _Atomic uint32_t tail; // Next slot the writer drains, only advanced by the writer
+    _Atomic bool stop;
+    pthread_t writer;
+
+    // Writer's buffers
+    uint64_t planes[DISPLAY_PLANES][SCREEN_HEIGHT][SCREEN_WORDS]; // The frame at full resolution
+    uint8_t previous[CAPTURE_FRAME_BYTES]; // Last frame written to the .rle files
+    uint8_t packed[CAPTURE_FRAME_BYTES];
+    uint8_t delta[CAPTURE_FRAME_BYTES * 3 + 8];
+    uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint8_t yuv[3][SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint32_t palette[4]; // By the pixel's bit in each plane, plane 0 the low bit
+    uint8_t yuvPalette[4][3];
+
+    uint64_t frames;
+    uint64_t dropped; // Frames skipped because the ring was full
+    uint64_t stalls; // Times the emulator had to wait for the writer to free up space
+} captureState;
+
+// BT.601 limited range, the Y4M default
+static void ColorToYuv(uint32_t color, uint8_t* yuv)
+{
+    double r = color & 0xFF, g = (color >> 8) & 0xFF, b = (color >> 16) & 0xFF;
+    yuv[0] = 16.5 + (65.481*r + 128.553*g + 24.966*b) / 255;
+    yuv[1] = 128.5 + (-37.797*r - 74.203*g + 112.0*b) / 255;
+    yuv[2] = 128.5 + (112.0*r - 93.786*g - 18.214*b) / 255;
+}
+
+// Bit i of a 32-bit value moved to bit 2i
+static uint64_t SpreadBits(uint32_t value)
+{
+    uint64_t x = value;
+    x = (x | x << 16) & 0x0000FFFF0000FFFF;
+    x = (x | x << 8) & 0x00FF00FF00FF00FF;
+    x = (x | x << 4) & 0x0F0F0F0F0F0F0F0F;
+    x = (x | x << 2) & 0x3333333333333333;
+    x = (x | x << 1) & 0x5555555555555555;
+    return x;
+}
+
+// Lo-res frames get every pixel doubled in both directions, every word of a row turning into two
+static void ExpandCaptureFrame(const framebuffer* fb)
+{
+    if (fb->hires)
+    {
+        memcpy(captureState.planes, fb->planes, sizeof(captureState.planes));
+        return;
+    }
+    for (int p=0; p<DISPLAY_PLANES; p++)
+    {
+        for (int y=0; y<SCREEN_HEIGHT; y++)
+        {
+            for (int w=0; w<SCREEN_WORDS; w++)
+            {
+                uint64_t source = fb->planes[p][y/2][w/2];
+                uint64_t spread = SpreadBits((w % 2) ? (uint32_t)source : source >> 32);
+                captureState.planes[p][y][w] = spread | spread << 1;
+            }
+        }
+    }
+}
+
+static inline int CapturePixel(int x, int y)
+{
+    int color = 0;
+    for (int p=0; p<DISPLAY_PLANES; p++) color |= ((captureState.planes[p][y][x/64] >> (63 - x%64)) & 1) << p;
+    return color;
+}
+
+static void WriteCaptureFrame(captureFile* f)
+{
+    switch (f->format)
+    {
+        case CAPTURE_Y4M:
+        {
+            for (int y=0; y<SCREEN_HEIGHT; y++)
+            {
+                for (int x=0; x<SCREEN_WIDTH; x++)
+                {
+                    const uint8_t* yuv = captureState.yuvPalette[CapturePixel(x, y)];
+                    for (int p=0; p<3; p++) captureState.yuv[p][y*SCREEN_WIDTH + x] = yuv[p];
+                }
+            }
+            fputs("FRAME\n", f->file);
+            fwrite(captureState.yuv, sizeof(captureState.yuv), 1, f->file);
+            f->bytes += 6 + sizeof(captureState.yuv);
+        } break;
+
+        case CAPTURE_RGBA:
+        {
+            for (int y=0; y<SCREEN_HEIGHT; y++)
+            {
+                for (int x=0; x<SCREEN_WIDTH; x++) captureState.pixels[y*SCREEN_WIDTH + x] = captureState.palette[CapturePixel(x, y)];
+            }
+            fwrite(captureState.pixels, sizeof(captureState.pixels), 1, f->file);
+            f->bytes += sizeof(captureState.pixels);
+        } break;
+
+        case CAPTURE_BITS:
+        {
+            fwrite(captureState.packed, sizeof(captureState.packed), 1, f->file);
+            f->bytes += sizeof(captureState.packed);
+        } break;
+
+        case CAPTURE_RLE:
+        {
+            uint32_t size = EncodeDelta(captureState.packed, captureState.previous, CAPTURE_FRAME_BYTES, captureState.delta);
+            fwrite(&size, sizeof(size), 1, f->file);
+            fwrite(captureState.delta, size, 1, f->file);
+            f->bytes += sizeof(size) + size;
+        } break;
+    }
+}
+
+static void* CaptureWriter(void* arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        uint32_t tail = atomic_load_explicit(&captureState.tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&captureState.head, memory_order_acquire);
+
+        if (head == tail)
+        {
+            if (atomic_load_explicit(&captureState.stop, memory_order_acquire))
+            {
+                // The emulator stops producing before it raises the flag, so one more look is enough
+                if (atomic_load_explicit(&captureState.head, memory_order_acquire) == tail) break;
+                continue;
+            }
+            struct timespec nap = { 0, 1000000 }; // 1ms
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        ExpandCaptureFrame(&captureState.ring[tail & CAPTURE_RING_MASK]);
+        const uint64_t* words = &captureState.planes[0][0][0];
+        for (int i=0; i<DISPLAY_PLANES * SCREEN_HEIGHT * SCREEN_WORDS; i++)
+        {
+            uint64_t bigEndian = __builtin_bswap64(words[i]);
+            memcpy(&captureState.packed[i * 8], &bigEndian, 8);
+        }
+        for (int i=0; i<captureState.fileCount; i++) WriteCaptureFrame(&captureState.files[i]);
+        memcpy(captureState.previous, captureState.packed, CAPTURE_FRAME_BYTES);
+
+        atomic_store_explicit(&captureState.tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static bool OpenCaptureFile(const char* path, captureFile* f)
+{
+    const char* extension = strrchr(path, '.');
+    if (extension == NULL) extension = "";
+    if (!strcmp(extension, ".y4m")) f->format = CAPTURE_Y4M;
+    else if (!strcmp(extension, ".rgba")) f->format = CAPTURE_RGBA;
+    else if (!strcmp(extension, ".bits")) f->format = CAPTURE_BITS;
+    else if (!strcmp(extension, ".rle")) f->format = CAPTURE_RLE;
+    else
+    {
+        printf("[ERROR]: Unknown capture format '%s', use .y4m, .rgba, .bits or .rle.\n", path);
+        return false;
+    }
+
+    f->file = fopen(path, "wb");
+    if (f->file == NULL)
+    {
+        printf("[ERROR]: Failed to open capture file: '%s'\n", path);
+        return false;
+    }
+    f->bytes = 0;
+    if (f->format == CAPTURE_Y4M) f->bytes = fprintf(f->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", SCREEN_WIDTH, SCREEN_HEIGHT, TIMER_HZ);
+    if (f->format == CAPTURE_RLE) f->bytes = fprintf(f->file, "C8FRAMES 2\n");
+    return true;
+}
+
+bool CaptureStart(const char* const* paths, int count, bool dropFrames)
+{
+    if (count > CAPTURE_MAX_FILES)
+    {
+        printf("[ERROR]: At most %d capture files at a time.\n", CAPTURE_MAX_FILES);
+        return false;
+    }
+    for (int i=0; i<count; i++)
+    {
+        if (!OpenCaptureFile(paths[i], &captureState.files[i]))
+        {
+            for (int j=0; j<i; j++) fclose(captureState.files[j].file);
+            return false;
+        }
+    }
+    captureState.fileCount = count;
+    captureState.dropFrames = dropFrames;
+    captureState.frames = captureState.dropped = captureState.stalls = 0;
+    memset(captureState.previous, 0, sizeof(captureState.previous));
+    const uint32_t colors[4] = { COLOR_OFF, COLOR_ON, COLOR_PLANE2, COLOR_BOTH };
+    for (int i=0; i<4; i++)
+    {
+        captureState.palette[i] = 0xFF000000 | colors[i];
+        ColorToYuv(colors[i], captureState.yuvPalette[i]);
+    }
+
+    captureState.ring = malloc(CAPTURE_RING_SIZE * sizeof(*captureState.ring));
+    atomic_store(&captureState.head, 0);
+    atomic_store(&captureState.tail, 0);
+    atomic_store(&captureState.stop, false);
+
+    if (pthread_create(&captureState.writer, NULL, CaptureWriter, NULL) != 0)
+    {
+        printf("[ERROR]: Failed to start capture writer thread.\n");
+        for (int i=0; i<count; i++) fclose(captureState.files[i].file);
+        free(captureState.ring);
+        return false;
+    }
+
+    captureState.enabled = true;
+    return true;
+}
+
+void CaptureStop()
+{
+    if (!captureState.enabled) return;
+    captureState.enabled = false;
+
+    atomic_store_explicit(&captureState.stop, true, memory_order_release);
+    pthread_join(captureState.writer, NULL);
+
+    uint64_t bytes = 0;
+    for (int i=0; i<captureState.fileCount; i++)
+    {
+        fclose(captureState.files[i].file);
+        bytes += captureState.files[i].bytes;
+    }
+    free(captureState.ring);
+    printf("Captured %lu frames to %d files (%.1f KB), %lu dropped, %lu writer stalls\n", captureState.frames,
+        captureState.fileCount, bytes / 1024.0, captureState.dropped, captureState.stalls);
+}
+
+// Only ever called from the emulation thread, at every timer tick
+static void CaptureFrame(const chip8* cpu)
+{
+    uint32_t head = atomic_load_explicit(&captureState.head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&captureState.tail, memory_order_acquire) == CAPTURE_RING_SIZE)
+    {
+        if (captureState.dropFrames)
+        {
+            captureState.dropped++;
+            return;
+        }
+        captureState.stalls++;
+        while (head - atomic_load_explicit(&captureState.tail, memory_order_acquire) == CAPTURE_RING_SIZE) sched_yield();
+    }
+
+    captureState.ring[head & CAPTURE_RING_MASK] = cpu->display; // See the top of the file for why it's a copy
+    atomic_store_explicit(&captureState.head, head + 1, memory_order_release);
+    captureState.frames++;
+}
@@ -0,0 +1,271 @@
+// Interface of the CHIP-8 core library (libchip8.a, built from core.c). Nothing here depends on SDL:
+// frontends set the keypad, run the machine for a number of cycles or frames and read the framebuffer.
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef uint8_t bool;
+#define false 0
+#define true 1
+
+#define MEMORY_SIZE 4096
+#define ROM_MAX_SIZE (MEMORY_SIZE - 0x200) // Programs start at 0x200
+#define BIG_FONT_START 80 // FX30's 8x10 digits, right after the 4x5 ones at 0
+
+// Hi-res (SUPER-CHIP 00FF) is the whole framebuffer, lo-res only uses its top left corner
+#define SCREEN_WIDTH 128
+#define SCREEN_HEIGHT 64
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+#define SCREEN_WORDS (SCREEN_WIDTH / 64) // Words per row
+#define DISPLAY_PLANES 2 // XO-CHIP bit planes, a pixel's colour is its bit in each
+
+#define CLOCK_HZ 10000//500
+#define TIMER_HZ 60
+
+// Pixel colours as 0xAABBGGRR, which is RGBA byte order in memory
+#define COLOR_ON 0x77FF33
+#define COLOR_OFF 0x223500
+#define COLOR_PLANE2 0x2277FF // Only the second XO-CHIP plane set
+#define COLOR_BOTH 0xCCFFEE // Both planes set
+
+// Quirks, the behaviours CHIP-8 platforms disagree on. A profile is a named set of them, see profiles.c
+#define QUIRK_VF_RESET (1 << 0) // AND, OR and XOR reset VF
+#define QUIRK_MEMORY_INCREMENT (1 << 1) // FX55 and FX65 leave I pointing past the last register
+#define QUIRK_SHIFT_VY (1 << 2) // 8XY6 and 8XYE shift VY into VX instead of shifting VX
+#define QUIRK_JUMP_VX (1 << 3) // BXNN jumps to XNN + VX instead of NNN + V0
+
+#define FORK_PAGE_SIZE 256 // Granularity of copy-on-write forks, see fork.c
+#define FORK_DISPLAY_DIRTY (1u << 31)
+
+struct blockCache;
+struct core;
+struct profile;
+struct machineFork;
+
+typedef struct {
+    uint64_t planes[DISPLAY_PLANES][SCREEN_HEIGHT][SCREEN_WORDS]; // A row is SCREEN_WORDS words, x=0 in the top bit of the first
+    bool hires; // 128x64, otherwise the rows and columns past 64x32 stay blank
+} framebuffer;
+
+typedef struct {
+    uint16_t opcode;
+
+    _Alignas(64) uint8_t memory[MEMORY_SIZE]; // 4kB ram, aligned so a reset is one aligned copy
+    framebuffer display;
+
+    // Registers
+    uint8_t V[16]; // General purpose registers VF is also carry flag
+    uint16_t I; // Index register
+    uint16_t pc; // Program counter
+    //uint8_t VF; // Carry flag
+
+    uint16_t stack[16]; // We love the stack
+    uint8_t sp; // Stack pointer
+
+    uint8_t planeMask; // Planes that drawing, scrolling and clearing act on, set by XO-CHIP FN01
+
+    uint16_t keypad; // Bit i is set while key i is down
+
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+
+    uint64_t rngState; // CXNN draws from here instead of rand() so a seed always replays the same way
+
+    // Emulated time, the timers tick every clockHz/TIMER_HZ instructions no matter how fast the host runs
+    uint64_t cycles; // Instructions executed
+    uint64_t ticks; // Timer ticks so far
+    uint32_t clockHz; // Instructions per emulated second
+    uint64_t idleCycles; // Instructions skipped inside wait loops, counted in `cycles` too
+    bool noIdleSkip; // Run wait loops instruction by instruction, set on the validator's reference
+
+    uint8_t halted;
+
+    uint8_t drawFlag;
+    uint64_t dirtyRows; // Bit y is set when row y was drawn to, scrolled or cleared since the frontend last looked
+
+    const struct core* core; // Interpreter that runs this machine
+    const struct profile* profile; // Quirks it runs with, every core has a copy specialized for each profile
+    uint64_t romHash; // FNV-1a of the ROM file, looked up in the profile database
+    struct blockCache* blockCache; // Decoded blocks for the block core, NULL for the other cores
+
+    // Fork the machine was last restored from or forked into, and what changed since: bit i for memory page i,
+    // FORK_DISPLAY_DIRTY for the display. Pages that didn't change are shared with the next fork.
+    struct machineFork* forkBase;
+    uint32_t dirtyPages;
+} chip8;
+
+typedef struct core {
+    const char* name;
+    uint64_t (*run)(chip8* cpu, uint64_t cycles); // Runs up to `cycles` instructions, returns how many ran
+} core;
+
+extern const core cores[];
+extern const int coreCount;
+const core* FindCore(const char* name); // NULL if there is no core by that name
+
+typedef struct profile {
+    const char* name;
+    const char* description;
+    uint32_t quirks;
+} profile;
+
+extern const profile profiles[];
+extern const int profileCount;
+const profile* FindProfile(const char* name); // NULL if there is no profile by that name
+const profile* DetectProfile(uint64_t romHash); // The database's profile for a ROM, NULL if it isn't in there
+void SetProfile(chip8* cpu, const profile* p);
+
+// Machine
+chip8* CreateMachine(const core* cpuCore); // Powered on with the font loaded, the RNG seeded from the time, CLOCK_HZ and profiles[0]
+void DestroyMachine(chip8* cpu);
+bool LoadRom(chip8* cpu, const char* path); // Also switches to the detected profile, call SetProfile after it to override
+void SeedRandom(chip8* cpu, uint64_t seed);
+
+// ROM cache, see romcache.c. Each ROM file is read once into a pristine memory image with the font in place,
+// shared by every machine that runs it and never changed after.
+typedef struct romImage {
+    _Alignas(64) uint8_t memory[MEMORY_SIZE];
+    uint64_t hash; // FNV-1a of the ROM file
+    uint32_t size;
+    struct romImage* next; // In the cache's bucket
+} romImage;
+
+const romImage* LoadRomImage(const char* path); // NULL if the file can't be loaded, later loads of the path don't read it again
+int PreloadRoms(const char* directory); // Caches every .ch8 in the directory, returns how many or -1
+void ResetMachine(chip8* cpu, const romImage* rom); // Power on with the ROM loaded, keeps the core, profile, clock rate and RNG
+
+// Running
+uint64_t ExecuteCycles(chip8* cpu, uint64_t cycles); // Returns the instructions run, fewer if the machine halted
+uint64_t ExecuteFrames(chip8* cpu, uint64_t frames); // Runs until `frames` more timer ticks have happened
+uint64_t NextTickCycle(const chip8* cpu); // Instruction count at which the next timer tick happens
+void SetKeypad(chip8* cpu, uint16_t keys);
+const framebuffer* ReadFramebuffer(const chip8* cpu);
+uint64_t HashDisplay(const chip8* cpu);
+void PrintCoreStats(const chip8* cpu);
+void EmulateCycle(chip8* cpu); // One instruction on the interpreter, no timers or cycle count. Cores fall back on it
+
+// One instruction's effect without fetching or decoding it, for translated code (tools/aot.c)
+void ExecuteClear(chip8* cpu); // 00E0
+void ExecuteDraw(chip8* cpu, uint8_t regX, uint8_t regY, uint8_t height); // DXYN, sets VF
+void ExecuteScroll(chip8* cpu, int right, int down); // 00CN, 00DN, 00FB and 00FC, one of the two is 0
+void ExecuteResolution(chip8* cpu, bool hires); // 00FE and 00FF
+uint8_t ExecuteRandom(chip8* cpu, uint8_t mask); // CXNN's value
+void MemoryWritten(chip8* cpu, uint16_t address, uint16_t length); // After a store, keeps block caches and forks in sync
+
+// Tracing, see trace.c
+bool TraceStart(const char* path);
+void TraceStop();
+int FormatMnemonic(uint16_t opcode, char* out, size_t size); // The trace's mnemonic text, see mnemonic.c
+
+// Hot-spot profiler, see hotspots.c
+#define HOTSPOT_PERIOD 1000 // Default instructions per sample
+bool HotspotsStart(const char* path, uint32_t period); // Collapsed stacks go to `path`, period 0 counts every instruction
+void HotspotsStop(); // Writes the stacks and prints the hottest addresses and opcode groups
+
+// Frame capture, see capture.c. Every timer tick's frame goes to each file in the format of its extension:
+// .y4m video, .rgba raw pixels, .bits packed 1-bit frames or .rle packed frames run-length encoded.
+#define CAPTURE_MAX_FILES 4
+bool CaptureStart(const char* const* paths, int count, bool dropFrames); // Drops frames instead of waiting when the disk falls behind
+void CaptureStop(); // Finishes writing and prints the stats
+
+// Audio, see audio.c. The emulation thread queues buzzer edges stamped with the instruction they happened at,
+// the frontend's audio callback turns them into samples.
+bool AudioStart(uint32_t sampleRate, uint32_t buffer, uint32_t clockHz); // Buffer in samples, clockHz is the speed played back at
+void AudioStop(); // Prints the stats, after the audio device stopped calling back
+void AudioRender(int16_t* out, uint32_t count); // From the audio callback only, never locks or allocates
+
+// ROM analysis, see disasm.c
+#define ANALYSIS_CODE (1 << 0) // An instruction starts here
+#define ANALYSIS_CODE_BYTE (1 << 1) // Either byte of a reachable instruction
+#define ANALYSIS_BLOCK_START (1 << 2)
+#define ANALYSIS_CALL_TARGET (1 << 3) // A 2NNN calls here
+#define ANALYSIS_DATA (1 << 4) // Read by DXYN or FX65 with I set by an ANNN earlier in the block
+#define ANALYSIS_WRITTEN (1 << 5) // Written by FX33 or FX55, same condition
+
+typedef struct {
+    uint16_t start;
+    uint16_t end; // One past its last instruction
+    uint16_t successors[2]; // Known statically, a skip's taken branch second
+    uint8_t successorCount;
+    bool fallsThrough; // Ends only because the next block starts at `end`
+    bool dynamic; // Can also leave for an address only known at run time (00EE, BNNN, FX0A)
+} analysisBlock;
+
+typedef struct {
+    uint8_t flags[4096]; // ANALYSIS_* for every address
+    analysisBlock* blocks; // In address order
+    uint32_t blockCount;
+    uint32_t instructions;
+    uint32_t unknownWrites; // Stores whose I isn't known statically, they could write anywhere
+    uint32_t codeWrites; // Code bytes written by stores whose I is known
+    uint32_t indirectJumps; // BNNN, which can go where the analysis never looked
+} romAnalysis;
+
+romAnalysis* AnalyzeRom(const chip8* cpu); // Everything reachable from 0x200 in the machine's memory, with its quirks
+void FreeAnalysis(romAnalysis* a);
+
+// Savestates and rewind, see savestate.c
+typedef struct rewindBuffer rewindBuffer;
+bool SaveState(const chip8* cpu, const char* path);
+bool LoadState(chip8* cpu, const char* path);
+rewindBuffer* CreateRewindBuffer();
+void FreeRewindBuffer(rewindBuffer* history);
+void RewindPush(rewindBuffer* history, const chip8* cpu);
+bool RewindStep(rewindBuffer* history, chip8* cpu);
+void PrintRewindStats(const rewindBuffer* history);
+
+// Input movies, see movie.c
+typedef struct {
+    uint64_t cycle;
+    uint16_t keys;
+} movieEvent;
+
+typedef struct {
+    uint64_t romHash;
+    uint64_t seed;
+    uint32_t clockHz;
+    const profile* profile;
+    uint64_t endCycle;
+
+    movieEvent* events;
+    uint32_t count;
+    uint32_t capacity;
+} movie;
+
+void MovieAddEvent(movie* m, uint64_t cycle, uint16_t keys);
+void FreeMovie(movie* m);
+bool SaveMovie(const movie* m, const char* path);
+bool LoadMovie(movie* m, const char* path);
+
+// Differential validation, see validate.c. Both machines start out the same, the reference on the switch core.
+// Compares them every `every` instructions, prints the first mismatch and returns false if there is one.
+bool ValidateCore(chip8* reference, chip8* candidate, const movie* script, uint64_t cycles, uint64_t every);
+
+// Copy-on-write forks, see fork.c. A pool is not thread safe, give every thread its own.
+typedef struct forkPool forkPool;
+typedef struct machineFork machineFork;
+forkPool* CreateForkPool();
+void FreeForkPool(forkPool* pool); // Release every fork and detach every machine from the pool first
+machineFork* ForkMachine(forkPool* pool, chip8* cpu); // Snapshot of the machine, which then continues from it
+void RestoreFork(chip8* cpu, machineFork* fork);
+void ReleaseFork(machineFork* fork);
+void DetachFork(chip8* cpu); // Lets go of the machine's base fork, DestroyMachine does this too
+void PrintForkStats(const forkPool* pool);
+
+// Lockstep lanes, see lockstep.c
+#define LOCKSTEP_MAX_LANES 32
+typedef struct lockstep lockstep;
+lockstep* CreateLockstep(const chip8* prototype, int lanes); // Every lane starts as a copy of `prototype`
+void DestroyLockstep(lockstep* ls);
+void LockstepSeed(lockstep* ls, int lane, uint64_t seed);
+void LockstepSetKeypad(lockstep* ls, int lane, uint16_t keys);
+uint64_t LockstepExecute(lockstep* ls, uint64_t cycles); // Returns the instructions run summed over the lanes
+void LockstepExtract(const lockstep* ls, int lane, chip8* cpu);
+void PrintLockstepStats(const lockstep* ls);
+
+#endif
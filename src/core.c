@@ -0,0 +1,811 @@
+// The emulator core, built on its own into libchip8.a. Like the frontend it is a single translation unit,
+// the interpreter lives here and the other cores and features are included below. See chip8.h for the interface.
+#include <time.h>
+#include <pthread.h>
+
+#include "chip8.h"
+
+uint8_t fontSet[BIG_FONT_START + 160] = {
+  0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+  0x20, 0x60, 0x20, 0x20, 0x70, // 1
+  0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+  0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+  0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+  0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+  0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+  0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+  0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+  0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+  0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+  0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+  0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+  0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+  0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+  0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+
+  0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+  0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+  0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+  0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+  0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+  0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+  0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+  0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+  0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+  0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+  0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+  0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+void SeedRandom(chip8* cpu, uint64_t seed)
+{
+    cpu->rngState = seed * 0x9E3779B97F4A7C15ull | 1; // Spreads small seeds out, xorshift can't start from 0
+}
+
+// xorshift64, returns the high half which has the better bits
+static inline uint32_t XorShift(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x >> 32;
+}
+
+static inline uint32_t NextRandom(chip8* cpu)
+{
+    return XorShift(&cpu->rngState);
+}
+
+void DetachFork(chip8* cpu);
+uint64_t RunBlocks(chip8* cpu, uint64_t cycles);
+uint64_t RunJit(chip8* cpu, uint64_t cycles);
+struct blockCache* CreateBlockCache();
+static void FlushBlocks(struct blockCache* cache);
+void FreeBlockCache(struct blockCache* cache);
+void InitDispatch();
+static void InitDisplay();
+static uint32_t EncodeDelta(const uint8_t* a, const uint8_t* b, uint32_t size, uint8_t* out);
+
+chip8* CreateMachine(const core* cpuCore)
+{
+    static pthread_once_t dispatchOnce = PTHREAD_ONCE_INIT;
+    static pthread_once_t displayOnce = PTHREAD_ONCE_INIT;
+    pthread_once(&dispatchOnce, InitDispatch); // The decode table is shared by every machine
+    pthread_once(&displayOnce, InitDisplay);
+
+    // Cache line aligned so machines that run on different threads never share a line
+    size_t size = (sizeof(chip8) + 63) & ~(size_t)63;
+    chip8* cpu = aligned_alloc(64, size);
+    memset(cpu, 0, size);
+
+    SeedRandom(cpu, time(NULL)); // Initialize rng
+
+    memcpy(cpu->memory, fontSet, sizeof(fontSet)); // Load font
+
+    cpu->pc = 0x200; // Program starts at 200
+    cpu->planeMask = 1;
+    cpu->clockHz = CLOCK_HZ;
+    cpu->core = cpuCore;
+    cpu->profile = &profiles[0];
+    if (cpuCore->run == RunBlocks || cpuCore->run == RunJit) cpu->blockCache = CreateBlockCache();
+    return cpu;
+}
+
+void DestroyMachine(chip8* cpu)
+{
+    DetachFork(cpu);
+    if (cpu->blockCache) FreeBlockCache(cpu->blockCache);
+    free(cpu);
+}
+
+bool LoadRom(chip8* cpu, const char* path)
+{
+    const romImage* rom = LoadRomImage(path);
+    if (rom == NULL) return false;
+
+    memcpy(cpu->memory, rom->memory, sizeof(cpu->memory));
+    if (cpu->blockCache) FlushBlocks(cpu->blockCache);
+    cpu->dirtyPages = ~0u;
+
+    cpu->romHash = rom->hash;
+    const profile* detected = DetectProfile(cpu->romHash);
+    if (detected != NULL) SetProfile(cpu, detected); // Quietly, the frontends say which one they run with
+    return true;
+}
+
+#include "opcodes.h"
+#include "display.c"
+#include "trace.c"
+#include "hotspots.c"
+#include "capture.c"
+#include "audio.c"
+
+// Quirk profiles, in the order of profiles[]. Every interpreter is compiled once per profile with its quirks
+// as a constant, so checking a quirk costs nothing at run time and the machine's profile picks the copy.
+#define QUIRKS_MODERN 0
+#define QUIRKS_VIP (QUIRK_VF_RESET | QUIRK_MEMORY_INCREMENT | QUIRK_SHIFT_VY)
+#define QUIRKS_SCHIP QUIRK_JUMP_VX
+#define QUIRKS_XOCHIP (QUIRK_MEMORY_INCREMENT | QUIRK_SHIFT_VY)
+#define PROFILE_LIST(X) X(Modern, QUIRKS_MODERN) X(Vip, QUIRKS_VIP) X(Schip, QUIRKS_SCHIP) X(XoChip, QUIRKS_XOCHIP)
+#define PROFILE_COUNT 4
+#define PROFILE_INDEX(cpu) ((cpu)->profile - profiles)
+
+// Templates take the quirks as an argument and have to be inlined into each instance for them to fold away
+#if defined(__GNUC__)
+    #define SPECIALIZED static inline __attribute__((always_inline))
+#else
+    #define SPECIALIZED static inline
+#endif
+
+void InvalidateBlocks(struct blockCache* cache, uint16_t address, uint16_t length);
+
+// Every display opcode hands the rows it changed to this
+static inline void DisplayChanged(chip8* cpu, uint64_t rows)
+{
+    cpu->dirtyRows |= rows;
+    cpu->dirtyPages |= FORK_DISPLAY_DIRTY;
+    if (cpu->dirtyRows) cpu->drawFlag = 1;
+}
+
+static inline void ClearScreen(chip8* cpu)
+{
+    DisplayChanged(cpu, DisplayClear(&cpu->display, cpu->planeMask));
+}
+
+static inline void DrawSprite(chip8* cpu, uint8_t regX, uint8_t regY, uint8_t height)
+{
+    // A sprite running off the end of memory reads zeros there, the same as the lockstep lanes
+    uint8_t padded[16 * 2 * DISPLAY_PLANES];
+    const uint8_t* sprite = padded;
+    if (cpu->I <= MEMORY_SIZE - sizeof(padded)) sprite = &cpu->memory[cpu->I];
+    else
+    {
+        memset(padded, 0, sizeof(padded));
+        if (cpu->I < MEMORY_SIZE) memcpy(padded, &cpu->memory[cpu->I], MEMORY_SIZE - cpu->I);
+    }
+
+    cpu->V[0xF] = 0; // Before reading the coordinates, DXYN with X or Y = F draws at 0
+    cpu->V[0xF] = DisplayDraw(&cpu->display, cpu->planeMask, cpu->V[regX], cpu->V[regY], height, sprite, &cpu->dirtyRows);
+    cpu->drawFlag = 1;
+    cpu->dirtyPages |= FORK_DISPLAY_DIRTY;
+}
+
+// Every opcode that writes to memory has to call this so cached code and forks stay in sync
+// FX33/FX55/FX65 past the end of memory read zeros and drop their writes, the same as the lockstep lanes
+static inline uint8_t ReadMemory(const chip8* cpu, uint32_t address)
+{
+    return (address < MEMORY_SIZE) ? cpu->memory[address] : 0;
+}
+
+static inline void WriteMemory(chip8* cpu, uint32_t address, uint8_t value)
+{
+    if (address < MEMORY_SIZE) cpu->memory[address] = value;
+}
+
+static inline void MarkMemoryWritten(chip8* cpu, uint16_t address, uint16_t length)
+{
+    uint32_t first = address / FORK_PAGE_SIZE;
+    uint32_t last = (address + length - 1) / FORK_PAGE_SIZE;
+    if (last > 30) last = 30; // Bit 31 is the display
+    if (first <= last) cpu->dirtyPages |= (2u << last) - (1u << first);
+    if (cpu->blockCache) InvalidateBlocks(cpu->blockCache, address, length);
+}
+
+// We do both at the same time because it is simpler, atleast for the CHIP-8
+SPECIALIZED void DecodeAndExecute(chip8* cpu, const uint32_t quirks)
+{
+    switch (cpu->opcode & 0xF000)
+    {
+        case 0x0000: // 0NNN 
+            switch (cpu->opcode)
+            {
+                case OPCODE_CLEAR_SCREEN:
+                {
+                    ClearScreen(cpu);
+                } break;
+
+                case OPCODE_RETURN_SUBROUTINE:
+                {
+                    if (cpu->sp == 0)
+                    {
+                        printf("[WARNING]: Stack is empty. Ignoring instruction.\n");
+                        break;
+                    }
+                    cpu->sp--;
+                    cpu->pc = cpu->stack[cpu->sp];
+                } break;
+
+                case OPCODE_SCROLL_RIGHT:
+                {
+                    DisplayChanged(cpu, DisplayScrollHorizontal(&cpu->display, cpu->planeMask, 4));
+                } break;
+
+                case OPCODE_SCROLL_LEFT:
+                {
+                    DisplayChanged(cpu, DisplayScrollHorizontal(&cpu->display, cpu->planeMask, -4));
+                } break;
+
+                case OPCODE_EXIT:
+                {
+                    cpu->halted = 1;
+                } break;
+
+                case OPCODE_LORES:
+                case OPCODE_HIRES:
+                {
+                    DisplayChanged(cpu, DisplaySetResolution(&cpu->display, cpu->opcode == OPCODE_HIRES));
+                } break;
+
+                default:
+                {
+                    if ((cpu->opcode & 0xFFF0) == OPCODE_SCROLL_DOWN || (cpu->opcode & 0xFFF0) == OPCODE_SCROLL_UP)
+                    {
+                        int rows = OPCODE_N(cpu->opcode);
+                        DisplayChanged(cpu, DisplayScrollVertical(&cpu->display, cpu->planeMask, ((cpu->opcode & 0xFFF0) == OPCODE_SCROLL_UP) ? -rows : rows));
+                        break;
+                    }
+                    printf("[ERROR]: Invalid opcode: '%04x'\n", cpu->opcode);
+                    cpu->halted = 1;
+                } break;
+            } break;
+
+        case OPCODE_ARITHMETIC:
+        {
+            switch (OPCODE_N(cpu->opcode))
+            {
+                case OPCODE_SET:
+                {
+                    cpu->V[OPCODE_X(cpu->opcode)] = cpu->V[OPCODE_Y(cpu->opcode)];
+                } break;
+
+                case OPCODE_BINARY_OR:
+                {
+                    cpu->V[OPCODE_X(cpu->opcode)] |= cpu->V[OPCODE_Y(cpu->opcode)];
+                    if (quirks & QUIRK_VF_RESET) cpu->V[0xF] = 0;
+                } break;
+
+                case OPCODE_BINARY_AND:
+                {
+                    cpu->V[OPCODE_X(cpu->opcode)] &= cpu->V[OPCODE_Y(cpu->opcode)];
+                    if (quirks & QUIRK_VF_RESET) cpu->V[0xF] = 0;
+                } break;
+
+                case OPCODE_LOGICAL_XOR:
+                {
+                    cpu->V[OPCODE_X(cpu->opcode)] ^= cpu->V[OPCODE_Y(cpu->opcode)];
+                    if (quirks & QUIRK_VF_RESET) cpu->V[0xF] = 0;
+                } break;
+
+                case OPCODE_ADD:
+                {
+                    int vX = cpu->V[OPCODE_X(cpu->opcode)];
+                    int vY = cpu->V[OPCODE_Y(cpu->opcode)];
+
+                    cpu->V[OPCODE_X(cpu->opcode)] += cpu->V[OPCODE_Y(cpu->opcode)];
+
+                    cpu->V[0xF] = (vX + vY > 255) ? 1 : 0; // Check for overflow
+
+                } break;
+
+                case OPCODE_SUBTRACT_XY:
+                {
+                    uint8_t vX = cpu->V[OPCODE_X(cpu->opcode)];
+                    uint8_t vY = cpu->V[OPCODE_Y(cpu->opcode)];
+
+                    cpu->V[OPCODE_X(cpu->opcode)] = vX - vY;
+
+                    cpu->V[0xF] = (vY > vX) ? 0 : 1;
+
+                } break;
+
+                case OPCODE_SUBTRACT_YX:
+                {
+                    uint8_t vX = cpu->V[OPCODE_X(cpu->opcode)];
+                    uint8_t vY = cpu->V[OPCODE_Y(cpu->opcode)];
+
+                    cpu->V[OPCODE_X(cpu->opcode)] = vY - vX;
+
+                    cpu->V[0xF] = (vX > vY) ? 0 : 1;
+
+                } break;
+
+                case OPCODE_SHIFT_RIGHT:
+                {
+                    if (quirks & QUIRK_SHIFT_VY) cpu->V[OPCODE_X(cpu->opcode)] = cpu->V[OPCODE_Y(cpu->opcode)];
+                    uint8_t removedBit = cpu->V[OPCODE_X(cpu->opcode)] & 0b00000001;
+
+                    cpu->V[OPCODE_X(cpu->opcode)] >>= 1;
+
+                    cpu->V[0xF] = removedBit; 
+ 
+                } break;
+
+                case OPCODE_SHIFT_LEFT:
+                {
+                    if (quirks & QUIRK_SHIFT_VY) cpu->V[OPCODE_X(cpu->opcode)] = cpu->V[OPCODE_Y(cpu->opcode)];
+                    uint8_t removedBit = (cpu->V[OPCODE_X(cpu->opcode)] & 0b10000000) >> 7;
+
+                    cpu->V[OPCODE_X(cpu->opcode)] <<= 1;
+
+                    cpu->V[0xF] = removedBit; 
+                } break;
+
+                default:
+                {
+                    printf("[ERROR]: Invalid opcode: '%04x'\n", cpu->opcode);
+                    cpu->halted = 1;
+                } break;
+
+            } break;
+        } break;
+
+        case OPCODE_JUMP:
+            {
+                cpu->pc = OPCODE_NNN(cpu->opcode); // Jump to target
+            } break;
+
+        case OPCODE_RANDOM:
+            {
+                cpu->V[OPCODE_X(cpu->opcode)] = (NextRandom(cpu) % 0xFF) & OPCODE_NN(cpu->opcode);
+            } break;
+
+        case OPCODE_CALL_SUBROUTINE:
+        {
+            uint16_t prevPos = cpu->pc; // Store previous pc position
+
+            // Push previous position to stack
+            if (cpu->sp >=16) // Not if there is no space
+            {
+                printf("[ERROR]: Stack overflow.\n");
+                cpu->halted = 1;
+                break;
+            }
+            cpu->stack[cpu->sp] = prevPos;
+            cpu->sp++;
+
+            cpu->pc = OPCODE_NNN(cpu->opcode); // Jump 2.0
+        } break;
+
+        case OPCODE_REG_IS_VALUE:
+        {
+            if (cpu->V[OPCODE_X(cpu->opcode)] == OPCODE_NN(cpu->opcode)) cpu->pc+=2;
+        } break;
+
+        case OPCODE_REG_IS_NOT_VALUE:
+            {
+                if (cpu->V[OPCODE_X(cpu->opcode)] != OPCODE_NN(cpu->opcode)) cpu->pc+=2;
+            } break;
+
+        case OPCODE_REG_IS_REG:
+            {
+                if (cpu->V[OPCODE_X(cpu->opcode)] == cpu->V[OPCODE_Y(cpu->opcode)]) cpu->pc+=2;
+            } break;
+
+        case OPCODE_REG_IS_NOT_REG:
+            {
+                if (cpu->V[OPCODE_X(cpu->opcode)] != cpu->V[OPCODE_Y(cpu->opcode)]) cpu->pc+=2;
+            } break;
+
+        case OPCODE_SET_REG:
+            {
+                cpu->V[OPCODE_X(cpu->opcode)] = OPCODE_NN(cpu->opcode); // Bitshift to get value between 0 and F 
+                } break;
+
+        case OPCODE_ADD_TO_REG:
+            {
+                cpu->V[OPCODE_X(cpu->opcode)] += OPCODE_NN(cpu->opcode);
+            } break;
+
+        case OPCODE_SET_INDEX_REG:
+            {
+                cpu->I = OPCODE_NNN(cpu->opcode);
+            } break;
+
+        case OPCODE_JUMP_OFFSET:
+            {
+
+                if (quirks & QUIRK_JUMP_VX)
+                {
+                    cpu->pc = OPCODE_NNN(cpu->opcode) + cpu->V[OPCODE_X(cpu->opcode)]; // XNN is the address, X also picks the register
+                }
+                else {
+                    cpu->pc = OPCODE_NNN(cpu->opcode) + cpu->V[0];
+                }
+            } break;
+
+        case OPCODE_F:
+        {
+            switch (OPCODE_NN(cpu->opcode))
+            {
+                case OPCODE_STORE_MEMORY:
+                {
+                    uint16_t start = cpu->I;
+                    for (int i=0; i<=OPCODE_X(cpu->opcode); i++)
+                    {
+                        uint16_t memoryPos = (quirks & QUIRK_MEMORY_INCREMENT) ? cpu->I++ : cpu->I+i;
+                        WriteMemory(cpu, memoryPos, cpu->V[i]);
+                    }
+                    MarkMemoryWritten(cpu, start, OPCODE_X(cpu->opcode)+1);
+                } break;
+
+                case OPCODE_LOAD_MEMORY:
+                {
+                    for (int i=0; i<=OPCODE_X(cpu->opcode); i++)
+                    {
+                        uint16_t memoryPos = (quirks & QUIRK_MEMORY_INCREMENT) ? cpu->I++ : cpu->I+i;
+                        cpu->V[i] = ReadMemory(cpu, memoryPos);
+                    }
+                } break;
+
+                case OPCODE_CONVERT_DECIMAL:
+                {
+                    WriteMemory(cpu, cpu->I, cpu->V[OPCODE_X(cpu->opcode)] / 100);
+                    WriteMemory(cpu, cpu->I + 1, (cpu->V[OPCODE_X(cpu->opcode)] / 10) %10);
+                    WriteMemory(cpu, cpu->I + 2, cpu->V[OPCODE_X(cpu->opcode)] % 10);
+                    MarkMemoryWritten(cpu, cpu->I, 3);
+                } break;
+
+                case OPCODE_ADD_TO_INDEX:
+                {
+                    cpu->I += cpu->V[OPCODE_X(cpu->opcode)];
+                } break;
+
+                case OPCODE_GET_DELAY_TIMER:
+                {
+                    cpu->V[OPCODE_X(cpu->opcode)] = cpu->delayTimer;
+                } break;
+
+                case OPCODE_SET_DELAY_TIMER:
+                {
+                    cpu->delayTimer = cpu->V[OPCODE_X(cpu->opcode)];
+                } break;
+
+                case OPCODE_SET_SOUND_TIMER:
+                {
+                    cpu->soundTimer = cpu->V[OPCODE_X(cpu->opcode)];
+                } break;
+
+                case OPCODE_AWAIT_KEY:
+                {
+                    for (int i=0; i<16; i++)
+                    {
+                        if ((cpu->keypad >> i) & 1)
+                        {
+                            cpu->V[OPCODE_X(cpu->opcode)] = i;
+                            cpu->pc+=2;            
+                            break;
+                        }
+                    }
+                    cpu->pc-=2;
+                } break;
+
+                case OPCODE_FONT_CHARACTER:
+                {
+                    uint8_t character = cpu->V[OPCODE_X(cpu->opcode)] & 0x0F; // Only use the last nibble
+                    cpu->I = character * 5;
+                    
+                } break;
+
+                case OPCODE_BIG_FONT_CHARACTER:
+                {
+                    cpu->I = BIG_FONT_START + (cpu->V[OPCODE_X(cpu->opcode)] & 0x0F) * 10;
+                } break;
+
+                case OPCODE_SELECT_PLANES:
+                {
+                    cpu->planeMask = OPCODE_X(cpu->opcode) & ((1 << DISPLAY_PLANES) - 1);
+                } break;
+
+                default:
+                {
+                    printf("[ERROR]: Invalid opcode: '%04x'\n", cpu->opcode);
+                    cpu->halted = 1;
+                } break;
+            }
+        } break;
+
+        case OPCODE_KEY_SKIP:
+        {
+            switch (OPCODE_NN(cpu->opcode))
+            {
+                case OPCODE_SKIP_IF_KEY:
+                    {
+                        if ((cpu->keypad >> (cpu->V[OPCODE_X(cpu->opcode)] & 0xF)) & 1) cpu->pc+=2;
+                    } break;
+
+                case OPCODE_SKIP_IF_NOT_KEY:
+                    {
+                        if (!((cpu->keypad >> (cpu->V[OPCODE_X(cpu->opcode)] & 0xF)) & 1)) cpu->pc+=2;
+                    } break;
+            } 
+        } break;
+
+        case OPCODE_DISPLAY:
+        {
+            DrawSprite(cpu, OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode), OPCODE_N(cpu->opcode));
+        } break;
+
+        default:
+        {
+            printf("[ERROR]: Invalid opcode: '%04x'\n", cpu->opcode);
+            cpu->halted = true;
+        } break;
+    }
+}
+
+SPECIALIZED void EmulateCycleWith(chip8* cpu, const uint32_t quirks)
+{
+    // Fetch instruction
+    uint16_t pc = cpu->pc;
+    cpu->opcode = cpu->memory[cpu->pc] << 8 | cpu->memory[cpu->pc+1]; // Combine the two bytes to create the opcode
+    cpu->pc+=2; // increment program counter by 2
+
+    if (traceState.enabled || hotspotState.everyInstruction)
+    {
+        if (hotspotState.everyInstruction) HotspotCount(cpu, pc, 1);
+        uint8_t before[16];
+        memcpy(before, cpu->V, 16);
+        DecodeAndExecute(cpu, quirks);
+        if (traceState.enabled) TraceRecord(pc, cpu->opcode, before, cpu->I, cpu->V);
+        return;
+    }
+
+    DecodeAndExecute(cpu, quirks);
+}
+
+#define EMULATE_CYCLE_INSTANCE(id, quirks) static void EmulateCycle##id(chip8* cpu) { EmulateCycleWith(cpu, quirks); }
+PROFILE_LIST(EMULATE_CYCLE_INSTANCE)
+
+// Runs one instruction with the machine's profile, for the slow paths of the other cores
+void EmulateCycle(chip8* cpu)
+{
+    #define EMULATE_CYCLE_ENTRY(id, quirks) EmulateCycle##id,
+    static void (*const instances[PROFILE_COUNT])(chip8*) = { PROFILE_LIST(EMULATE_CYCLE_ENTRY) };
+    instances[PROFILE_INDEX(cpu)](cpu);
+}
+
+// Single instructions for code translated by tools/aot.c, which has decoded them and baked the quirks in
+void ExecuteClear(chip8* cpu)
+{
+    ClearScreen(cpu);
+}
+
+void ExecuteDraw(chip8* cpu, uint8_t regX, uint8_t regY, uint8_t height)
+{
+    DrawSprite(cpu, regX, regY, height);
+}
+
+void ExecuteScroll(chip8* cpu, int right, int down)
+{
+    if (right) DisplayChanged(cpu, DisplayScrollHorizontal(&cpu->display, cpu->planeMask, right));
+    else DisplayChanged(cpu, DisplayScrollVertical(&cpu->display, cpu->planeMask, down));
+}
+
+void ExecuteResolution(chip8* cpu, bool hires)
+{
+    DisplayChanged(cpu, DisplaySetResolution(&cpu->display, hires));
+}
+
+uint8_t ExecuteRandom(chip8* cpu, uint8_t mask)
+{
+    return (NextRandom(cpu) % 0xFF) & mask;
+}
+
+void MemoryWritten(chip8* cpu, uint16_t address, uint16_t length)
+{
+    MarkMemoryWritten(cpu, address, length);
+}
+
+#include "dispatch.c"
+#include "blockcache.c"
+#include "jit.c"
+
+// Reference core, runs DecodeAndExecute one instruction at a time
+SPECIALIZED uint64_t RunSwitchWith(chip8* cpu, uint64_t cycles, const uint32_t quirks)
+{
+    for (uint64_t i=0; i<cycles; i++)
+    {
+        EmulateCycleWith(cpu, quirks);
+        if (cpu->halted || AudioEdgeOpcode(cpu->opcode)) return i+1;
+    }
+    return cycles;
+}
+
+#define SWITCH_INSTANCE(id, quirks) static uint64_t RunSwitch##id(chip8* cpu, uint64_t cycles) { return RunSwitchWith(cpu, cycles, quirks); }
+PROFILE_LIST(SWITCH_INSTANCE)
+
+uint64_t RunSwitch(chip8* cpu, uint64_t cycles)
+{
+    #define SWITCH_ENTRY(id, quirks) RunSwitch##id,
+    static uint64_t (*const instances[PROFILE_COUNT])(chip8*, uint64_t) = { PROFILE_LIST(SWITCH_ENTRY) };
+    return instances[PROFILE_INDEX(cpu)](cpu, cycles);
+}
+
+const core cores[] = {
+    { "switch", RunSwitch },
+    { "threaded", RunThreaded },
+    { "block", RunBlocks },
+    { "jit", RunJit },
+};
+const int coreCount = sizeof(cores) / sizeof(cores[0]);
+
+const core* FindCore(const char* name)
+{
+    for (int i=0; i<coreCount; i++)
+    {
+        if (!strcmp(name, cores[i].name)) return &cores[i];
+    }
+    return NULL;
+}
+
+uint64_t HashDisplay(const chip8* cpu) // FNV-1a
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    const uint8_t* bytes = (const uint8_t*)cpu->display.planes;
+    for (int i=0; i<sizeof(cpu->display.planes); i++) hash = (hash ^ bytes[i]) * 0x100000001b3;
+    return (hash ^ cpu->display.hires) * 0x100000001b3;
+}
+
+uint64_t NextTickCycle(const chip8* cpu)
+{
+    return (cpu->ticks + 1) * cpu->clockHz / TIMER_HZ;
+}
+
+void TickTimers(chip8* cpu)
+{
+    if (cpu->delayTimer>0) cpu->delayTimer--;
+    if (cpu->soundTimer>0) cpu->soundTimer--;
+    cpu->ticks++;
+    if (captureState.enabled) CaptureFrame(cpu);
+    if (audioState.enabled) AudioUpdate(cpu);
+}
+
+#define IDLE_MAX_LOOP 8 // Longest wait loop we look for, in instructions
+
+// Opcodes that can't change anything but registers and pc, so a loop of them only waits on the timer or keypad
+static bool IsIdleOp(uint8_t op)
+{
+    switch (op)
+    {
+        case OP_NOP: case OP_SET_REG: case OP_ADD_TO_REG: case OP_SET: case OP_BINARY_OR: case OP_BINARY_AND:
+        case OP_LOGICAL_XOR: case OP_ADD: case OP_SUBTRACT_XY: case OP_SUBTRACT_YX: case OP_SHIFT_RIGHT:
+        case OP_SHIFT_LEFT: case OP_SET_INDEX_REG: case OP_ADD_TO_INDEX: case OP_FONT_CHARACTER:
+        case OP_GET_DELAY_TIMER: case OP_REG_IS_VALUE: case OP_REG_IS_NOT_VALUE: case OP_REG_IS_REG:
+        case OP_REG_IS_NOT_REG: case OP_SKIP_IF_KEY: case OP_SKIP_IF_NOT_KEY: case OP_JUMP: case OP_JUMP_OFFSET:
+        case OP_AWAIT_KEY: case OP_LOAD_MEMORY:
+            return true;
+    }
+    return false;
+}
+
+static inline const decodedOp* DecodeAt(chip8* cpu, uint16_t address)
+{
+    return &decodeTable[cpu->memory[address] << 8 | cpu->memory[address+1]];
+}
+
+// Runs one pass of the loop at pc on a scratch machine, returns its length or 0 if it didn't come back to pc
+static int SimulateIteration(chip8* scratch, uint16_t pc)
+{
+    for (int i=1; i<=IDLE_MAX_LOOP; i++)
+    {
+        if (scratch->pc+1 >= sizeof(scratch->memory) || !IsIdleOp(DecodeAt(scratch, scratch->pc)->op)) return 0;
+        EmulateCycle(scratch);
+        if (scratch->pc == pc) return i;
+    }
+    return 0;
+}
+
+// Cheap check before copying anything: idle opcodes up to a backward jump (or FX0A) close enough to pc
+static bool IsIdleCandidate(const uint8_t* memory, uint16_t pc)
+{
+    bool candidate = false;
+    uint16_t address = pc;
+    for (int i=0; i<IDLE_MAX_LOOP && address+1 < sizeof(((chip8*)0)->memory); i++, address+=2)
+    {
+        const decodedOp* d = &decodeTable[memory[address] << 8 | memory[address+1]];
+        if (!IsIdleOp(d->op)) break;
+        if (d->op == OP_AWAIT_KEY && i == 0) candidate = true;
+        if ((d->op == OP_JUMP && d->nnn <= pc && (address - d->nnn)/2 < IDLE_MAX_LOOP) || d->op == OP_JUMP_OFFSET)
+        {
+            candidate = true;
+            break;
+        }
+    }
+    return candidate;
+}
+
+// Skips whole iterations of a wait loop (FX0A, or a short loop polling the delay timer or keypad) within
+// `budget` instructions. Nothing those loops read changes between timer ticks and batches, so once an
+// iteration leaves the machine as it found it every following one does too. Returns the instructions skipped.
+uint64_t SkipIdleLoop(chip8* cpu, uint64_t budget)
+{
+    if (!IsIdleCandidate(cpu->memory, cpu->pc)) return 0;
+
+    chip8 scratch = *cpu;
+    scratch.blockCache = NULL;
+    int length = SimulateIteration(&scratch, cpu->pc);
+    if (length == 0 || budget < (uint64_t)length) return 0;
+
+    uint8_t V[16];
+    memcpy(V, scratch.V, 16);
+    uint16_t I = scratch.I;
+    if (SimulateIteration(&scratch, cpu->pc) != length || memcmp(V, scratch.V, 16) || I != scratch.I) return 0;
+
+    memcpy(cpu->V, scratch.V, 16);
+    cpu->I = scratch.I;
+    cpu->opcode = scratch.opcode;
+    return budget / length * length;
+}
+
+// Runs `cycles` instructions on the machine's core, stopping at every timer tick to update the timers
+uint64_t ExecuteCycles(chip8* cpu, uint64_t cycles)
+{
+    uint64_t done = 0;
+    while (done < cycles && !cpu->halted)
+    {
+        while (cpu->cycles >= NextTickCycle(cpu)) TickTimers(cpu);
+
+        uint64_t slice = NextTickCycle(cpu) - cpu->cycles;
+        if (slice > cycles - done) slice = cycles - done;
+
+        // Tracing and exact hot-spot counts have to see every instruction
+        if (!cpu->noIdleSkip && !traceState.enabled && !hotspotState.everyInstruction)
+        {
+            uint64_t skipped = SkipIdleLoop(cpu, slice);
+            cpu->cycles += skipped;
+            cpu->idleCycles += skipped;
+            done += skipped;
+            slice -= skipped;
+            if (slice == 0) continue;
+        }
+        if (hotspotState.enabled && !hotspotState.everyInstruction) slice = HotspotSlice(cpu, slice);
+
+        uint64_t ran = cpu->core->run(cpu, slice);
+        cpu->cycles += ran;
+        done += ran;
+        if (audioState.enabled) AudioUpdate(cpu);
+    }
+    while (cpu->cycles >= NextTickCycle(cpu)) TickTimers(cpu);
+    if (audioState.enabled) AudioUpdate(cpu);
+    return done;
+}
+
+uint64_t ExecuteFrames(chip8* cpu, uint64_t frames)
+{
+    uint64_t target = cpu->ticks + frames;
+    uint64_t done = 0;
+    while (cpu->ticks < target && !cpu->halted) done += ExecuteCycles(cpu, NextTickCycle(cpu) - cpu->cycles);
+    return done;
+}
+
+void SetKeypad(chip8* cpu, uint16_t keys)
+{
+    cpu->keypad = keys;
+}
+
+const framebuffer* ReadFramebuffer(const chip8* cpu)
+{
+    return &cpu->display;
+}
+
+void PrintCoreStats(const chip8* cpu)
+{
+    if (cpu->blockCache) PrintBlockCacheStats(cpu->blockCache);
+    if (cpu->core->run == RunJit) PrintJitStats(cpu->blockCache);
+}
+
+#include "romcache.c"
+#include "savestate.c"
+#include "movie.c"
+#include "lockstep.c"
+#include "fork.c"
+#include "profiles.c"
+#include "disasm.c"
+#include "validate.c"
+
@@ -0,0 +1,178 @@
+// ROM analysis. A recursive descent from 0x200 over the decode table finds every instruction control can
+// reach without knowing register values, splits them into basic blocks and collects the call targets.
+// Within each block I is followed from ANNN, so the bytes that sprites and FX65 read are classified as data
+// and the bytes FX33 and FX55 write are known, along with whether any of them fall on code. A store with an
+// I that isn't known there counts as possibly writing anywhere. Tools like the AOT recompiler and the
+// disassembler CLI build on this.
+
+#define ANALYSIS_SIZE sizeof(((chip8*)0)->memory)
+
+// Instructions that don't just go on to the next address
+static bool EndsFlow(uint8_t op)
+{
+    switch (op)
+    {
+        case OP_INVALID:
+        case OP_EXIT:
+        case OP_RETURN_SUBROUTINE:
+        case OP_JUMP:
+        case OP_CALL_SUBROUTINE:
+        case OP_REG_IS_VALUE:
+        case OP_REG_IS_NOT_VALUE:
+        case OP_REG_IS_REG:
+        case OP_REG_IS_NOT_REG:
+        case OP_JUMP_OFFSET:
+        case OP_SKIP_IF_KEY:
+        case OP_SKIP_IF_NOT_KEY:
+        case OP_AWAIT_KEY:
+            return true;
+    }
+    return false;
+}
+
+// Where control can go after an instruction that ends the flow, as far as can be told statically.
+// Sets `dynamic` when it can also go somewhere only known at run time.
+static int StaticSuccessors(const decodedOp* d, uint16_t address, uint16_t* out, bool* dynamic)
+{
+    *dynamic = false;
+    switch (d->op)
+    {
+        case OP_JUMP: out[0] = d->nnn; return 1;
+        case OP_CALL_SUBROUTINE: out[0] = d->nnn; out[1] = address+2; return 2; // Where 00EE comes back to
+        case OP_AWAIT_KEY: out[0] = address+2; *dynamic = true; return 1; // Or the same instruction again
+        case OP_RETURN_SUBROUTINE: case OP_JUMP_OFFSET: *dynamic = true; return 0;
+        case OP_INVALID: case OP_EXIT: return 0; // Halts
+    }
+    out[0] = address+2; // The skips
+    out[1] = address+4;
+    return 2;
+}
+
+static bool InAnalysis(uint32_t address)
+{
+    return address+1 < ANALYSIS_SIZE;
+}
+
+static void MarkRange(romAnalysis* a, uint32_t start, uint32_t length, uint8_t flag)
+{
+    for (uint32_t i=start; i<start+length && i<ANALYSIS_SIZE; i++) a->flags[i] |= flag;
+}
+
+// Follows I through one block, -1 while it isn't known
+static void AnalyzeBlockData(romAnalysis* a, const chip8* cpu, const analysisBlock* b)
+{
+    int32_t I = -1;
+    for (uint32_t address=b->start; address<b->end; address+=2)
+    {
+        const decodedOp* d = &decodeTable[cpu->memory[address] << 8 | cpu->memory[address+1]];
+        uint32_t length = d->x + 1;
+        switch (d->op)
+        {
+            case OP_SET_INDEX_REG: I = d->nnn; break;
+            case OP_ADD_TO_INDEX: case OP_FONT_CHARACTER: case OP_BIG_FONT_CHARACTER: I = -1; break;
+            case OP_DISPLAY: if (I >= 0) MarkRange(a, I, (d->n) ? d->n : 32, ANALYSIS_DATA); break; // The first plane's sprite
+
+            case OP_LOAD_MEMORY:
+            case OP_STORE_MEMORY:
+            case OP_CONVERT_DECIMAL:
+                if (d->op == OP_CONVERT_DECIMAL) length = 3;
+                if (I < 0)
+                {
+                    if (d->op != OP_LOAD_MEMORY) a->unknownWrites++;
+                    break;
+                }
+                MarkRange(a, I, length, (d->op == OP_LOAD_MEMORY) ? ANALYSIS_DATA : ANALYSIS_WRITTEN);
+                if (d->op != OP_CONVERT_DECIMAL && (cpu->profile->quirks & QUIRK_MEMORY_INCREMENT)) I += length;
+                break;
+        }
+    }
+}
+
+romAnalysis* AnalyzeRom(const chip8* cpu)
+{
+    romAnalysis* a = calloc(1, sizeof(romAnalysis));
+    static _Thread_local uint16_t worklist[ANALYSIS_SIZE * 2];
+    int count = 0;
+    worklist[count++] = 0x200;
+    a->flags[0x200] |= ANALYSIS_BLOCK_START;
+
+    // Every reachable instruction, and the leaders that split them into blocks
+    while (count > 0)
+    {
+        uint16_t address = worklist[--count];
+        while (InAnalysis(address) && !(a->flags[address] & ANALYSIS_CODE))
+        {
+            const decodedOp* d = &decodeTable[cpu->memory[address] << 8 | cpu->memory[address+1]];
+            a->flags[address] |= ANALYSIS_CODE | ANALYSIS_CODE_BYTE;
+            a->flags[address+1] |= ANALYSIS_CODE_BYTE;
+            a->instructions++;
+            a->indirectJumps += d->op == OP_JUMP_OFFSET;
+            if (!EndsFlow(d->op))
+            {
+                address += 2;
+                continue;
+            }
+
+            uint16_t next[2];
+            bool dynamic;
+            int n = StaticSuccessors(d, address, next, &dynamic);
+            if (d->op == OP_CALL_SUBROUTINE && InAnalysis(d->nnn)) a->flags[d->nnn] |= ANALYSIS_CALL_TARGET;
+            for (int i=0; i<n; i++)
+            {
+                if (!InAnalysis(next[i])) continue;
+                a->flags[next[i]] |= ANALYSIS_BLOCK_START;
+                worklist[count++] = next[i];
+            }
+            break;
+        }
+    }
+
+    // Blocks in address order, each runs to the end of the flow or the next leader
+    for (uint32_t start=0; start<ANALYSIS_SIZE; start++)
+    {
+        if ((a->flags[start] & (ANALYSIS_BLOCK_START | ANALYSIS_CODE)) == (ANALYSIS_BLOCK_START | ANALYSIS_CODE)) a->blockCount++;
+    }
+    a->blocks = calloc(a->blockCount ? a->blockCount : 1, sizeof(analysisBlock));
+
+    uint32_t index = 0;
+    for (uint32_t start=0; start<ANALYSIS_SIZE; start++)
+    {
+        if ((a->flags[start] & (ANALYSIS_BLOCK_START | ANALYSIS_CODE)) != (ANALYSIS_BLOCK_START | ANALYSIS_CODE)) continue;
+
+        analysisBlock* b = &a->blocks[index++];
+        b->start = start;
+        uint32_t address = start;
+        for (;;)
+        {
+            const decodedOp* d = &decodeTable[cpu->memory[address] << 8 | cpu->memory[address+1]];
+            if (EndsFlow(d->op))
+            {
+                b->successorCount = StaticSuccessors(d, address, b->successors, &b->dynamic);
+                b->end = address+2;
+                break;
+            }
+            address += 2;
+            if (!InAnalysis(address) || (a->flags[address] & ANALYSIS_BLOCK_START))
+            {
+                b->successors[0] = address;
+                b->successorCount = 1;
+                b->fallsThrough = true;
+                b->end = address;
+                break;
+            }
+        }
+        AnalyzeBlockData(a, cpu, b);
+    }
+
+    for (uint32_t i=0; i<ANALYSIS_SIZE; i++)
+    {
+        if ((a->flags[i] & (ANALYSIS_WRITTEN | ANALYSIS_CODE_BYTE)) == (ANALYSIS_WRITTEN | ANALYSIS_CODE_BYTE)) a->codeWrites++;
+    }
+    return a;
+}
+
+void FreeAnalysis(romAnalysis* a)
+{
+    free(a->blocks);
+    free(a);
+}
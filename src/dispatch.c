@@ -0,0 +1,158 @@
+// Pre-decoded interpreter core. Every one of the 65536 possible opcodes is decoded once at startup into
+// a handler and its operands, so running an instruction is a table lookup and an indirect jump.
+// With GCC/Clang the handlers are chained with computed goto (direct threading), otherwise a switch is used.
+
+#if defined(__GNUC__)
+    #define THREADED_DISPATCH
+#endif
+
+// One entry per handler in ops.inc
+#define OP_LIST(X) \
+    X(INVALID) X(NOP) X(CLEAR_SCREEN) X(RETURN_SUBROUTINE) X(JUMP) X(CALL_SUBROUTINE) \
+    X(REG_IS_VALUE) X(REG_IS_NOT_VALUE) X(REG_IS_REG) X(REG_IS_NOT_REG) X(SET_REG) X(ADD_TO_REG) \
+    X(SET) X(BINARY_OR) X(BINARY_AND) X(LOGICAL_XOR) X(ADD) X(SUBTRACT_XY) X(SUBTRACT_YX) \
+    X(SHIFT_RIGHT) X(SHIFT_LEFT) X(SET_INDEX_REG) X(JUMP_OFFSET) X(RANDOM) X(DISPLAY) \
+    X(SKIP_IF_KEY) X(SKIP_IF_NOT_KEY) X(GET_DELAY_TIMER) X(AWAIT_KEY) X(SET_DELAY_TIMER) \
+    X(SET_SOUND_TIMER) X(ADD_TO_INDEX) X(FONT_CHARACTER) X(CONVERT_DECIMAL) X(STORE_MEMORY) X(LOAD_MEMORY) \
+    X(SCROLL_DOWN) X(SCROLL_UP) X(SCROLL_RIGHT) X(SCROLL_LEFT) X(EXIT) X(LORES) X(HIRES) X(BIG_FONT_CHARACTER) \
+    X(SELECT_PLANES)
+
+#define OP_ENUM(name) OP_##name,
+enum { OP_LIST(OP_ENUM) OP_COUNT };
+#undef OP_ENUM
+
+typedef struct {
+    uint16_t nnn;
+    uint8_t op;
+    uint8_t x;
+    uint8_t y;
+    uint8_t nn;
+    uint8_t n;
+} decodedOp;
+
+decodedOp decodeTable[0x10000];
+
+static uint8_t DecodeOp(uint16_t opcode)
+{
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            if (opcode == OPCODE_CLEAR_SCREEN) return OP_CLEAR_SCREEN;
+            if (opcode == OPCODE_RETURN_SUBROUTINE) return OP_RETURN_SUBROUTINE;
+            if (opcode == OPCODE_SCROLL_RIGHT) return OP_SCROLL_RIGHT;
+            if (opcode == OPCODE_SCROLL_LEFT) return OP_SCROLL_LEFT;
+            if (opcode == OPCODE_EXIT) return OP_EXIT;
+            if (opcode == OPCODE_LORES) return OP_LORES;
+            if (opcode == OPCODE_HIRES) return OP_HIRES;
+            if ((opcode & 0xFFF0) == OPCODE_SCROLL_DOWN) return OP_SCROLL_DOWN;
+            if ((opcode & 0xFFF0) == OPCODE_SCROLL_UP) return OP_SCROLL_UP;
+            return OP_INVALID;
+
+        case OPCODE_ARITHMETIC:
+            switch (OPCODE_N(opcode))
+            {
+                case OPCODE_SET: return OP_SET;
+                case OPCODE_BINARY_OR: return OP_BINARY_OR;
+                case OPCODE_BINARY_AND: return OP_BINARY_AND;
+                case OPCODE_LOGICAL_XOR: return OP_LOGICAL_XOR;
+                case OPCODE_ADD: return OP_ADD;
+                case OPCODE_SUBTRACT_XY: return OP_SUBTRACT_XY;
+                case OPCODE_SUBTRACT_YX: return OP_SUBTRACT_YX;
+                case OPCODE_SHIFT_RIGHT: return OP_SHIFT_RIGHT;
+                case OPCODE_SHIFT_LEFT: return OP_SHIFT_LEFT;
+            }
+            return OP_INVALID;
+
+        case OPCODE_JUMP: return OP_JUMP;
+        case OPCODE_RANDOM: return OP_RANDOM;
+        case OPCODE_CALL_SUBROUTINE: return OP_CALL_SUBROUTINE;
+        case OPCODE_REG_IS_VALUE: return OP_REG_IS_VALUE;
+        case OPCODE_REG_IS_NOT_VALUE: return OP_REG_IS_NOT_VALUE;
+        case OPCODE_REG_IS_REG: return OP_REG_IS_REG;
+        case OPCODE_REG_IS_NOT_REG: return OP_REG_IS_NOT_REG;
+        case OPCODE_SET_REG: return OP_SET_REG;
+        case OPCODE_ADD_TO_REG: return OP_ADD_TO_REG;
+        case OPCODE_SET_INDEX_REG: return OP_SET_INDEX_REG;
+        case OPCODE_JUMP_OFFSET: return OP_JUMP_OFFSET;
+        case OPCODE_DISPLAY: return OP_DISPLAY;
+
+        case OPCODE_F:
+            switch (OPCODE_NN(opcode))
+            {
+                case OPCODE_STORE_MEMORY: return OP_STORE_MEMORY;
+                case OPCODE_LOAD_MEMORY: return OP_LOAD_MEMORY;
+                case OPCODE_CONVERT_DECIMAL: return OP_CONVERT_DECIMAL;
+                case OPCODE_ADD_TO_INDEX: return OP_ADD_TO_INDEX;
+                case OPCODE_GET_DELAY_TIMER: return OP_GET_DELAY_TIMER;
+                case OPCODE_SET_DELAY_TIMER: return OP_SET_DELAY_TIMER;
+                case OPCODE_SET_SOUND_TIMER: return OP_SET_SOUND_TIMER;
+                case OPCODE_AWAIT_KEY: return OP_AWAIT_KEY;
+                case OPCODE_FONT_CHARACTER: return OP_FONT_CHARACTER;
+                case OPCODE_BIG_FONT_CHARACTER: return OP_BIG_FONT_CHARACTER;
+                case OPCODE_SELECT_PLANES: return OP_SELECT_PLANES;
+            }
+            return OP_INVALID;
+
+        case OPCODE_KEY_SKIP:
+            switch (OPCODE_NN(opcode))
+            {
+                case OPCODE_SKIP_IF_KEY: return OP_SKIP_IF_KEY;
+                case OPCODE_SKIP_IF_NOT_KEY: return OP_SKIP_IF_NOT_KEY;
+            }
+            return OP_NOP; // DecodeAndExecute silently ignores the rest of EXNN
+    }
+    return OP_INVALID;
+}
+
+void InitDispatch()
+{
+    for (int opcode=0; opcode<0x10000; opcode++)
+    {
+        decodedOp* d = &decodeTable[opcode];
+        d->op = DecodeOp(opcode);
+        d->x = OPCODE_X(opcode);
+        d->y = OPCODE_Y(opcode);
+        d->nn = OPCODE_NN(opcode);
+        d->n = OPCODE_N(opcode);
+        d->nnn = OPCODE_NNN(opcode);
+    }
+}
+
+// One copy of threaded.inc per quirk profile. Handler labels can't be shared between copies, so the handlers
+// are looked up by op in each copy's own table instead of being stored in the decode table. GCC won't inline
+// or clone a function that takes label addresses, so each copy has to be its own #include, but the copies are
+// declared from PROFILE_LIST: a profile added there without one here fails to build ("used but never defined").
+#define THREADED_INSTANCE(id, quirks) static uint64_t RunThreaded##id(chip8* cpu, uint64_t cycles);
+PROFILE_LIST(THREADED_INSTANCE)
+
+static uint64_t RunThreadedModern(chip8* cpu, uint64_t cycles)
+{
+    const uint32_t quirks = QUIRKS_MODERN;
+    #include "threaded.inc"
+}
+
+static uint64_t RunThreadedVip(chip8* cpu, uint64_t cycles)
+{
+    const uint32_t quirks = QUIRKS_VIP;
+    #include "threaded.inc"
+}
+
+static uint64_t RunThreadedSchip(chip8* cpu, uint64_t cycles)
+{
+    const uint32_t quirks = QUIRKS_SCHIP;
+    #include "threaded.inc"
+}
+
+static uint64_t RunThreadedXoChip(chip8* cpu, uint64_t cycles)
+{
+    const uint32_t quirks = QUIRKS_XOCHIP;
+    #include "threaded.inc"
+}
+
+// Runs up to `cycles` instructions, returns how many were executed (less if the machine halted)
+uint64_t RunThreaded(chip8* cpu, uint64_t cycles)
+{
+    #define THREADED_ENTRY(id, quirks) RunThreaded##id,
+    static uint64_t (*const instances[PROFILE_COUNT])(chip8*, uint64_t) = { PROFILE_LIST(THREADED_ENTRY) };
+    return instances[PROFILE_INDEX(cpu)](cpu, cycles);
+}
@@ -0,0 +1,202 @@
+// Framebuffer operations, shared by the interpreters and the lockstep lanes. Each bit plane is packed rows of
+// SCREEN_WORDS words. Lo-res only uses the first LORES_HEIGHT rows and the first word of each, so the same
+// code runs both resolutions and switching between them is a clear. Drawing is a shift and XOR per sprite
+// row and word. Vertical scrolls move whole rows. Horizontal scrolls shift every word of a row and carry the
+// bits into its neighbour, two rows per AVX2 vector or one per SSE2 vector. Every operation returns a mask of
+// the rows it changed, in the rows of the current resolution.
+
+static bool displayAvx2;
+
+static void InitDisplay()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    displayAvx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+static inline int DisplayRows(const framebuffer* fb)
+{
+    return (fb->hires) ? SCREEN_HEIGHT : LORES_HEIGHT;
+}
+
+static inline uint64_t AllRows(const framebuffer* fb)
+{
+    return (fb->hires) ? ~0ull : (1ull << LORES_HEIGHT) - 1;
+}
+
+// Clears the planes in `planeMask`, returns the rows that had anything on them
+static uint64_t DisplayClear(framebuffer* fb, uint8_t planeMask)
+{
+    int rows = DisplayRows(fb);
+    uint64_t dirty = 0;
+    for (int p=0; p<DISPLAY_PLANES; p++)
+    {
+        if (!((planeMask >> p) & 1)) continue;
+        uint64_t (*plane)[SCREEN_WORDS] = fb->planes[p];
+        for (int y=0; y<rows; y++)
+        {
+            uint64_t any = 0;
+            for (int w=0; w<SCREEN_WORDS; w++) any |= plane[y][w];
+            if (any) dirty |= 1ull << y;
+        }
+        memset(plane, 0, rows * sizeof(plane[0]));
+    }
+    return dirty;
+}
+
+// 00FE and 00FF, a blank display in the new resolution
+static uint64_t DisplaySetResolution(framebuffer* fb, bool hires)
+{
+    memset(fb->planes, 0, sizeof(fb->planes));
+    fb->hires = hires;
+    return ~0ull;
+}
+
+// Draws an 8 pixel wide sprite `height` rows high, or 16x16 for height 0, into each plane in `planeMask`.
+// Each plane takes the next sprite from `sprite`, the way XO-CHIP lays them out. Anything past the right or
+// bottom edge is clipped. Returns whether a pixel was turned off.
+static uint8_t DisplayDraw(framebuffer* fb, uint8_t planeMask, uint8_t vx, uint8_t vy, uint8_t height, const uint8_t* sprite, uint64_t* dirty)
+{
+    int width = (fb->hires) ? SCREEN_WIDTH : LORES_WIDTH;
+    int rows = DisplayRows(fb);
+    int x = vx % width;
+    int y = vy % rows;
+    int spriteRows = (height) ? height : 16;
+    int rowBytes = (height) ? 1 : 2;
+    int visible = (spriteRows < rows - y) ? spriteRows : rows - y;
+
+    // Bits past the end of a word go into the next one, if the row has one
+    int word = x / 64;
+    int shift = x % 64;
+    bool spill = word + 1 < width / 64 && shift > 64 - 8*rowBytes;
+
+    uint8_t collision = 0;
+    uint64_t drawn = 0;
+    for (int p=0; p<DISPLAY_PLANES; p++)
+    {
+        if (!((planeMask >> p) & 1)) continue;
+        uint64_t (*plane)[SCREEN_WORDS] = &fb->planes[p][y];
+        for (int j=0; j<visible; j++)
+        {
+            uint64_t bits = (rowBytes == 1) ? (uint64_t)sprite[j] << 56 : (uint64_t)(sprite[2*j] << 8 | sprite[2*j+1]) << 48;
+            uint64_t left = bits >> shift;
+            uint64_t right = (spill) ? bits << (64 - shift) : 0;
+            collision |= ((plane[j][word] & left) | (spill ? plane[j][word+1] & right : 0)) != 0;
+            plane[j][word] ^= left;
+            if (spill) plane[j][word+1] ^= right;
+            if (left | right) drawn |= 1ull << j;
+        }
+        sprite += spriteRows * rowBytes;
+    }
+    *dirty |= drawn << y;
+    return collision;
+}
+
+// Scrolls the planes in `planeMask` down by `amount` rows, or up for a negative amount, blank rows coming in
+static uint64_t DisplayScrollVertical(framebuffer* fb, uint8_t planeMask, int amount)
+{
+    int rows = DisplayRows(fb);
+    int n = (amount < 0) ? -amount : amount;
+    if (n > rows) n = rows;
+    if (n == 0 || planeMask == 0) return 0;
+
+    for (int p=0; p<DISPLAY_PLANES; p++)
+    {
+        if (!((planeMask >> p) & 1)) continue;
+        uint64_t (*plane)[SCREEN_WORDS] = fb->planes[p];
+        size_t kept = (rows - n) * sizeof(plane[0]);
+        if (amount > 0)
+        {
+            memmove(plane[n], plane[0], kept);
+            memset(plane[0], 0, n * sizeof(plane[0]));
+        }
+        else
+        {
+            memmove(plane[0], plane[n], kept);
+            memset(plane[rows - n], 0, n * sizeof(plane[0]));
+        }
+    }
+    return AllRows(fb);
+}
+
+// Horizontal scrolls shift each word of a row by `shift` and or in the bits that left its neighbour. In lo-res
+// the second word has to stay blank, so a row is masked down to its first word afterwards.
+static void ScrollRowsScalar(uint64_t (*rows)[SCREEN_WORDS], int count, int shift, bool right, bool hires)
+{
+    for (int y=0; y<count; y++)
+    {
+        uint64_t* row = rows[y];
+        if (!hires) row[0] = (right) ? row[0] >> shift : row[0] << shift;
+        else if (right)
+        {
+            for (int w=SCREEN_WORDS-1; w>0; w--) row[w] = row[w] >> shift | row[w-1] << (64 - shift);
+            row[0] >>= shift;
+        }
+        else
+        {
+            for (int w=0; w<SCREEN_WORDS-1; w++) row[w] = row[w] << shift | row[w+1] >> (64 - shift);
+            row[SCREEN_WORDS-1] <<= shift;
+        }
+    }
+}
+
+#if defined(__SSE2__) && SCREEN_WORDS == 2
+#include <emmintrin.h>
+
+// One row per vector, the first word in the low half
+static void ScrollRowsSSE2(uint64_t (*rows)[SCREEN_WORDS], int count, int shift, bool right, bool hires)
+{
+    const __m128i keep = _mm_set_epi64x((hires) ? -1 : 0, -1);
+    const __m128i by = _mm_cvtsi32_si128(shift);
+    const __m128i carryBy = _mm_cvtsi32_si128(64 - shift);
+    for (int y=0; y<count; y++)
+    {
+        __m128i* row = (__m128i*)rows[y];
+        __m128i v = _mm_loadu_si128(row);
+        if (right) v = _mm_or_si128(_mm_srl_epi64(v, by), _mm_slli_si128(_mm_sll_epi64(v, carryBy), 8));
+        else v = _mm_or_si128(_mm_sll_epi64(v, by), _mm_srli_si128(_mm_srl_epi64(v, carryBy), 8));
+        _mm_storeu_si128(row, _mm_and_si128(v, keep));
+    }
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__) && SCREEN_WORDS == 2
+#include <immintrin.h>
+
+#define DISPLAY_AVX2 __attribute__((target("avx2")))
+
+// Two rows per vector, the byte shifts work within each 128-bit half so the carries never cross rows
+DISPLAY_AVX2 static void ScrollRowsAVX2(uint64_t (*rows)[SCREEN_WORDS], int count, int shift, bool right, bool hires)
+{
+    const __m256i keep = _mm256_set_epi64x((hires) ? -1 : 0, -1, (hires) ? -1 : 0, -1);
+    const __m128i by = _mm_cvtsi32_si128(shift);
+    const __m128i carryBy = _mm_cvtsi32_si128(64 - shift);
+    for (int y=0; y<count; y+=2)
+    {
+        __m256i* pair = (__m256i*)rows[y];
+        __m256i v = _mm256_loadu_si256(pair);
+        if (right) v = _mm256_or_si256(_mm256_srl_epi64(v, by), _mm256_slli_si256(_mm256_sll_epi64(v, carryBy), 8));
+        else v = _mm256_or_si256(_mm256_sll_epi64(v, by), _mm256_srli_si256(_mm256_srl_epi64(v, carryBy), 8));
+        _mm256_storeu_si256(pair, _mm256_and_si256(v, keep));
+    }
+}
+#endif
+
+// Scrolls the planes in `planeMask` right by `amount` pixels (1 to 63), or left for a negative amount
+static uint64_t DisplayScrollHorizontal(framebuffer* fb, uint8_t planeMask, int amount)
+{
+    void (*scrollRows)(uint64_t (*)[SCREEN_WORDS], int, int, bool, bool) = ScrollRowsScalar;
+#if defined(__SSE2__) && SCREEN_WORDS == 2
+    scrollRows = ScrollRowsSSE2;
+#endif
+#ifdef DISPLAY_AVX2
+    if (displayAvx2) scrollRows = ScrollRowsAVX2;
+#endif
+
+    if (planeMask == 0) return 0;
+    for (int p=0; p<DISPLAY_PLANES; p++)
+    {
+        if ((planeMask >> p) & 1) scrollRows(fb->planes[p], DisplayRows(fb), (amount < 0) ? -amount : amount, amount > 0, fb->hires);
+    }
+    return AllRows(fb);
+}
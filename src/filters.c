@@ -0,0 +1,459 @@
+// Display filters, shared by the SDL frontend and tools/filterbench. A frame goes through up to three stages
+// and is rendered straight into a 32-bit RGBA buffer (the streaming texture) of any size at least as big as
+// the smoothed hi-res frame. Frames are filtered in the resolution they were drawn in, so smoothing works on
+// lo-res pixels, and each resolution has its own output lookup. Names are given as a comma separated list,
+// "none" for plain scaling:
+//
+//     phosphor   Pixels that go dark fade out over two frames instead of vanishing, which hides the flicker of
+//                sprites being erased and redrawn. The level planes then hold a 2-bit fade level per pixel
+//                instead of the XO-CHIP colour, so the display is shown in one colour.
+//     scale2x    EPX edge smoothing to twice the resolution (scale3x: three times), computed 64 pixels at a
+//                time with bitwise operations on the packed rows of each plane.
+//     scanlines  Darkens the last output row of every CHIP-8 row.
+//
+// The output stage scales the planes to the target size, nearest neighbour so integer scales are exact, and
+// looks each pixel's colour up from its level: 8 pixels at a time with AVX2, 4 with SSE2.
+
+#define FILTER_MAX_FACTOR 3
+#define FILTER_PLANE_WORDS (SCREEN_WIDTH * FILTER_MAX_FACTOR / 64)
+#define FILTER_PLANE_ROWS (SCREEN_HEIGHT * FILTER_MAX_FACTOR)
+
+// Output lookup for one resolution, padded to a multiple of 8 pixels
+typedef struct {
+    int planeWidth; // Of the smoothed frame
+    int planeHeight;
+    uint16_t* blockWord; // First 32-bit plane word each block of 8 output pixels reads
+    uint32_t* maskLow; // Bit each output pixel reads from that word, 0 if it reads the next one
+    uint32_t* maskHigh; // Bit it reads from the word after
+    uint16_t* sourceRow; // Plane row of each output row
+    uint8_t* dark; // Whether each output row is a scanline
+} filterLayout;
+
+typedef struct {
+    int factor; // 1, 2 for scale2x or 3 for scale3x
+    bool phosphor;
+    bool scanlines;
+    bool avx2;
+
+    int width; // Of the output
+    int height;
+    bool hires; // Resolution of the last frame, picks the layout
+    filterLayout layouts[2]; // Lo-res, hi-res
+
+    uint64_t history[2][SCREEN_HEIGHT][SCREEN_WORDS]; // The two frames before, for phosphor
+    bool settling; // The last frame's levels weren't steady yet, rendering it again would change them
+    uint64_t fadingRows; // The rows of the last frame that weren't steady
+    uint64_t planes[2][FILTER_PLANE_ROWS][FILTER_PLANE_WORDS]; // Bit 0 and bit 1 of each pixel's level
+    uint32_t halves[2][FILTER_PLANE_ROWS][FILTER_PLANE_WORDS*2 + 1]; // The planes in 32-bit words, plus one word of padding
+
+    uint32_t palette[2][4]; // Colour of each level, then darkened for scanlines
+    uint32_t spread[FILTER_MAX_FACTOR+1][256]; // Each bit of a byte moved `factor` bits apart
+} displayFilter;
+
+static uint32_t MixColor(uint32_t a, uint32_t b, int weight, int total)
+{
+    uint32_t mixed = 0;
+    for (int shift=0; shift<32; shift+=8)
+    {
+        uint32_t channelA = (a >> shift) & 0xFF;
+        uint32_t channelB = (b >> shift) & 0xFF;
+        mixed |= ((channelA * (total - weight) + channelB * weight) / total) << shift;
+    }
+    return mixed;
+}
+
+static bool ParseFilters(displayFilter* f, const char* names)
+{
+    f->factor = 1;
+    const char* name = names;
+    while (name != NULL && *name)
+    {
+        const char* end = strchr(name, ',');
+        size_t length = (end != NULL) ? (size_t)(end - name) : strlen(name);
+        if (length == 4 && !strncmp(name, "none", 4)) {}
+        else if (length == 8 && !strncmp(name, "phosphor", 8)) f->phosphor = true;
+        else if (length == 9 && !strncmp(name, "scanlines", 9)) f->scanlines = true;
+        else if (length == 7 && !strncmp(name, "scale2x", 7)) f->factor = 2;
+        else if (length == 7 && !strncmp(name, "scale3x", 7)) f->factor = 3;
+        else
+        {
+            printf("[ERROR]: Unknown filter '%.*s'. Filters: none, phosphor, scale2x, scale3x, scanlines\n", (int)length, name);
+            return false;
+        }
+        name = (end != NULL) ? end + 1 : NULL;
+    }
+    return true;
+}
+
+static void CreateLayout(displayFilter* f, filterLayout* l, int columns, int rows)
+{
+    l->planeWidth = columns * f->factor;
+    l->planeHeight = rows * f->factor;
+
+    int padded = (f->width + 7) & ~7;
+    l->blockWord = malloc(padded / 8 * sizeof(uint16_t));
+    l->maskLow = malloc(padded * sizeof(uint32_t));
+    l->maskHigh = malloc(padded * sizeof(uint32_t));
+    for (int x=0; x<padded; x++)
+    {
+        int source = (x < f->width) ? (int)((int64_t)x * l->planeWidth / f->width) : l->planeWidth - 1;
+        if (x % 8 == 0) l->blockWord[x/8] = source / 32;
+        uint32_t bit = 1u << (31 - source % 32);
+        bool next = source / 32 != l->blockWord[x/8]; // Never more than one word on, the output is at least as wide
+        l->maskLow[x] = (next) ? 0 : bit;
+        l->maskHigh[x] = (next) ? bit : 0;
+    }
+
+    l->sourceRow = malloc(f->height * sizeof(uint16_t));
+    l->dark = malloc(f->height);
+    for (int y=0; y<f->height; y++)
+    {
+        l->sourceRow[y] = (int64_t)y * l->planeHeight / f->height;
+        int row = (int64_t)y * rows / f->height;
+        int next = (int64_t)(y+1) * rows / f->height;
+        l->dark[y] = f->scanlines && f->height >= rows*2 && next != row;
+    }
+}
+
+displayFilter* CreateFilter(const char* names, int width, int height)
+{
+    displayFilter* f = calloc(1, sizeof(displayFilter));
+    if (!ParseFilters(f, names))
+    {
+        free(f);
+        return NULL;
+    }
+    f->width = width;
+    f->height = height;
+    if (width < SCREEN_WIDTH * f->factor || height < SCREEN_HEIGHT * f->factor)
+    {
+        printf("[ERROR]: The output has to be at least %dx%d for these filters.\n", SCREEN_WIDTH * f->factor, SCREEN_HEIGHT * f->factor);
+        free(f);
+        return NULL;
+    }
+#if defined(__x86_64__) && defined(__GNUC__)
+    f->avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+    // With phosphor: off, fading out, fading out for one more frame, on. Without, the XO-CHIP colours.
+    uint32_t levels[4] = { COLOR_OFF, COLOR_ON, COLOR_PLANE2, COLOR_BOTH };
+    if (f->phosphor)
+    {
+        levels[1] = MixColor(COLOR_OFF, COLOR_ON, 1, 3);
+        levels[2] = MixColor(COLOR_OFF, COLOR_ON, 2, 3);
+        levels[3] = COLOR_ON;
+    }
+    for (int i=0; i<4; i++)
+    {
+        f->palette[0][i] = 0xFF000000 | levels[i];
+        f->palette[1][i] = 0xFF000000 | MixColor(levels[i], 0, 2, 5);
+    }
+
+    for (int factor=1; factor<=FILTER_MAX_FACTOR; factor++)
+    {
+        for (int v=0; v<256; v++)
+        {
+            for (int i=0; i<8; i++)
+            {
+                if ((v >> (7-i)) & 1) f->spread[factor][v] |= 1u << (8*factor - 1 - i*factor);
+            }
+        }
+    }
+
+    CreateLayout(f, &f->layouts[0], LORES_WIDTH, LORES_HEIGHT);
+    CreateLayout(f, &f->layouts[1], SCREEN_WIDTH, SCREEN_HEIGHT);
+    f->settling = true;
+    return f;
+}
+
+void FreeFilter(displayFilter* f)
+{
+    for (int i=0; i<2; i++)
+    {
+        free(f->layouts[i].blockWord);
+        free(f->layouts[i].maskLow);
+        free(f->layouts[i].maskHigh);
+        free(f->layouts[i].sourceRow);
+        free(f->layouts[i].dark);
+    }
+    free(f);
+}
+
+// Ors `width` bits of `value` into a row of words, starting `offset` bits from the top of the first word
+static inline void PutBits(uint64_t* words, int offset, uint64_t value, int width)
+{
+    int word = offset / 64;
+    int bit = offset % 64;
+    if (bit + width <= 64) words[word] |= value << (64 - bit - width);
+    else
+    {
+        words[word] |= value >> (bit + width - 64);
+        words[word+1] |= value << (128 - bit - width);
+    }
+}
+
+// Interleaves `factor` rows of 64 pixels into one row `factor` times as wide, pixel x of row j landing on x*factor+j
+static void SpreadRow(const displayFilter* f, const uint64_t* rows, int factor, uint64_t* out)
+{
+    memset(out, 0, factor * sizeof(uint64_t));
+    for (int k=0; k<8; k++)
+    {
+        uint32_t chunk = 0;
+        for (int j=0; j<factor; j++) chunk |= f->spread[factor][(rows[j] >> (56 - 8*k)) & 0xFF] >> j;
+        PutBits(out, k * 8 * factor, chunk, 8 * factor);
+    }
+}
+
+// Each pixel's left and right neighbour in word w of a row, bits carried over from the words next to it and
+// the edges repeated
+static inline uint64_t LeftOf(const uint64_t* row, int w)
+{
+    return (row[w] >> 1) | ((w > 0) ? row[w-1] << 63 : row[w] & (1ull << 63));
+}
+
+static inline uint64_t RightOf(const uint64_t* row, int w, int words)
+{
+    return (row[w] << 1) | ((w < words-1) ? row[w+1] >> 63 : row[w] & 1);
+}
+
+#define SELECT(mask, a, b) (((mask) & (a)) | (~(mask) & (b)))
+
+// Smooths row y of a frame `rows` high and `words` wide into `factor` output rows, EPX rules on 64 pixels at
+// once. Neighbours:
+//     A B C
+//     D E F
+//     G H I
+static void SmoothRow(const displayFilter* f, uint64_t (*frame)[SCREEN_WORDS], int y, int rows, int words, uint64_t out[FILTER_MAX_FACTOR][FILTER_PLANE_WORDS])
+{
+    const uint64_t* above = frame[(y > 0) ? y-1 : y];
+    const uint64_t* below = frame[(y < rows-1) ? y+1 : y];
+    for (int w=0; w<words; w++)
+    {
+        uint64_t E = frame[y][w];
+        uint64_t B = above[w];
+        uint64_t H = below[w];
+        uint64_t D = LeftOf(frame[y], w), F = RightOf(frame[y], w, words);
+        int at = w * f->factor; // First output word this one spreads into
+
+        if (f->factor == 1) out[0][w] = E;
+        else if (f->factor == 2)
+        {
+            uint64_t edge = (B ^ H) & (D ^ F);
+            uint64_t top[2] = { SELECT(edge & ~(D ^ B), D, E), SELECT(edge & ~(B ^ F), F, E) };
+            uint64_t bottom[2] = { SELECT(edge & ~(D ^ H), D, E), SELECT(edge & ~(H ^ F), F, E) };
+            SpreadRow(f, top, 2, out[0] + at);
+            SpreadRow(f, bottom, 2, out[1] + at);
+        }
+        else
+        {
+            uint64_t A = LeftOf(above, w), C = RightOf(above, w, words), G = LeftOf(below, w), I = RightOf(below, w, words);
+            uint64_t db = ~(D ^ B) & (B ^ F) & (D ^ H); // D==B, B!=F, D!=H
+            uint64_t bf = ~(B ^ F) & (B ^ D) & (F ^ H);
+            uint64_t dh = ~(D ^ H) & (D ^ B) & (H ^ F);
+            uint64_t hf = ~(H ^ F) & (D ^ H) & (B ^ F);
+            uint64_t top[3] = {
+                SELECT(db, D, E),
+                SELECT((db & (E ^ C)) | (bf & (E ^ A)), B, E),
+                SELECT(bf, F, E),
+            };
+            uint64_t middle[3] = {
+                SELECT((db & (E ^ G)) | (dh & (E ^ A)), D, E),
+                E,
+                SELECT((bf & (E ^ I)) | (hf & (E ^ C)), F, E),
+            };
+            uint64_t bottom[3] = {
+                SELECT(dh, D, E),
+                SELECT((dh & (E ^ I)) | (hf & (E ^ G)), H, E),
+                SELECT(hf, F, E),
+            };
+            SpreadRow(f, top, 3, out[0] + at);
+            SpreadRow(f, middle, 3, out[1] + at);
+            SpreadRow(f, bottom, 3, out[2] + at);
+        }
+    }
+}
+
+// Runs the frame through phosphor and smoothing, returns the rows of the hi-res frame whose output changed
+// since the last frame (both of a lo-res row's). `rows` are the frame's rows that may have changed since the
+// last one it was given, in the frame's resolution, the machine's dirtyRows. Only those, their neighbours for
+// smoothing and the rows still fading are filtered again.
+uint64_t FilterFrame(displayFilter* f, const framebuffer* frame, uint64_t rows)
+{
+    int height = (frame->hires) ? SCREEN_HEIGHT : LORES_HEIGHT;
+    int words = (frame->hires) ? SCREEN_WORDS : 1;
+    bool switched = frame->hires != f->hires;
+    f->hires = frame->hires;
+
+    // The levels are cheap to work out for every row, it's the smoothing and the comparing that gets skipped
+    uint64_t levels[2][SCREEN_HEIGHT][SCREEN_WORDS]; // Bit 0 and bit 1 of each pixel's level
+    uint64_t fading = 0;
+    for (int y=0; y<height; y++)
+    {
+        for (int w=0; w<words; w++)
+        {
+            if (!f->phosphor)
+            {
+                levels[0][y][w] = frame->planes[0][y][w];
+                levels[1][y][w] = frame->planes[1][y][w];
+                continue;
+            }
+            uint64_t now = frame->planes[0][y][w] | frame->planes[1][y][w];
+            uint64_t before = (switched) ? now : f->history[0][y][w];
+            uint64_t earlier = (switched) ? now : f->history[1][y][w];
+            levels[0][y][w] = now | (~before & earlier);
+            levels[1][y][w] = now | before;
+            if (now != before || before != earlier) fading |= 1ull << y;
+            f->history[1][y][w] = before;
+            f->history[0][y][w] = now;
+        }
+    }
+    f->settling = fading != 0;
+
+    // A row's levels change when it was drawn to or was still fading, smoothing spreads that to its neighbours
+    uint64_t redo = rows | fading | f->fadingRows;
+    if (f->factor > 1) redo |= redo << 1 | redo >> 1;
+    if (switched) redo = ~0ull;
+    f->fadingRows = fading;
+
+    uint64_t changed = 0;
+    int planeWords = words * f->factor;
+    for (int p=0; p<2; p++)
+    {
+        for (int y=0; y<height; y++)
+        {
+            if (!((redo >> y) & 1)) continue;
+            uint64_t out[FILTER_MAX_FACTOR][FILTER_PLANE_WORDS];
+            SmoothRow(f, levels[p], y, height, words, out);
+            for (int r=0; r<f->factor; r++)
+            {
+                uint64_t* plane = f->planes[p][y*f->factor + r];
+                if (!switched && !memcmp(plane, out[r], planeWords * sizeof(uint64_t))) continue;
+                memcpy(plane, out[r], planeWords * sizeof(uint64_t));
+                uint32_t* halves = f->halves[p][y*f->factor + r];
+                for (int w=0; w<planeWords; w++)
+                {
+                    halves[2*w] = plane[w] >> 32;
+                    halves[2*w+1] = (uint32_t)plane[w];
+                }
+                changed |= (frame->hires) ? 1ull << y : 3ull << 2*y;
+            }
+        }
+    }
+    return (switched) ? ~0ull : changed;
+}
+
+// Whether the last frame still needs rendering again for the phosphor to fade out
+bool FilterSettling(const displayFilter* f)
+{
+    return f->settling;
+}
+
+// Output rows showing rows [first, last) of the hi-res frame
+void FilterRows(const displayFilter* f, int first, int last, int* outFirst, int* outLast)
+{
+    *outFirst = ((int64_t)first * f->height + SCREEN_HEIGHT-1) / SCREEN_HEIGHT;
+    *outLast = ((int64_t)last * f->height + SCREEN_HEIGHT-1) / SCREEN_HEIGHT;
+}
+
+static void RenderRowScalar(const displayFilter* f, const filterLayout* l, const uint32_t* bit0, const uint32_t* bit1, const uint32_t* palette, uint32_t* out)
+{
+    for (int x=0; x<f->width; x++)
+    {
+        int word = l->blockWord[x/8];
+        int level = ((bit0[word] & l->maskLow[x]) || (bit0[word+1] & l->maskHigh[x]))
+            | ((bit1[word] & l->maskLow[x]) || (bit1[word+1] & l->maskHigh[x])) << 1;
+        out[x] = palette[level];
+    }
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+static void RenderRowSSE2(const displayFilter* f, const filterLayout* l, const uint32_t* bit0, const uint32_t* bit1, const uint32_t* palette, uint32_t* out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i p0 = _mm_set1_epi32(palette[0]), p1 = _mm_set1_epi32(palette[1]);
+    const __m128i p2 = _mm_set1_epi32(palette[2]), p3 = _mm_set1_epi32(palette[3]);
+    int x = 0;
+    for (; x+4 <= f->width; x+=4)
+    {
+        int word = l->blockWord[x/8];
+        __m128i maskLow = _mm_loadu_si128((const __m128i*)&l->maskLow[x]);
+        __m128i maskHigh = _mm_loadu_si128((const __m128i*)&l->maskHigh[x]);
+        __m128i off0 = _mm_cmpeq_epi32(_mm_or_si128(_mm_and_si128(_mm_set1_epi32(bit0[word]), maskLow),
+            _mm_and_si128(_mm_set1_epi32(bit0[word+1]), maskHigh)), zero);
+        __m128i off1 = _mm_cmpeq_epi32(_mm_or_si128(_mm_and_si128(_mm_set1_epi32(bit1[word]), maskLow),
+            _mm_and_si128(_mm_set1_epi32(bit1[word+1]), maskHigh)), zero);
+        __m128i low = _mm_or_si128(_mm_and_si128(off0, p0), _mm_andnot_si128(off0, p1));
+        __m128i high = _mm_or_si128(_mm_and_si128(off0, p2), _mm_andnot_si128(off0, p3));
+        _mm_storeu_si128((__m128i*)&out[x], _mm_or_si128(_mm_and_si128(off1, low), _mm_andnot_si128(off1, high)));
+    }
+    for (; x<f->width; x++)
+    {
+        int word = l->blockWord[x/8];
+        int level = ((bit0[word] & l->maskLow[x]) || (bit0[word+1] & l->maskHigh[x]))
+            | ((bit1[word] & l->maskLow[x]) || (bit1[word+1] & l->maskHigh[x])) << 1;
+        out[x] = palette[level];
+    }
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+#define FILTER_AVX2 __attribute__((target("avx2")))
+
+FILTER_AVX2 static void RenderRowAVX2(const displayFilter* f, const filterLayout* l, const uint32_t* bit0, const uint32_t* bit1, const uint32_t* palette, uint32_t* out)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i p0 = _mm256_set1_epi32(palette[0]), p1 = _mm256_set1_epi32(palette[1]);
+    const __m256i p2 = _mm256_set1_epi32(palette[2]), p3 = _mm256_set1_epi32(palette[3]);
+    for (int x=0; x<f->width; x+=8)
+    {
+        int word = l->blockWord[x/8];
+        __m256i maskLow = _mm256_loadu_si256((const __m256i*)&l->maskLow[x]);
+        __m256i maskHigh = _mm256_loadu_si256((const __m256i*)&l->maskHigh[x]);
+        __m256i off0 = _mm256_cmpeq_epi32(_mm256_or_si256(_mm256_and_si256(_mm256_set1_epi32(bit0[word]), maskLow),
+            _mm256_and_si256(_mm256_set1_epi32(bit0[word+1]), maskHigh)), zero);
+        __m256i off1 = _mm256_cmpeq_epi32(_mm256_or_si256(_mm256_and_si256(_mm256_set1_epi32(bit1[word]), maskLow),
+            _mm256_and_si256(_mm256_set1_epi32(bit1[word+1]), maskHigh)), zero);
+        __m256i low = _mm256_blendv_epi8(p1, p0, off0);
+        __m256i high = _mm256_blendv_epi8(p3, p2, off0);
+        __m256i color = _mm256_blendv_epi8(high, low, off1);
+
+        if (x+8 <= f->width) _mm256_storeu_si256((__m256i*)&out[x], color);
+        else
+        {
+            const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            _mm256_maskstore_epi32((int*)&out[x], _mm256_cmpgt_epi32(_mm256_set1_epi32(f->width - x), lanes), color);
+        }
+    }
+}
+#endif
+
+// Renders output rows [first, last) into `pixels`, which points at row `first`. Rows showing the same
+// plane row as the one before are copied.
+void FilterRender(const displayFilter* f, uint32_t* pixels, int pitch, int first, int last)
+{
+    void (*renderRow)(const displayFilter*, const filterLayout*, const uint32_t*, const uint32_t*, const uint32_t*, uint32_t*) = RenderRowScalar;
+#ifdef __SSE2__
+    renderRow = RenderRowSSE2;
+#endif
+#ifdef FILTER_AVX2
+    if (f->avx2) renderRow = RenderRowAVX2;
+#endif
+
+    const filterLayout* l = &f->layouts[f->hires];
+    uint32_t* previous = NULL;
+    for (int y=first; y<last; y++)
+    {
+        uint32_t* row = (uint32_t*)((uint8_t*)pixels + (size_t)(y - first) * pitch);
+        int source = l->sourceRow[y];
+        if (previous != NULL && source == l->sourceRow[y-1] && l->dark[y] == l->dark[y-1])
+        {
+            memcpy(row, previous, f->width * sizeof(uint32_t));
+        }
+        else renderRow(f, l, f->halves[0][source], f->halves[1][source], f->palette[l->dark[y]], row);
+        previous = row;
+    }
+}
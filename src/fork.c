@@ -0,0 +1,293 @@
+// Copy-on-write forks for searching over machine states. A fork holds what a savestate holds, with memory
+// split into FORK_PAGE_SIZE pages and the display stored as more pages. Pages are reference counted and
+// shared between a fork and the forks made after it: a machine remembers the fork it was last restored
+// from or forked into, MarkMemoryWritten and the display ops flag the pages it changes, and only those get
+// copied into the next fork. A child that only touched registers costs just the fork itself.
+// Forks, page tables and pages come from free lists refilled a slab at a time, so forking doesn't call malloc.
+
+#define FORK_MEMORY_PAGES ((sizeof(((chip8*)0)->memory) + FORK_PAGE_SIZE - 1) / FORK_PAGE_SIZE)
+#define FORK_DISPLAY_PAGES ((sizeof(((chip8*)0)->display) + FORK_PAGE_SIZE - 1) / FORK_PAGE_SIZE)
+#define FORK_TOTAL_PAGES (FORK_MEMORY_PAGES + FORK_DISPLAY_PAGES)
+#define FORK_SLAB 256 // Pages or forks allocated at once when a free list runs dry
+
+_Static_assert(FORK_MEMORY_PAGES <= 31, "Memory pages have to fit below FORK_DISPLAY_DIRTY");
+
+// Every pooled object starts with one of these while it sits on a free list
+typedef struct freeItem {
+    struct freeItem* next;
+} freeItem;
+
+typedef struct {
+    uint32_t refs;
+    _Alignas(64) uint8_t bytes[FORK_PAGE_SIZE];
+} forkPage;
+
+// Forks that didn't change a page share the whole table, so forking a register-only change is O(1)
+typedef struct {
+    uint32_t refs;
+    forkPage* pages[FORK_TOTAL_PAGES]; // Memory, then the display
+} forkPageTable;
+
+struct machineFork {
+    forkPool* pool;
+    uint32_t refs; // The owner, plus the machine whose base it is
+    forkPageTable* table;
+
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t pc;
+    uint16_t stack[16];
+    uint16_t opcode;
+    uint8_t sp;
+    uint8_t planeMask;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint8_t halted;
+    uint64_t cycles;
+    uint64_t ticks;
+    uint64_t rngState;
+};
+
+struct forkPool {
+    freeItem* freePages;
+    freeItem* freeTables;
+    freeItem* freeForks;
+    void** slabs;
+    uint32_t slabCount;
+    uint32_t slabCapacity;
+
+    uint32_t liveForks;
+    uint32_t liveTables;
+    uint32_t livePages;
+    uint64_t forks;
+    uint64_t pagesShared;
+    uint64_t pagesCopied;
+    uint64_t restores;
+    uint64_t pagesRestored;
+};
+
+forkPool* CreateForkPool()
+{
+    return calloc(1, sizeof(forkPool));
+}
+
+void FreeForkPool(forkPool* pool)
+{
+    if (pool->liveForks) printf("[WARNING]: Freeing a fork pool with %u forks still live.\n", pool->liveForks);
+    for (uint32_t i=0; i<pool->slabCount; i++) free(pool->slabs[i]);
+    free(pool->slabs);
+    free(pool);
+}
+
+static void PoolGive(freeItem** list, void* item)
+{
+    ((freeItem*)item)->next = *list;
+    *list = item;
+}
+
+static void* PoolTake(forkPool* pool, freeItem** list, size_t size)
+{
+    if (*list == NULL)
+    {
+        if (pool->slabCount == pool->slabCapacity)
+        {
+            pool->slabCapacity = (pool->slabCapacity) ? pool->slabCapacity * 2 : 16;
+            pool->slabs = realloc(pool->slabs, pool->slabCapacity * sizeof(void*));
+        }
+        uint8_t* slab = aligned_alloc(64, (size * FORK_SLAB + 63) & ~(size_t)63);
+        pool->slabs[pool->slabCount++] = slab;
+        for (int i=0; i<FORK_SLAB; i++) PoolGive(list, slab + i * size);
+    }
+    freeItem* item = *list;
+    *list = item->next;
+    return item;
+}
+
+static void ReleaseTable(forkPool* pool, forkPageTable* table)
+{
+    if (--table->refs) return;
+    for (uint32_t i=0; i<FORK_TOTAL_PAGES; i++)
+    {
+        if (--table->pages[i]->refs) continue;
+        PoolGive(&pool->freePages, table->pages[i]);
+        pool->livePages--;
+    }
+    PoolGive(&pool->freeTables, table);
+    pool->liveTables--;
+}
+
+// Where page i lives in the machine, and how much of it is used
+static uint8_t* PageBytes(chip8* cpu, uint32_t i, uint32_t* size)
+{
+    uint8_t* base = cpu->memory;
+    uint32_t total = sizeof(cpu->memory);
+    if (i >= FORK_MEMORY_PAGES)
+    {
+        base = (uint8_t*)&cpu->display;
+        total = sizeof(cpu->display);
+        i -= FORK_MEMORY_PAGES;
+    }
+    uint32_t offset = i * FORK_PAGE_SIZE;
+    *size = (total - offset < FORK_PAGE_SIZE) ? total - offset : FORK_PAGE_SIZE;
+    return base + offset;
+}
+
+static bool PageDirty(const chip8* cpu, uint32_t i)
+{
+    uint32_t bit = (i < FORK_MEMORY_PAGES) ? 1u << i : FORK_DISPLAY_DIRTY;
+    return (cpu->dirtyPages & bit) != 0;
+}
+
+void DetachFork(chip8* cpu)
+{
+    if (cpu->forkBase) ReleaseFork(cpu->forkBase);
+    cpu->forkBase = NULL;
+    cpu->dirtyPages = ~0u;
+}
+
+static void AttachFork(chip8* cpu, machineFork* fork)
+{
+    fork->refs++;
+    DetachFork(cpu);
+    cpu->forkBase = fork;
+    cpu->dirtyPages = 0;
+}
+
+// Pages for a new fork: the base's where the machine didn't change them (or wrote back the same bytes),
+// fresh copies elsewhere. Refcounts aren't atomic, so nothing is shared with a base from another pool.
+static forkPageTable* CaptureTable(forkPool* pool, chip8* cpu)
+{
+    forkPageTable* base = (cpu->forkBase && cpu->forkBase->pool == pool) ? cpu->forkBase->table : NULL;
+    if (base && cpu->dirtyPages == 0)
+    {
+        base->refs++;
+        pool->pagesShared += FORK_TOTAL_PAGES;
+        return base;
+    }
+
+    forkPageTable* table = PoolTake(pool, &pool->freeTables, sizeof(forkPageTable));
+    table->refs = 1;
+    pool->liveTables++;
+    uint32_t copied = 0;
+    for (uint32_t i=0; i<FORK_TOTAL_PAGES; i++)
+    {
+        uint32_t size;
+        uint8_t* bytes = PageBytes(cpu, i, &size);
+        if (base && (!PageDirty(cpu, i) || !memcmp(base->pages[i]->bytes, bytes, size)))
+        {
+            table->pages[i] = base->pages[i];
+            table->pages[i]->refs++;
+            continue;
+        }
+        table->pages[i] = PoolTake(pool, &pool->freePages, sizeof(forkPage));
+        table->pages[i]->refs = 1;
+        pool->livePages++;
+        memcpy(table->pages[i]->bytes, bytes, size);
+        copied++;
+    }
+    pool->pagesCopied += copied;
+    pool->pagesShared += FORK_TOTAL_PAGES - copied;
+
+    if (base && copied == 0) // Only rewrote what was there
+    {
+        ReleaseTable(pool, table);
+        base->refs++;
+        return base;
+    }
+    return table;
+}
+
+machineFork* ForkMachine(forkPool* pool, chip8* cpu)
+{
+    machineFork* fork = PoolTake(pool, &pool->freeForks, sizeof(machineFork));
+    fork->pool = pool;
+    fork->refs = 1;
+    fork->table = CaptureTable(pool, cpu);
+    pool->liveForks++;
+    pool->forks++;
+
+    memcpy(fork->V, cpu->V, sizeof(fork->V));
+    memcpy(fork->stack, cpu->stack, sizeof(fork->stack));
+    fork->I = cpu->I;
+    fork->pc = cpu->pc;
+    fork->opcode = cpu->opcode;
+    fork->sp = cpu->sp;
+    fork->planeMask = cpu->planeMask;
+    fork->delayTimer = cpu->delayTimer;
+    fork->soundTimer = cpu->soundTimer;
+    fork->halted = cpu->halted;
+    fork->cycles = cpu->cycles;
+    fork->ticks = cpu->ticks;
+    fork->rngState = cpu->rngState;
+
+    AttachFork(cpu, fork);
+    return fork;
+}
+
+// Only copies the pages the machine doesn't already have, and only invalidates cached code inside those
+void RestoreFork(chip8* cpu, machineFork* fork)
+{
+    forkPageTable* base = (cpu->forkBase) ? cpu->forkBase->table : NULL;
+    if (base != fork->table || cpu->dirtyPages)
+    {
+        for (uint32_t i=0; i<FORK_TOTAL_PAGES; i++)
+        {
+            if (base && base->pages[i] == fork->table->pages[i] && !PageDirty(cpu, i)) continue;
+
+            uint32_t size;
+            uint8_t* bytes = PageBytes(cpu, i, &size);
+            memcpy(bytes, fork->table->pages[i]->bytes, size);
+            fork->pool->pagesRestored++;
+            if (i < FORK_MEMORY_PAGES)
+            {
+                if (cpu->blockCache) InvalidateBlocks(cpu->blockCache, i * FORK_PAGE_SIZE, size);
+            }
+            else
+            {
+                // Pages past the planes hold the resolution, which changes every row
+                uint32_t offset = (i - FORK_MEMORY_PAGES) * FORK_PAGE_SIZE;
+                uint32_t firstRow = offset % sizeof(cpu->display.planes[0]) / sizeof(cpu->display.planes[0][0]);
+                uint32_t rows = size / sizeof(cpu->display.planes[0][0]);
+                if (offset >= sizeof(cpu->display.planes)) cpu->dirtyRows = ~0ull;
+                else cpu->dirtyRows |= ((rows < 64) ? (1ull << rows) - 1 : ~0ull) << firstRow;
+                cpu->drawFlag = 1;
+            }
+        }
+    }
+
+    memcpy(cpu->V, fork->V, sizeof(cpu->V));
+    memcpy(cpu->stack, fork->stack, sizeof(cpu->stack));
+    cpu->I = fork->I;
+    cpu->pc = fork->pc;
+    cpu->opcode = fork->opcode;
+    cpu->sp = fork->sp;
+    cpu->planeMask = fork->planeMask;
+    cpu->delayTimer = fork->delayTimer;
+    cpu->soundTimer = fork->soundTimer;
+    cpu->halted = fork->halted;
+    cpu->cycles = fork->cycles;
+    cpu->ticks = fork->ticks;
+    cpu->rngState = fork->rngState;
+    fork->pool->restores++;
+
+    AttachFork(cpu, fork);
+}
+
+void ReleaseFork(machineFork* fork)
+{
+    if (--fork->refs) return;
+    forkPool* pool = fork->pool;
+    ReleaseTable(pool, fork->table);
+    PoolGive(&pool->freeForks, fork);
+    pool->liveForks--;
+}
+
+void PrintForkStats(const forkPool* pool)
+{
+    uint64_t bytes = (uint64_t)pool->liveForks * sizeof(machineFork) + (uint64_t)pool->liveTables * sizeof(forkPageTable)
+        + (uint64_t)pool->livePages * sizeof(forkPage);
+    uint64_t pages = pool->pagesShared + pool->pagesCopied;
+    printf("Forks: %lu made, %u live holding %u pages (%.1f KB, %.0f bytes per fork), %.1f%% of pages shared, %.2f pages copied per restore\n",
+        pool->forks, pool->liveForks, pool->livePages, bytes / 1024.0, pool->liveForks ? (double)bytes / pool->liveForks : 0.0,
+        pages ? 100.0 * pool->pagesShared / pages : 0.0, pool->restores ? (double)pool->pagesRestored / pool->restores : 0.0);
+}
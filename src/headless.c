@@ -0,0 +1,323 @@
+// Headless runner over the core library, for machines without a display. Runs a ROM for a number of
+// instructions or frames (or replays a movie) and prints the speed and a hash of the framebuffer. With
+// --validate n it instead runs the chosen core against the reference, comparing them every n instructions.
+#include <time.h>
+
+#include "chip8.h"
+
+static double Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Summary of a headless run, the hash and registers make it easy to tell whether two runs matched
+static void PrintHeadlessRun(chip8* cpu, uint64_t done, double seconds)
+{
+    printf("%s core, %s profile: %lu instructions in %.3fs (%.2f M instructions/sec)\n", cpu->core->name, cpu->profile->name, done, seconds, done / seconds / 1e6);
+    printf("pc: %03x I: %03x display hash: %016lx\nV:", cpu->pc, cpu->I, HashDisplay(cpu));
+    for (int i=0; i<16; i++) printf(" %02x", cpu->V[i]);
+    printf("\n");
+    printf("Skipped %lu instructions (%.2f%%) in wait loops\n", cpu->idleCycles, done ? 100.0 * cpu->idleCycles / done : 0.0);
+    PrintCoreStats(cpu);
+}
+
+// Runs `lanes` copies of the machine with seeds seed, seed+1... on the lockstep engine, then the same
+// machines one by one on the chosen core, and checks that both ended up in the same state
+static int RunLanes(chip8* prototype, int lanes, uint64_t seed, uint64_t cycles)
+{
+    lockstep* ls = CreateLockstep(prototype, lanes);
+    if (ls == NULL) return -1;
+    for (int l=0; l<lanes; l++) LockstepSeed(ls, l, seed + l);
+
+    double start = Now();
+    uint64_t done = LockstepExecute(ls, cycles);
+    double lockstepSeconds = Now() - start;
+    printf("Lockstep: %d lanes, %lu instructions in %.3fs (%.2f M instructions/sec)\n", lanes, done, lockstepSeconds, done / lockstepSeconds / 1e6);
+    PrintLockstepStats(ls);
+
+    double singleSeconds = 0;
+    uint64_t singleDone = 0;
+    int mismatches = 0;
+    chip8* lane = CreateMachine(prototype->core);
+    for (int l=0; l<lanes; l++)
+    {
+        chip8* single = CreateMachine(prototype->core);
+        struct blockCache* cache = single->blockCache;
+        *single = *prototype;
+        single->blockCache = cache;
+        SeedRandom(single, seed + l);
+
+        start = Now();
+        singleDone += ExecuteCycles(single, cycles);
+        singleSeconds += Now() - start;
+
+        LockstepExtract(ls, l, lane);
+        if (lane->pc != single->pc || lane->I != single->I || lane->cycles != single->cycles || lane->ticks != single->ticks
+            || memcmp(lane->V, single->V, 16) || memcmp(lane->memory, single->memory, sizeof(lane->memory))
+            || HashDisplay(lane) != HashDisplay(single) || lane->rngState != single->rngState)
+        {
+            printf("[ERROR]: Lane %d differs from running it on its own (pc %03x vs %03x, display hash %016lx vs %016lx).\n",
+                l, lane->pc, single->pc, HashDisplay(lane), HashDisplay(single));
+            mismatches++;
+        }
+        DestroyMachine(single);
+    }
+    DestroyMachine(lane);
+    DestroyLockstep(ls);
+
+    printf("One by one on the %s core: %lu instructions in %.3fs (%.2f M instructions/sec), lockstep is %.2fx as fast\n",
+        prototype->core->name, singleDone, singleSeconds, singleDone / singleSeconds / 1e6,
+        (done / lockstepSeconds) / (singleDone / singleSeconds));
+    if (mismatches == 0) printf("All %d lanes match their single runs\n", lanes);
+    return (mismatches) ? -1 : 0;
+}
+
+// Fork benchmark, starting from wherever the machine is. First forks and restores with nothing run in
+// between, against copying the whole machine. Then a random tree search: restore one of `live` forks,
+// press a random key for a frame and fork the result, replacing a random fork once there are enough.
+static int RunForks(chip8* cpu, int live, uint64_t seed)
+{
+    const int rounds = 1000000;
+    const int branches = 100000;
+    forkPool* pool = CreateForkPool();
+    machineFork* root = ForkMachine(pool, cpu);
+
+    double start = Now();
+    for (int i=0; i<rounds; i++)
+    {
+        RestoreFork(cpu, root);
+        ReleaseFork(ForkMachine(pool, cpu));
+    }
+    double forkSeconds = Now() - start;
+
+    start = Now();
+    for (int i=0; i<rounds; i++)
+    {
+        chip8* copy = malloc(sizeof(chip8));
+        *copy = *cpu;
+        __asm__ volatile("" : : "r"(copy) : "memory"); // Keep the copy from being optimized out
+        free(copy);
+    }
+    double copySeconds = Now() - start;
+    printf("Fork and restore: %.2f M/sec, copying the whole machine (%lu bytes): %.2f M/sec\n",
+        rounds / forkSeconds / 1e6, sizeof(chip8), rounds / copySeconds / 1e6);
+
+    machineFork** forks = malloc(live * sizeof(machineFork*));
+    int count = 0;
+    forks[count++] = root;
+    uint64_t rng = seed * 0x9E3779B97F4A7C15ull | 1;
+    uint64_t done = 0;
+    start = Now();
+    for (int i=0; i<branches; i++)
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        RestoreFork(cpu, forks[(rng >> 32) % count]);
+        SetKeypad(cpu, 1 << (rng & 0xF));
+        done += ExecuteFrames(cpu, 1);
+        machineFork* child = ForkMachine(pool, cpu);
+        if (count < live) forks[count++] = child;
+        else
+        {
+            int slot = (rng >> 8) % count;
+            ReleaseFork(forks[slot]);
+            forks[slot] = child;
+        }
+    }
+    double searchSeconds = Now() - start;
+    printf("Search: %d branches of one frame in %.3fs (%.0f forks/sec, %lu instructions)\n", branches, searchSeconds, branches / searchSeconds, done);
+    PrintForkStats(pool);
+
+    for (int i=0; i<count; i++) ReleaseFork(forks[i]);
+    free(forks);
+    DetachFork(cpu);
+    FreeForkPool(pool);
+    return 0;
+}
+
+int main(int argc, char* args[])
+{
+    char* romPath = NULL;
+    char* tracePath = NULL;
+    char* hotspotPath = NULL;
+    char* loadPath = NULL;
+    char* replayPath = NULL;
+    char* coreName = "switch";
+    char* profileName = NULL; // Detected from the ROM when not given
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    int lanes = 0;
+    int forks = 0;
+    uint64_t validateEvery = 0;
+    const char* capturePaths[CAPTURE_MAX_FILES];
+    int captureCount = 0;
+    bool captureDrop = false;
+    uint32_t hotspotPeriod = HOTSPOT_PERIOD;
+    uint64_t seed = time(NULL);
+    uint32_t clockHz = CLOCK_HZ;
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(args[i], "--trace") && i+1 < argc) tracePath = args[++i];
+        else if (!strcmp(args[i], "--hotspots") && i+1 < argc) hotspotPath = args[++i];
+        else if (!strcmp(args[i], "--hotspot-period") && i+1 < argc) hotspotPeriod = strtoul(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--core") && i+1 < argc) coreName = args[++i];
+        else if (!strcmp(args[i], "--profile") && i+1 < argc) profileName = args[++i];
+        else if (!strcmp(args[i], "--cycles") && i+1 < argc) cycles = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--frames") && i+1 < argc) frames = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--ips") && i+1 < argc) clockHz = strtoul(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--seed") && i+1 < argc) seed = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--load") && i+1 < argc) loadPath = args[++i];
+        else if (!strcmp(args[i], "--replay") && i+1 < argc) replayPath = args[++i];
+        else if (!strcmp(args[i], "--lanes") && i+1 < argc) lanes = atoi(args[++i]);
+        else if (!strcmp(args[i], "--forks") && i+1 < argc) forks = atoi(args[++i]);
+        else if (!strcmp(args[i], "--validate") && i+1 < argc) validateEvery = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--capture") && i+1 < argc)
+        {
+            if (captureCount < CAPTURE_MAX_FILES) capturePaths[captureCount++] = args[++i];
+            else printf("[WARNING]: At most %d capture files. Ignoring '%s'.\n", CAPTURE_MAX_FILES, args[++i]);
+        }
+        else if (!strcmp(args[i], "--capture-drop")) captureDrop = true;
+        else if (romPath == NULL) romPath = args[i];
+        else printf("[WARNING]: Too many arguments. Ignoring '%s'.\n", args[i]);
+    }
+
+    if (romPath == NULL || (cycles == 0 && frames == 0 && replayPath == NULL))
+    {
+        printf("[ERROR]: Not enough arguments.\n");
+        printf("Usage: %s [--core name] [--profile name] [--ips n] [--seed n] [--load state] [--trace file] [--hotspots file] [--hotspot-period n] [--lanes n] [--forks n] [--validate n] [--capture file]... [--capture-drop] (--cycles n | --frames n | --replay movie) rom.ch8\n", args[0]);
+        return -1;
+    }
+    if (lanes && (cycles == 0 || replayPath != NULL || tracePath != NULL || hotspotPath != NULL))
+    {
+        printf("[ERROR]: --lanes runs a number of --cycles, without --replay, --trace or --hotspots.\n");
+        return -1;
+    }
+    if (validateEvery && (frames || lanes || forks || tracePath != NULL || hotspotPath != NULL || captureCount))
+    {
+        printf("[ERROR]: --validate runs a number of --cycles or a --replay, without --lanes, --forks, --trace, --hotspots or --capture.\n");
+        return -1;
+    }
+    if (lanes && captureCount)
+    {
+        printf("[ERROR]: --capture records a single machine, it can't be combined with --lanes.\n");
+        return -1;
+    }
+    if (loadPath != NULL && replayPath != NULL)
+    {
+        printf("[ERROR]: Movies start from power on, --load can't be combined with --replay.\n");
+        return -1;
+    }
+
+    // A replay brings its own seed, clock rate and profile
+    movie replay = { 0 };
+    if (replayPath != NULL)
+    {
+        if (!LoadMovie(&replay, replayPath)) return -1;
+        seed = replay.seed;
+        clockHz = replay.clockHz;
+    }
+    if (clockHz == 0)
+    {
+        printf("[ERROR]: Instructions per second must be above 0.\n");
+        return -1;
+    }
+
+    const core* cpuCore = FindCore(coreName);
+    if (cpuCore == NULL)
+    {
+        printf("[ERROR]: Unknown core '%s'.\n", coreName);
+        return -1;
+    }
+    const profile* quirkProfile = (profileName != NULL) ? FindProfile(profileName) : NULL;
+    if (profileName != NULL && quirkProfile == NULL)
+    {
+        printf("[ERROR]: Unknown profile '%s'. Profiles:\n", profileName);
+        for (int i=0; i<profileCount; i++) printf("  %-8s %s\n", profiles[i].name, profiles[i].description);
+        return -1;
+    }
+
+    if (tracePath != NULL)
+    {
+        if (cpuCore != &cores[0]) printf("[WARNING]: Tracing only works with the switch core. Using it instead.\n");
+        cpuCore = &cores[0];
+        if (!TraceStart(tracePath)) return -1;
+    }
+    if (hotspotPath != NULL)
+    {
+        // Exact counts hook into every instruction like tracing does, samples work with any core
+        if (hotspotPeriod == 0 && cpuCore != &cores[0])
+        {
+            printf("[WARNING]: Exact hot-spot counts only work with the switch core. Using it instead.\n");
+            cpuCore = &cores[0];
+        }
+        if (!HotspotsStart(hotspotPath, hotspotPeriod)) return -1;
+    }
+    if (captureCount && !CaptureStart(capturePaths, captureCount, captureDrop)) return -1;
+
+    chip8* cpu = CreateMachine(cpuCore);
+    if (!LoadRom(cpu, romPath)) return -1;
+    if (replayPath != NULL) quirkProfile = replay.profile;
+    if (quirkProfile != NULL) SetProfile(cpu, quirkProfile);
+    else if (DetectProfile(cpu->romHash) != NULL) printf("Using the %s quirk profile for this ROM\n", cpu->profile->name);
+    cpu->clockHz = clockHz;
+    SeedRandom(cpu, seed);
+    if (loadPath != NULL && !LoadState(cpu, loadPath)) return -1;
+
+    if (lanes)
+    {
+        int result = RunLanes(cpu, lanes, seed, cycles);
+        DestroyMachine(cpu);
+        return result;
+    }
+
+    if (validateEvery)
+    {
+        chip8* reference = CreateMachine(&cores[0]);
+        *reference = *cpu;
+        reference->core = &cores[0];
+        reference->blockCache = NULL;
+        if (replayPath != NULL)
+        {
+            if (replay.romHash != cpu->romHash) printf("[WARNING]: The movie was recorded with a different ROM.\n");
+            cycles = replay.endCycle - cpu->cycles;
+        }
+
+        double start = Now();
+        bool same = ValidateCore(reference, cpu, (replayPath != NULL) ? &replay : NULL, cycles, validateEvery);
+        if (same) printf("%s core, %s profile: matched the reference over %lu instructions, compared every %lu, in %.3fs\n",
+            cpu->core->name, cpu->profile->name, reference->cycles, validateEvery, Now() - start);
+        FreeMovie(&replay);
+        DestroyMachine(reference);
+        DestroyMachine(cpu);
+        return (same) ? 0 : 1;
+    }
+
+    double start = Now();
+    uint64_t done = 0;
+    if (replayPath != NULL)
+    {
+        // Every run of the same movie executes the same instructions
+        if (replay.romHash != cpu->romHash) printf("[WARNING]: The movie was recorded with a different ROM.\n");
+        for (uint32_t i=0; i<replay.count && !cpu->halted; i++)
+        {
+            done += ExecuteCycles(cpu, replay.events[i].cycle - cpu->cycles);
+            SetKeypad(cpu, replay.events[i].keys);
+        }
+        if (!cpu->halted) done += ExecuteCycles(cpu, replay.endCycle - cpu->cycles);
+        printf("Replayed %u key changes from '%s'\n", replay.count, replayPath);
+        FreeMovie(&replay);
+    }
+    else if (frames) done = ExecuteFrames(cpu, frames);
+    else done = ExecuteCycles(cpu, cycles);
+
+    PrintHeadlessRun(cpu, done, Now() - start);
+    HotspotsStop();
+    CaptureStop();
+    if (forks > 0) RunForks(cpu, forks, seed);
+    DestroyMachine(cpu);
+    TraceStop();
+    return 0;
+}
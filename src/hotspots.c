@@ -0,0 +1,205 @@
+// Hot-spot profiler. Counts where a ROM spends its instructions: per address, per opcode group and per
+// call stack, the stack being rebuilt from the 2NNN return addresses on the machine's own stack. It either
+// counts every instruction (switch core only, like tracing) or samples the machine every `period`
+// instructions on average between core slices, which any core can run at close to full speed.
+// The stacks are written as collapsed stack text ("main;sub_2a0;sub_312;0x318 1234") for flamegraph tools.
+
+#define HOTSPOT_ADDRESSES 4096
+#define HOTSPOT_MAX_DEPTH 16 // Same as the machine's stack
+
+typedef struct {
+    uint16_t frames[HOTSPOT_MAX_DEPTH + 1]; // Call targets from the outermost in, then the address itself
+    uint8_t depth; // Frames in use, at least 1
+    uint64_t count;
+} hotspotStack;
+
+struct {
+    bool enabled;
+    bool everyInstruction;
+
+    FILE* file;
+    uint32_t period;
+    uint64_t lastSample; // Cycle of the last sample
+    uint64_t nextSample;
+    uint64_t rngState; // Jitters the sampling interval so it can't lock onto a loop, separate from the machine's
+
+    uint64_t total;
+    uint64_t samples;
+    uint64_t addresses[HOTSPOT_ADDRESSES];
+    uint16_t opcodes[HOTSPOT_ADDRESSES]; // Last opcode seen at each address, for the report
+    uint64_t groups[16]; // By the top nibble of the opcode
+
+    hotspotStack* stacks; // Open addressing hash table of every distinct stack
+    uint32_t stackCapacity; // Power of two
+    uint32_t stackCount;
+} hotspotState;
+
+// Named after the OPCODE_* group each top nibble selects
+static const char* opcodeGroupNames[16] = {
+    "00E0/00EE", "JUMP", "CALL_SUBROUTINE", "REG_IS_VALUE", "REG_IS_NOT_VALUE", "REG_IS_REG", "SET_REG", "ADD_TO_REG",
+    "ARITHMETIC", "REG_IS_NOT_REG", "SET_INDEX_REG", "JUMP_OFFSET", "RANDOM", "DISPLAY", "KEY_SKIP", "F",
+};
+
+static uint32_t HashStack(const hotspotStack* s)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int i=0; i<s->depth; i++) hash = (hash ^ s->frames[i]) * 16777619u;
+    return hash;
+}
+
+static hotspotStack* FindStack(const hotspotStack* key)
+{
+    uint32_t mask = hotspotState.stackCapacity - 1;
+    for (uint32_t i=HashStack(key) & mask;; i=(i+1) & mask)
+    {
+        hotspotStack* s = &hotspotState.stacks[i];
+        if (s->depth == 0 || (s->depth == key->depth && !memcmp(s->frames, key->frames, key->depth * sizeof(uint16_t)))) return s;
+    }
+}
+
+static void GrowStacks()
+{
+    hotspotStack* old = hotspotState.stacks;
+    uint32_t oldCapacity = hotspotState.stackCapacity;
+
+    hotspotState.stackCapacity = oldCapacity ? oldCapacity * 2 : 1024;
+    hotspotState.stacks = calloc(hotspotState.stackCapacity, sizeof(hotspotStack));
+    for (uint32_t i=0; i<oldCapacity; i++)
+    {
+        if (old[i].depth) *FindStack(&old[i]) = old[i];
+    }
+    free(old);
+}
+
+bool HotspotsStart(const char* path, uint32_t period)
+{
+    hotspotState.file = fopen(path, "w");
+    if (hotspotState.file == NULL)
+    {
+        printf("[ERROR]: Failed to open hot-spot file: '%s'\n", path);
+        return false;
+    }
+
+    hotspotState.total = hotspotState.samples = 0;
+    memset(hotspotState.addresses, 0, sizeof(hotspotState.addresses));
+    memset(hotspotState.groups, 0, sizeof(hotspotState.groups));
+    hotspotState.period = period;
+    hotspotState.everyInstruction = period == 0;
+    hotspotState.lastSample = UINT64_MAX; // The first sample only starts the count
+    hotspotState.nextSample = 0;
+    hotspotState.rngState = 0x9E3779B97F4A7C15ull;
+    GrowStacks();
+    hotspotState.enabled = true;
+    return true;
+}
+
+// Counts `weight` instructions at pc under the machine's current call stack
+static void HotspotCount(const chip8* cpu, uint16_t pc, uint64_t weight)
+{
+    uint16_t opcode = (pc+1 < sizeof(cpu->memory)) ? cpu->memory[pc] << 8 | cpu->memory[pc+1] : 0;
+    hotspotState.total += weight;
+    hotspotState.addresses[pc % HOTSPOT_ADDRESSES] += weight;
+    hotspotState.opcodes[pc % HOTSPOT_ADDRESSES] = opcode;
+    hotspotState.groups[opcode >> 12] += weight;
+
+    // A return address points after its 2NNN, whose NNN is the subroutine. Code that rewrote the call since
+    // shows up as the call site with the top bit set instead.
+    hotspotStack key = { .depth = 0 };
+    for (int i=0; i<cpu->sp && i<HOTSPOT_MAX_DEPTH; i++)
+    {
+        uint16_t site = cpu->stack[i] - 2;
+        uint16_t call = (site+1 < sizeof(cpu->memory)) ? cpu->memory[site] << 8 | cpu->memory[site+1] : 0;
+        key.frames[key.depth++] = ((call & 0xF000) == OPCODE_CALL_SUBROUTINE) ? OPCODE_NNN(call) : 0x8000 | site;
+    }
+    key.frames[key.depth++] = pc;
+
+    if (hotspotState.stackCount * 2 >= hotspotState.stackCapacity) GrowStacks();
+    hotspotStack* s = FindStack(&key);
+    if (s->depth == 0)
+    {
+        *s = key;
+        hotspotState.stackCount++;
+    }
+    s->count += weight;
+}
+
+// Called between core slices when sampling, the sample stands in for every instruction since the last one.
+// Wait loops skipped in one go land in a single heavy sample at the loop, which is where the time went.
+static void HotspotSample(chip8* cpu)
+{
+    // A machine that went back in time (a savestate or a fork) starts over from here
+    if (cpu->cycles > hotspotState.lastSample)
+    {
+        HotspotCount(cpu, cpu->pc, cpu->cycles - hotspotState.lastSample);
+        hotspotState.samples++;
+    }
+    hotspotState.lastSample = cpu->cycles;
+
+    // Uniform over [period/2, period*3/2) so the samples still average one per period
+    uint64_t interval = hotspotState.period/2 + XorShift(&hotspotState.rngState) % hotspotState.period;
+    hotspotState.nextSample = cpu->cycles + (interval ? interval : 1);
+}
+
+// Takes a sample if one is due and shortens the slice to end at the next one
+static inline uint64_t HotspotSlice(chip8* cpu, uint64_t slice)
+{
+    if (cpu->cycles >= hotspotState.nextSample || cpu->cycles < hotspotState.lastSample) HotspotSample(cpu);
+    uint64_t untilSample = hotspotState.nextSample - cpu->cycles;
+    return (slice < untilSample) ? slice : untilSample;
+}
+
+static void WriteStackFrame(FILE* file, uint16_t frame)
+{
+    if (frame & 0x8000) fprintf(file, ";call_%03x", frame & 0xFFF);
+    else fprintf(file, ";sub_%03x", frame);
+}
+
+static int CompareAddresses(const void* a, const void* b)
+{
+    uint64_t countA = hotspotState.addresses[*(const uint16_t*)a];
+    uint64_t countB = hotspotState.addresses[*(const uint16_t*)b];
+    return (countA < countB) - (countA > countB);
+}
+
+void HotspotsStop()
+{
+    if (!hotspotState.enabled) return;
+    hotspotState.enabled = false;
+    hotspotState.everyInstruction = false;
+
+    for (uint32_t i=0; i<hotspotState.stackCapacity; i++)
+    {
+        const hotspotStack* s = &hotspotState.stacks[i];
+        if (s->depth == 0) continue;
+        fprintf(hotspotState.file, "main");
+        for (int f=0; f<s->depth-1; f++) WriteStackFrame(hotspotState.file, s->frames[f]);
+        fprintf(hotspotState.file, ";0x%03x %lu\n", s->frames[s->depth-1], s->count);
+    }
+    fclose(hotspotState.file);
+
+    if (hotspotState.period == 0) printf("Hot spots: %lu instructions counted", hotspotState.total);
+    else printf("Hot spots: %lu samples, one every %u instructions on average", hotspotState.samples, hotspotState.period);
+    printf(", %u distinct stacks\n", hotspotState.stackCount);
+
+    uint64_t total = hotspotState.total ? hotspotState.total : 1;
+    uint16_t order[HOTSPOT_ADDRESSES];
+    for (int i=0; i<HOTSPOT_ADDRESSES; i++) order[i] = i;
+    qsort(order, HOTSPOT_ADDRESSES, sizeof(order[0]), CompareAddresses);
+    for (int i=0; i<10 && hotspotState.addresses[order[i]]; i++)
+    {
+        char text[32];
+        FormatMnemonic(hotspotState.opcodes[order[i]], text, sizeof(text));
+        printf("  %03x %6.2f%%  %04x %s\n", order[i], 100.0 * hotspotState.addresses[order[i]] / total, hotspotState.opcodes[order[i]], text);
+    }
+
+    printf("Opcode groups:");
+    for (int i=0; i<16; i++)
+    {
+        if (hotspotState.groups[i]) printf(" %s %.1f%%", opcodeGroupNames[i], 100.0 * hotspotState.groups[i] / total);
+    }
+    printf("\n");
+
+    free(hotspotState.stacks);
+    hotspotState.stacks = NULL;
+    hotspotState.stackCapacity = hotspotState.stackCount = 0;
+}
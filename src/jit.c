@@ -0,0 +1,705 @@
+// x86-64 dynamic recompiler. Hot blocks from the block cache are translated into native code that keeps the
+// V registers and I it touches in host registers for the length of the block and writes them back when it
+// leaves or calls out. The display, RNG and memory opcodes call the core's helper for just that instruction,
+// the keypad and stack ones are inlined, only invalid opcodes and stack errors go through the interpreter.
+//
+// Blocks run straight into each other. An exit to a static target (jumps, calls, skips, running into the
+// next block) returns to RunJitWith the first time, which patches it into a jump to the target's native
+// code once that is compiled. The instructions left in the slice live in a register and each block takes
+// its length off it on entry, bailing out to RunJitWith when it doesn't fit. When a store overwrites a
+// block, its entry is patched into a jump to that bail-out, so nothing linked to it runs the stale code.
+
+#define JIT_HOT_RUNS 8 // Times a block is interpreted before it gets compiled
+#define JIT_CODE_SIZE (1 << 20)
+#define JIT_MAX_BLOCK_CODE 8192 // Upper bound for the code of one block
+
+enum { JIT_UNTRIED, JIT_COMPILED, JIT_UNCOMPILABLE };
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define JIT_SUPPORTED
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+#define JIT_CPU R15 // The chip8 pointer
+#define JIT_BUDGET R14 // Instructions left in the slice
+
+// Host registers the V registers and I are kept in, the ones that survive calls first
+static const uint8_t jitRegisters[] = { RBX, RBP, R12, R13, RSI, RDI, R8, R9, R10, R11 };
+#define JIT_REGISTER_COUNT (int)sizeof(jitRegisters)
+#define JIT_CALLER_SAVED(reg) ((reg) != RBX && (reg) != RBP && (reg) < R12)
+#define SLOT_I 16 // Slots 0-15 are V0-VF
+#define SLOT_COUNT 17
+#define SLOT_BIT(slot) (1u << (slot))
+#define ALL_SLOTS ((1u << SLOT_COUNT) - 1)
+
+typedef struct {
+    uint8_t* code;
+    size_t size;
+
+    // Where each slot is while compiling a block
+    int8_t host[SLOT_COUNT]; // Host register, -1 if it's only in the chip8 struct
+    uint32_t dirty; // Slots changed since they were loaded
+    uint32_t lastUse[SLOT_COUNT]; // To evict the least recently used one
+    uint32_t clock;
+} emitter;
+
+static void Emit8(emitter* e, uint8_t value) { e->code[e->size++] = value; }
+static void Emit16(emitter* e, uint16_t value) { memcpy(&e->code[e->size], &value, 2); e->size += 2; }
+static void Emit32(emitter* e, uint32_t value) { memcpy(&e->code[e->size], &value, 4); e->size += 4; }
+static void Emit64(emitter* e, uint64_t value) { memcpy(&e->code[e->size], &value, 8); e->size += 8; }
+
+// REX prefix for a ModRM with `reg` and `rm`, `bytes` forces it so 4-7 are spl-dil and not ah-bh
+static void Rex(emitter* e, bool wide, int reg, int rm, bool bytes)
+{
+    uint8_t rex = 0x40 | wide << 3 | (reg >> 3) << 2 | rm >> 3;
+    if (rex != 0x40 || bytes) Emit8(e, rex);
+}
+
+static void ModRegs(emitter* e, int reg, int rm) { Emit8(e, 0xC0 | (reg & 7) << 3 | (rm & 7)); }
+static void ModMem(emitter* e, int reg, uint32_t offset) { Emit8(e, 0x80 | (reg & 7) << 3 | (JIT_CPU & 7)); Emit32(e, offset); } // [r15 + disp32]
+
+static void LoadByte(emitter* e, int reg, uint32_t offset) { Rex(e, false, reg, JIT_CPU, false); Emit8(e, 0x0F); Emit8(e, 0xB6); ModMem(e, reg, offset); } // movzx r32, byte [cpu+off]
+static void LoadWord(emitter* e, int reg, uint32_t offset) { Rex(e, false, reg, JIT_CPU, false); Emit8(e, 0x0F); Emit8(e, 0xB7); ModMem(e, reg, offset); } // movzx r32, word [cpu+off]
+static void StoreByte(emitter* e, uint32_t offset, int reg) { Rex(e, false, reg, JIT_CPU, false); Emit8(e, 0x88); ModMem(e, reg, offset); }
+static void StoreWord(emitter* e, uint32_t offset, int reg) { Emit8(e, 0x66); Rex(e, false, reg, JIT_CPU, false); Emit8(e, 0x89); ModMem(e, reg, offset); }
+static void StoreByteImm(emitter* e, uint32_t offset, uint8_t value) { Rex(e, false, 0, JIT_CPU, false); Emit8(e, 0xC6); ModMem(e, 0, offset); Emit8(e, value); }
+static void StoreWordImm(emitter* e, uint32_t offset, uint16_t value) { Emit8(e, 0x66); Rex(e, false, 0, JIT_CPU, false); Emit8(e, 0xC7); ModMem(e, 0, offset); Emit16(e, value); }
+
+// op dst, src for the 01/09/21/29/31/39/85/89 family (add/or/and/sub/xor/cmp/test/mov), 32 bit
+static void AluReg(emitter* e, uint8_t op, int dst, int src) { Rex(e, false, src, dst, false); Emit8(e, op); ModRegs(e, src, dst); }
+#define ALU_ADD 0x01
+#define ALU_OR 0x09
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_XOR 0x31
+#define ALU_CMP 0x39
+#define ALU_TEST 0x85
+#define ALU_MOV 0x89
+
+static void AluImm(emitter* e, int ext, int reg, uint32_t value) { Rex(e, false, 0, reg, false); Emit8(e, 0x81); ModRegs(e, ext, reg); Emit32(e, value); } // op r32, imm32
+#define IMM_ADD 0
+#define IMM_AND 4
+#define IMM_SUB 5
+#define IMM_CMP 7
+
+static void MoveImm(emitter* e, int reg, uint32_t value) { Rex(e, false, 0, reg, false); Emit8(e, 0xB8 | (reg & 7)); Emit32(e, value); }
+static void Move64(emitter* e, int dst, int src) { Rex(e, true, src, dst, false); Emit8(e, 0x89); ModRegs(e, src, dst); }
+static void ShiftRight(emitter* e, int reg, uint8_t count) { Rex(e, false, 0, reg, false); Emit8(e, 0xC1); ModRegs(e, 5, reg); Emit8(e, count); }
+static void ShiftLeft(emitter* e, int reg, uint8_t count) { Rex(e, false, 0, reg, false); Emit8(e, 0xC1); ModRegs(e, 4, reg); Emit8(e, count); }
+static void ZeroExtend8(emitter* e, int dst, int src) { Rex(e, false, dst, src, true); Emit8(e, 0x0F); Emit8(e, 0xB6); ModRegs(e, dst, src); } // movzx r32, r8
+static void ZeroExtend16(emitter* e, int dst, int src) { Rex(e, false, dst, src, false); Emit8(e, 0x0F); Emit8(e, 0xB7); ModRegs(e, dst, src); } // movzx r32, r16
+static void SetCondition(emitter* e, uint8_t cc, int reg) { Rex(e, false, 0, reg, true); Emit8(e, 0x0F); Emit8(e, 0x90 | cc); ModRegs(e, 0, reg); } // setcc r8
+static void MultiplyImm(emitter* e, int reg, uint8_t value) { Rex(e, false, reg, reg, false); Emit8(e, 0x6B); ModRegs(e, reg, reg); Emit8(e, value); } // imul r32, r32, imm8
+#define CC_B 0x2 // Also the carry bt leaves
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+
+// Budget register, add/sub/cmp r14, imm8
+static void BudgetImm(emitter* e, int ext, uint8_t value) { Rex(e, true, 0, JIT_BUDGET, false); Emit8(e, 0x83); ModRegs(e, ext, JIT_BUDGET); Emit8(e, value); }
+
+// Jumps to a known address, and conditional ones to code emitted later that PatchJump points at
+static void EmitJumpTo(emitter* e, const uint8_t* target) { Emit8(e, 0xE9); Emit32(e, target - (e->code + e->size + 4)); }
+static size_t EmitJump(emitter* e, uint8_t cc) { Emit8(e, 0x0F); Emit8(e, 0x80 | cc); Emit32(e, 0); return e->size; }
+static void PatchJump(emitter* e, size_t from) { uint32_t rel = e->size - from; memcpy(&e->code[from-4], &rel, 4); }
+
+#define OFFSET(field) ((uint32_t)offsetof(chip8, field))
+#define OFFSET_V(i) (OFFSET(V) + (i))
+
+static void WriteBack(emitter* e, int slot)
+{
+    if (!(e->dirty & SLOT_BIT(slot))) return;
+    if (slot == SLOT_I) StoreWord(e, OFFSET(I), e->host[slot]);
+    else StoreByte(e, OFFSET_V(slot), e->host[slot]);
+    e->dirty &= ~SLOT_BIT(slot);
+}
+
+static void WriteBackAll(emitter* e)
+{
+    for (int slot=0; slot<SLOT_COUNT; slot++) WriteBack(e, slot);
+}
+
+// A free host register, evicting the slot used longest ago if there is none
+static int Allocate(emitter* e)
+{
+    for (int i=0; i<JIT_REGISTER_COUNT; i++)
+    {
+        bool taken = false;
+        for (int slot=0; slot<SLOT_COUNT; slot++) taken |= e->host[slot] == jitRegisters[i];
+        if (!taken) return jitRegisters[i];
+    }
+    int victim = -1;
+    for (int slot=0; slot<SLOT_COUNT; slot++)
+    {
+        if (e->host[slot] >= 0 && (victim < 0 || e->lastUse[slot] < e->lastUse[victim])) victim = slot;
+    }
+    WriteBack(e, victim);
+    int reg = e->host[victim];
+    e->host[victim] = -1;
+    return reg;
+}
+
+// The host register holding a slot, loaded from the chip8 struct on first use in the block
+static int Get(emitter* e, int slot)
+{
+    if (e->host[slot] < 0)
+    {
+        int reg = Allocate(e);
+        if (slot == SLOT_I) LoadWord(e, reg, OFFSET(I));
+        else LoadByte(e, reg, OFFSET_V(slot));
+        e->host[slot] = reg;
+    }
+    e->lastUse[slot] = ++e->clock;
+    return e->host[slot];
+}
+
+// The host register a slot is about to be overwritten in. V registers always hold 0-255 and I 0-65535.
+static int Set(emitter* e, int slot)
+{
+    if (e->host[slot] < 0) e->host[slot] = Allocate(e);
+    e->dirty |= SLOT_BIT(slot);
+    e->lastUse[slot] = ++e->clock;
+    return e->host[slot];
+}
+
+// Calls fn(cpu, a, b, c). The core reads the slots in `reads` and writes those in `writes` from the chip8
+// struct, everything in a register the call may clobber is written back and forgotten.
+static void EmitCall(emitter* e, const void* fn, uint32_t a, uint32_t b, uint32_t c, uint32_t reads, uint32_t writes, uint64_t* calls)
+{
+    for (int slot=0; slot<SLOT_COUNT; slot++)
+    {
+        if (e->host[slot] < 0) continue;
+        bool clobbered = JIT_CALLER_SAVED(e->host[slot]) || (writes & SLOT_BIT(slot));
+        if (clobbered || (reads & SLOT_BIT(slot))) WriteBack(e, slot);
+        if (clobbered) e->host[slot] = -1;
+    }
+    Emit8(e, 0x48); Emit8(e, 0xB8); Emit64(e, (uint64_t)calls); // mov rax, &calls
+    Emit8(e, 0x48); Emit8(e, 0xFF); Emit8(e, 0x00); // inc qword [rax]
+    Move64(e, RDI, JIT_CPU);
+    MoveImm(e, RSI, a);
+    MoveImm(e, RDX, b);
+    MoveImm(e, RCX, c);
+    Emit8(e, 0x48); Emit8(e, 0xB8); Emit64(e, (uint64_t)fn); // mov rax, fn
+    Emit8(e, 0xFF); Emit8(e, 0xD0); // call rax
+}
+
+// Leaves for a static target: stores the last opcode and pc and returns the address of the pc store to
+// RunJitWith, which can overwrite it with a jump to the target block (unless `linkable` is false)
+static void EmitExit(emitter* e, const struct blockCache* cache, uint16_t pc, uint16_t lastOpcode, bool linkable)
+{
+    StoreWordImm(e, OFFSET(opcode), lastOpcode);
+    size_t store = e->size;
+    StoreWordImm(e, OFFSET(pc), pc);
+    if (linkable)
+    {
+        Emit8(e, 0x48); Emit8(e, 0x8D); Emit8(e, 0x05); Emit32(e, store - (e->size + 4)); // lea rax, [the pc store]
+    }
+    else
+    {
+        Emit8(e, 0x31); Emit8(e, 0xC0); // xor eax, eax
+    }
+    EmitJumpTo(e, cache->exitNative);
+}
+
+// Leaves with pc and the opcode already in the chip8 struct
+static void EmitDynamicExit(emitter* e, const struct blockCache* cache)
+{
+    Emit8(e, 0x31); Emit8(e, 0xC0); // xor eax, eax
+    EmitJumpTo(e, cache->exitNative);
+}
+
+// Leaves for the pc in ecx, straight into its block's native code when it has some (00EE and BNNN)
+static void EmitIndirectExit(emitter* e, const struct blockCache* cache, uint16_t lastOpcode)
+{
+    StoreWordImm(e, OFFSET(opcode), lastOpcode);
+    StoreWord(e, OFFSET(pc), RCX);
+    AluImm(e, IMM_CMP, RCX, BLOCK_CODE_SIZE - 1);
+    size_t outside = EmitJump(e, CC_AE);
+    Emit8(e, 0x48); Emit8(e, 0xB8); Emit64(e, (uint64_t)cache->blocks); // mov rax, blocks
+    Emit8(e, 0x48); Emit8(e, 0x8B); Emit8(e, 0x04); Emit8(e, 0xC8); // mov rax, [rax+rcx*8]
+    Emit8(e, 0x48); Emit8(e, 0x85); Emit8(e, 0xC0); // test rax, rax
+    size_t missing = EmitJump(e, CC_E);
+    Emit8(e, 0x48); Emit8(e, 0x8B); Emit8(e, 0x80); Emit32(e, offsetof(block, native)); // mov rax, [rax+native]
+    Emit8(e, 0x48); Emit8(e, 0x85); Emit8(e, 0xC0); // test rax, rax
+    size_t cold = EmitJump(e, CC_E);
+    Emit8(e, 0xFF); Emit8(e, 0xE0); // jmp rax
+    PatchJump(e, outside);
+    PatchJump(e, missing);
+    PatchJump(e, cold);
+    EmitDynamicExit(e, cache);
+}
+
+// Both ways out of a skip, the flags of the comparison pick one
+static void EmitBranch(emitter* e, const struct blockCache* cache, uint8_t skipIf, uint16_t next, uint16_t opcode)
+{
+    size_t skip = EmitJump(e, skipIf);
+    EmitExit(e, cache, next, opcode, true);
+    PatchJump(e, skip);
+    EmitExit(e, cache, next + 2, opcode, true);
+}
+
+// Runs the instruction at `address` on the profile's interpreter, for invalid opcodes and stack errors
+static void EmitInterpret(emitter* e, struct blockCache* cache, uint16_t address, void (*interpret)(chip8*))
+{
+    WriteBackAll(e);
+    StoreWordImm(e, OFFSET(pc), address);
+    EmitCall(e, (const void*)interpret, 0, 0, 0, ALL_SLOTS, ALL_SLOTS, &cache->jitStats.calls);
+    EmitDynamicExit(e, cache);
+}
+
+// FX55, FX65 and FX33 for the native code, the same loops the interpreter runs
+static void JitStoreMemory(chip8* cpu, uint32_t x, uint32_t increment)
+{
+    uint16_t start = cpu->I;
+    for (uint32_t i=0; i<=x; i++) WriteMemory(cpu, (uint16_t)(start + i), cpu->V[i]);
+    if (increment) cpu->I += x+1;
+    MarkMemoryWritten(cpu, start, x+1);
+}
+
+static void JitLoadMemory(chip8* cpu, uint32_t x, uint32_t increment)
+{
+    uint16_t start = cpu->I;
+    for (uint32_t i=0; i<=x; i++) cpu->V[i] = ReadMemory(cpu, (uint16_t)(start + i));
+    if (increment) cpu->I += x+1;
+}
+
+static void JitConvertDecimal(chip8* cpu, uint32_t x)
+{
+    WriteMemory(cpu, cpu->I, cpu->V[x] / 100);
+    WriteMemory(cpu, cpu->I + 1, (cpu->V[x] / 10) % 10);
+    WriteMemory(cpu, cpu->I + 2, cpu->V[x] % 10);
+    MarkMemoryWritten(cpu, cpu->I, 3);
+}
+
+static void ExecuteScrollRight(chip8* cpu) { ExecuteScroll(cpu, 4, 0); }
+static void ExecuteScrollLeft(chip8* cpu) { ExecuteScroll(cpu, -4, 0); }
+static void ExecuteScrollDown(chip8* cpu, uint32_t rows) { ExecuteScroll(cpu, 0, rows); }
+static void ExecuteScrollUp(chip8* cpu, uint32_t rows) { ExecuteScroll(cpu, 0, -(int)rows); }
+
+// Compiles one op. The quirks are baked into the code, so SetProfile flushes the cache. Every op that ends
+// a block leaves it here, after writing the slots back.
+static void CompileOp(emitter* e, struct blockCache* cache, const decodedOp* d, uint32_t quirks, uint16_t address, void (*interpret)(chip8*))
+{
+    uint16_t opcode = d - decodeTable;
+    uint16_t next = address + 2;
+    uint64_t* calls = &cache->jitStats.calls;
+
+    switch (d->op)
+    {
+        case OP_NOP: break;
+        case OP_SET_REG: MoveImm(e, Set(e, d->x), d->nn); break;
+
+        case OP_ADD_TO_REG:
+        {
+            int vX = Get(e, d->x);
+            AluImm(e, IMM_ADD, vX, d->nn);
+            ZeroExtend8(e, vX, vX);
+            Set(e, d->x);
+        } break;
+
+        case OP_SET:
+        {
+            int vY = Get(e, d->y);
+            AluReg(e, ALU_MOV, Set(e, d->x), vY);
+        } break;
+
+        case OP_BINARY_OR:
+        case OP_BINARY_AND:
+        case OP_LOGICAL_XOR:
+        {
+            int vY = Get(e, d->y);
+            int vX = Get(e, d->x);
+            AluReg(e, (d->op == OP_BINARY_OR) ? ALU_OR : (d->op == OP_BINARY_AND) ? ALU_AND : ALU_XOR, vX, vY);
+            Set(e, d->x);
+            if (quirks & QUIRK_VF_RESET) MoveImm(e, Set(e, 0xF), 0);
+        } break;
+
+        case OP_ADD:
+        {
+            int vY = Get(e, d->y);
+            int vX = Get(e, d->x);
+            AluReg(e, ALU_MOV, RAX, vX);
+            AluReg(e, ALU_ADD, RAX, vY);
+            ZeroExtend8(e, Set(e, d->x), RAX);
+            ShiftRight(e, RAX, 8); // The 9 bit sum leaves the carry in bit 8
+            AluReg(e, ALU_MOV, Set(e, 0xF), RAX);
+        } break;
+
+        case OP_SUBTRACT_XY:
+        case OP_SUBTRACT_YX:
+        {
+            int vY = Get(e, d->y);
+            int vX = Get(e, d->x);
+            int minuend = (d->op == OP_SUBTRACT_XY) ? vX : vY;
+            int subtrahend = (d->op == OP_SUBTRACT_XY) ? vY : vX;
+            AluReg(e, ALU_MOV, RAX, minuend);
+            AluReg(e, ALU_CMP, RAX, subtrahend);
+            SetCondition(e, CC_AE, RCX); // No borrow
+            AluReg(e, ALU_SUB, RAX, subtrahend);
+            ZeroExtend8(e, Set(e, d->x), RAX);
+            ZeroExtend8(e, Set(e, 0xF), RCX);
+        } break;
+
+        case OP_SHIFT_RIGHT:
+        case OP_SHIFT_LEFT:
+        {
+            AluReg(e, ALU_MOV, RAX, Get(e, (quirks & QUIRK_SHIFT_VY) ? d->y : d->x));
+            AluReg(e, ALU_MOV, RCX, RAX);
+            if (d->op == OP_SHIFT_RIGHT)
+            {
+                AluImm(e, IMM_AND, RCX, 1);
+                ShiftRight(e, RAX, 1);
+            }
+            else
+            {
+                ShiftRight(e, RCX, 7);
+                ShiftLeft(e, RAX, 1);
+            }
+            ZeroExtend8(e, Set(e, d->x), RAX);
+            AluReg(e, ALU_MOV, Set(e, 0xF), RCX);
+        } break;
+
+        case OP_SET_INDEX_REG: MoveImm(e, Set(e, SLOT_I), d->nnn); break;
+
+        case OP_ADD_TO_INDEX:
+        {
+            int vX = Get(e, d->x);
+            int I = Get(e, SLOT_I);
+            AluReg(e, ALU_ADD, I, vX);
+            ZeroExtend16(e, I, I);
+            Set(e, SLOT_I);
+        } break;
+
+        case OP_FONT_CHARACTER:
+        case OP_BIG_FONT_CHARACTER:
+        {
+            int vX = Get(e, d->x);
+            int I = Set(e, SLOT_I);
+            AluReg(e, ALU_MOV, I, vX);
+            AluImm(e, IMM_AND, I, 0x0F);
+            if (d->op == OP_FONT_CHARACTER) MultiplyImm(e, I, 5);
+            else
+            {
+                MultiplyImm(e, I, 10);
+                AluImm(e, IMM_ADD, I, BIG_FONT_START);
+            }
+        } break;
+
+        case OP_GET_DELAY_TIMER: LoadByte(e, Set(e, d->x), OFFSET(delayTimer)); break;
+        case OP_SET_DELAY_TIMER: StoreByte(e, OFFSET(delayTimer), Get(e, d->x)); break;
+        case OP_SELECT_PLANES: StoreByteImm(e, OFFSET(planeMask), d->x & ((1 << DISPLAY_PLANES) - 1)); break;
+
+        case OP_SET_SOUND_TIMER:
+            StoreByte(e, OFFSET(soundTimer), Get(e, d->x));
+            WriteBackAll(e);
+            EmitExit(e, cache, next, opcode, false); // Back to ExecuteCycles for the buzzer edge
+            break;
+
+        case OP_CLEAR_SCREEN: EmitCall(e, (const void*)ExecuteClear, 0, 0, 0, 0, 0, calls); break;
+        case OP_SCROLL_RIGHT: EmitCall(e, (const void*)ExecuteScrollRight, 0, 0, 0, 0, 0, calls); break;
+        case OP_SCROLL_LEFT: EmitCall(e, (const void*)ExecuteScrollLeft, 0, 0, 0, 0, 0, calls); break;
+        case OP_SCROLL_DOWN: EmitCall(e, (const void*)ExecuteScrollDown, d->n, 0, 0, 0, 0, calls); break;
+        case OP_SCROLL_UP: EmitCall(e, (const void*)ExecuteScrollUp, d->n, 0, 0, 0, 0, calls); break;
+        case OP_LORES: case OP_HIRES: EmitCall(e, (const void*)ExecuteResolution, d->op == OP_HIRES, 0, 0, 0, 0, calls); break;
+        case OP_DISPLAY: EmitCall(e, (const void*)ExecuteDraw, d->x, d->y, d->n, SLOT_BIT(d->x) | SLOT_BIT(d->y) | SLOT_BIT(SLOT_I), SLOT_BIT(0xF), calls); break;
+
+        case OP_RANDOM:
+            EmitCall(e, (const void*)ExecuteRandom, d->nn, 0, 0, 0, 0, calls);
+            ZeroExtend8(e, Set(e, d->x), RAX);
+            break;
+
+        case OP_LOAD_MEMORY:
+        {
+            uint32_t loaded = SLOT_BIT(d->x + 1) - 1;
+            EmitCall(e, (const void*)JitLoadMemory, d->x, (quirks & QUIRK_MEMORY_INCREMENT) != 0, 0, SLOT_BIT(SLOT_I), loaded | SLOT_BIT(SLOT_I), calls);
+        } break;
+
+        case OP_STORE_MEMORY:
+        case OP_CONVERT_DECIMAL:
+            if (d->op == OP_STORE_MEMORY) EmitCall(e, (const void*)JitStoreMemory, d->x, (quirks & QUIRK_MEMORY_INCREMENT) != 0, 0, ALL_SLOTS, SLOT_BIT(SLOT_I), calls);
+            else EmitCall(e, (const void*)JitConvertDecimal, d->x, 0, 0, ALL_SLOTS, 0, calls);
+            WriteBackAll(e);
+            EmitExit(e, cache, next, opcode, true); // A block the store overwrote has had its entry unlinked
+            break;
+
+        case OP_JUMP:
+            WriteBackAll(e);
+            EmitExit(e, cache, d->nnn, opcode, true);
+            break;
+
+        case OP_JUMP_OFFSET:
+            AluReg(e, ALU_MOV, RAX, Get(e, (quirks & QUIRK_JUMP_VX) ? d->x : 0));
+            WriteBackAll(e);
+            AluImm(e, IMM_ADD, RAX, d->nnn);
+            AluReg(e, ALU_MOV, RCX, RAX);
+            EmitIndirectExit(e, cache, opcode);
+            break;
+
+        case OP_REG_IS_VALUE:
+        case OP_REG_IS_NOT_VALUE:
+        case OP_REG_IS_REG:
+        case OP_REG_IS_NOT_REG:
+        {
+            int vY = (d->op == OP_REG_IS_REG || d->op == OP_REG_IS_NOT_REG) ? Get(e, d->y) : -1;
+            int vX = Get(e, d->x);
+            WriteBackAll(e);
+            if (vY < 0) AluImm(e, IMM_CMP, vX, d->nn);
+            else AluReg(e, ALU_CMP, vX, vY);
+            EmitBranch(e, cache, (d->op == OP_REG_IS_VALUE || d->op == OP_REG_IS_REG) ? CC_E : CC_NE, next, opcode);
+        } break;
+
+        case OP_SKIP_IF_KEY:
+        case OP_SKIP_IF_NOT_KEY:
+            AluReg(e, ALU_MOV, RCX, Get(e, d->x));
+            WriteBackAll(e);
+            AluImm(e, IMM_AND, RCX, 0xF);
+            LoadWord(e, RAX, OFFSET(keypad));
+            Emit8(e, 0x0F); Emit8(e, 0xA3); Emit8(e, 0xC8); // bt eax, ecx
+            EmitBranch(e, cache, (d->op == OP_SKIP_IF_KEY) ? CC_B : CC_AE, next, opcode);
+            break;
+
+        case OP_AWAIT_KEY:
+        {
+            // The lowest key that is down, or wait here for one
+            WriteBackAll(e);
+            LoadWord(e, RAX, OFFSET(keypad));
+            AluReg(e, ALU_TEST, RAX, RAX);
+            size_t pressed = EmitJump(e, CC_NE);
+            EmitExit(e, cache, address, opcode, true);
+            PatchJump(e, pressed);
+            Emit8(e, 0x0F); Emit8(e, 0xBC); Emit8(e, 0xC0); // bsf eax, eax
+            StoreByte(e, OFFSET_V(d->x), RAX);
+            EmitExit(e, cache, next, opcode, true);
+        } break;
+
+        case OP_CALL_SUBROUTINE:
+        {
+            WriteBackAll(e);
+            LoadByte(e, RAX, OFFSET(sp));
+            AluImm(e, IMM_CMP, RAX, 16);
+            size_t full = EmitJump(e, CC_AE);
+            Emit8(e, 0x66); Emit8(e, 0x41); Emit8(e, 0xC7); Emit8(e, 0x84); Emit8(e, 0x47); Emit32(e, OFFSET(stack)); Emit16(e, next); // mov word [r15+rax*2+stack], next
+            Emit8(e, 0x41); Emit8(e, 0xFE); ModMem(e, 0, OFFSET(sp)); // inc byte [r15+sp]
+            EmitExit(e, cache, d->nnn, opcode, true);
+            PatchJump(e, full);
+            EmitInterpret(e, cache, address, interpret); // Reports the overflow
+        } break;
+
+        case OP_RETURN_SUBROUTINE:
+        {
+            WriteBackAll(e);
+            LoadByte(e, RAX, OFFSET(sp));
+            AluReg(e, ALU_TEST, RAX, RAX);
+            size_t empty = EmitJump(e, CC_E);
+            AluImm(e, IMM_SUB, RAX, 1);
+            StoreByte(e, OFFSET(sp), RAX);
+            Emit8(e, 0x41); Emit8(e, 0x0F); Emit8(e, 0xB7); Emit8(e, 0x8C); Emit8(e, 0x47); Emit32(e, OFFSET(stack)); // movzx ecx, word [r15+rax*2+stack]
+            EmitIndirectExit(e, cache, opcode);
+            PatchJump(e, empty);
+            EmitInterpret(e, cache, address, interpret); // Warns and goes on
+        } break;
+
+        default:
+            EmitInterpret(e, cache, address, interpret); // Invalid opcodes and 00FD, both end the block
+            break;
+    }
+}
+
+// The start of the code buffer: the entry RunJitWith calls with (cpu, native, budget) and the exit every
+// block jumps to with the exit to link, or 0, in rax. That goes to the cache, a store to the code's own
+// pages would flush the pipeline every time. The entry pushes the registers the
+// native code uses that the ABI has callers keep, plus the budget, which leaves the stack 16-byte aligned
+// for the calls out.
+static void EmitTrampolines(struct blockCache* cache)
+{
+    emitter e = { cache->code, 0 };
+    cache->enterNative = (uint64_t (*)(chip8*, const uint8_t*, uint64_t))(e.code + e.size);
+    Emit8(&e, 0x53); Emit8(&e, 0x55); // push rbx, push rbp
+    Emit8(&e, 0x41); Emit8(&e, 0x54); Emit8(&e, 0x41); Emit8(&e, 0x55); // push r12, push r13
+    Emit8(&e, 0x41); Emit8(&e, 0x56); Emit8(&e, 0x41); Emit8(&e, 0x57); // push r14, push r15
+    Emit8(&e, 0x52); // push rdx, the budget
+    Move64(&e, JIT_CPU, RDI);
+    Move64(&e, JIT_BUDGET, RDX);
+    Emit8(&e, 0xFF); Emit8(&e, 0xE6); // jmp rsi
+
+    cache->exitNative = e.code + e.size;
+    Emit8(&e, 0x48); Emit8(&e, 0xB9); Emit64(&e, (uint64_t)&cache->lastExit); // mov rcx, &lastExit
+    Emit8(&e, 0x48); Emit8(&e, 0x89); Emit8(&e, 0x01); // mov [rcx], rax
+    Emit8(&e, 0x58); // pop rax
+    Rex(&e, true, JIT_BUDGET, RAX, false); Emit8(&e, ALU_SUB); ModRegs(&e, JIT_BUDGET, RAX); // sub rax, r14
+    Emit8(&e, 0x41); Emit8(&e, 0x5F); Emit8(&e, 0x41); Emit8(&e, 0x5E); // pop r15, pop r14
+    Emit8(&e, 0x41); Emit8(&e, 0x5D); Emit8(&e, 0x41); Emit8(&e, 0x5C); // pop r13, pop r12
+    Emit8(&e, 0x5D); Emit8(&e, 0x5B); // pop rbp, pop rbx
+    Emit8(&e, 0xC3); // ret
+    cache->codeUsed = (e.size + 15) & ~15;
+}
+
+// A block's code starts with its bail-out: give the length back, store pc and return. The entry after it
+// takes the length off the budget and goes there when it was too short. Unlinking turns the entry into a
+// jump to the pc store.
+#define JIT_BAIL_SIZE 21
+#define JIT_BAIL_STORE 4 // Offset of the pc store
+
+static void JitUnlink(block* b)
+{
+    b->native[0] = 0xEB; // jmp rel8
+    b->native[1] = (uint8_t)(JIT_BAIL_STORE - JIT_BAIL_SIZE - 2);
+}
+
+// Patches the exit the native code last left through into a jump to the block it was going to, once that
+// one has been compiled
+static void LinkExit(struct blockCache* cache, uint16_t pc)
+{
+    uint8_t* exit = cache->lastExit;
+    cache->lastExit = NULL;
+    if (exit == NULL || pc >= BLOCK_CODE_SIZE || cache->blocks[pc] == NULL || cache->blocks[pc]->jitState != JIT_COMPILED) return;
+
+    emitter e = { exit, 0 };
+    EmitJumpTo(&e, cache->blocks[pc]->native);
+    cache->jitStats.links++;
+}
+
+static void JitCompile(struct blockCache* cache, block* b, uint32_t quirks, void (*interpret)(chip8*))
+{
+    if (cache->code == NULL)
+    {
+        cache->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (cache->code == MAP_FAILED)
+        {
+            printf("[WARNING]: Could not map executable memory, the JIT will only interpret.\n");
+            cache->code = NULL;
+            b->jitState = JIT_UNCOMPILABLE;
+            return;
+        }
+    }
+    if (cache->codeUsed == 0) EmitTrampolines(cache); // Flushing the blocks emptied the buffer
+
+    emitter e = { cache->code + cache->codeUsed, 0 };
+    memset(e.host, -1, sizeof(e.host));
+
+    BudgetImm(&e, IMM_ADD, b->length);
+    StoreWordImm(&e, OFFSET(pc), b->start);
+    Emit8(&e, 0x31); Emit8(&e, 0xC0); // xor eax, eax
+    EmitJumpTo(&e, cache->exitNative);
+
+    uint8_t* entry = e.code + e.size;
+    BudgetImm(&e, IMM_SUB, b->length);
+    Emit8(&e, 0x70 | CC_B); Emit8(&e, (uint8_t)-(JIT_BAIL_SIZE + 6)); // jb bail
+
+    for (uint8_t i=0; i<b->length; i++) CompileOp(&e, cache, b->ops[i], quirks, b->start + i*2, interpret);
+
+    // Ran into the next block, or stopped at the longest block
+    const decodedOp* last = b->ops[b->length-1];
+    if (!EndsBlock(last->op))
+    {
+        WriteBackAll(&e);
+        EmitExit(&e, cache, b->end, last - decodeTable, true);
+    }
+
+    b->native = entry;
+    b->jitState = JIT_COMPILED;
+    cache->codeUsed = (cache->codeUsed + e.size + 15) & ~15;
+    cache->jitStats.compiled++;
+}
+#endif
+
+#ifdef JIT_SUPPORTED
+// Compiled once per quirk profile like the interpreters, `interpret` is the profile's EmulateCycle instance
+// the native code calls and the slow paths inline their own copy of
+SPECIALIZED uint64_t RunJitWith(chip8* cpu, uint64_t cycles, const uint32_t quirks, void (*interpret)(chip8*))
+{
+    struct blockCache* cache = cpu->blockCache;
+    uint64_t done = 0;
+
+    while (done < cycles && !cpu->halted)
+    {
+        if (cpu->pc+1 >= BLOCK_CODE_SIZE)
+        {
+            interpret(cpu);
+            done++;
+            cache->jitStats.interpretedInstructions++;
+            if (AudioEdgeOpcode(cpu->opcode)) break;
+            continue;
+        }
+
+        // Start over with an empty cache when the code buffer could not fit another block
+        if (cache->codeUsed + JIT_MAX_BLOCK_CODE > JIT_CODE_SIZE)
+        {
+            FlushBlocks(cache);
+            cache->flushes++;
+        }
+
+        block* b = cache->blocks[cpu->pc];
+        if (b == NULL)
+        {
+            b = BuildBlock(cpu, cache, cpu->pc);
+            cache->misses++;
+        }
+        else cache->hits++;
+
+        if (b->jitState == JIT_UNTRIED && ++b->runs >= JIT_HOT_RUNS) JitCompile(cache, b, quirks, interpret);
+
+        uint64_t remaining = cycles - done;
+        if (b->jitState == JIT_COMPILED && b->length <= remaining)
+        {
+            // Runs on through every block linked to it, until one leaves for a block that isn't
+            uint64_t count = cache->enterNative(cpu, b->native, remaining);
+            done += count;
+            cache->jitStats.nativeRuns++;
+            cache->jitStats.nativeInstructions += count;
+            LinkExit(cache, cpu->pc);
+            if (AudioEdgeOpcode(cpu->opcode)) break; // Blocks end on FX18
+            continue;
+        }
+
+        // Cold, or no executable memory for it, interpret the block one instruction at a time
+        uint64_t count = (b->length < remaining) ? b->length : remaining;
+        for (uint64_t i=0; i<count && !cpu->halted; i++)
+        {
+            EmulateCycleWith(cpu, quirks);
+            done++;
+            cache->jitStats.interpretedInstructions++;
+        }
+        if (AudioEdgeOpcode(cpu->opcode)) break;
+    }
+    return done;
+}
+
+#define JIT_INSTANCE(id, quirks) static uint64_t RunJit##id(chip8* cpu, uint64_t cycles) { return RunJitWith(cpu, cycles, quirks, EmulateCycle##id); }
+PROFILE_LIST(JIT_INSTANCE)
+#else
+static void JitUnlink(block* b)
+{
+    (void)b; // There is never native code to unlink
+}
+#endif
+
+uint64_t RunJit(chip8* cpu, uint64_t cycles)
+{
+#ifndef JIT_SUPPORTED
+    return RunBlocks(cpu, cycles);
+#else
+    #define JIT_ENTRY(id, quirks) RunJit##id,
+    static uint64_t (*const instances[PROFILE_COUNT])(chip8*, uint64_t) = { PROFILE_LIST(JIT_ENTRY) };
+    return instances[PROFILE_INDEX(cpu)](cpu, cycles);
+#endif
+}
+
+// Frees a block cache along with the JIT code buffer it may own
+void FreeBlockCache(struct blockCache* cache)
+{
+#ifdef JIT_SUPPORTED
+    if (cache->code) munmap(cache->code, JIT_CODE_SIZE);
+#endif
+    free(cache);
+}
+
+void PrintJitStats(struct blockCache* cache)
+{
+    uint64_t total = cache->jitStats.nativeInstructions + cache->jitStats.interpretedInstructions;
+    printf("JIT: %lu blocks compiled, %lu exits linked, %lu native runs, %.2f%% of instructions in native code, %.2f%% of them calls to the core\n",
+        cache->jitStats.compiled, cache->jitStats.links, cache->jitStats.nativeRuns, total ? 100.0 * cache->jitStats.nativeInstructions / total : 0.0,
+        cache->jitStats.nativeInstructions ? 100.0 * cache->jitStats.calls / cache->jitStats.nativeInstructions : 0.0);
+}
@@ -0,0 +1,1124 @@
+// Lockstep engine. Runs up to LOCKSTEP_MAX_LANES copies of one machine side by side, typically the same ROM
+// with different seeds or inputs. The registers are stored per register across the lanes instead of per
+// machine, so V3 of all 32 lanes is one 32 byte row. Time is cut into slices between timer ticks and every
+// lane gets the slice's instructions as its budget. Within a slice the lanes at the lowest pc run as a group
+// for as long as they take the same path: register, memory load, skip and jump ops with AVX2 over the whole
+// row, the rest (display, stores, stack, rng) one lane at a time. Lanes that branched apart simply wait at
+// their pc until the lower ones catch up and join them, so they never leave the shared state. Code no lane
+// wrote to is fetched once for the group, a wait loop that comes round with its registers unchanged has its
+// remaining iterations taken off the budgets at once, the same skip ExecuteCycles does.
+
+#define LANE_MEMORY sizeof(((chip8*)0)->memory)
+// Room for the 4 byte fetch at the last pc, and an extra cache line so the same address in each lane maps to a
+// different L1 set instead of all 32 lanes fighting over one
+#define LANE_MEMORY_STRIDE (((LANE_MEMORY + 63) & ~(size_t)63) + 64)
+
+#define SLICE_MAX 0xFFFF // Instructions per slice at most, so the lanes' budgets fit in 16 bits
+
+#define ALL_LANES(ls) (uint32_t)((ls)->lanes == LOCKSTEP_MAX_LANES ? ~0u : (1u << (ls)->lanes) - 1)
+
+struct lockstep {
+    _Alignas(32) uint8_t V[16][LOCKSTEP_MAX_LANES]; // V[register][lane]
+    _Alignas(32) uint16_t I[LOCKSTEP_MAX_LANES];
+    _Alignas(32) uint16_t pc[LOCKSTEP_MAX_LANES];
+    _Alignas(32) uint16_t opcode[LOCKSTEP_MAX_LANES];
+    _Alignas(32) uint8_t delayTimer[LOCKSTEP_MAX_LANES];
+    _Alignas(32) uint8_t soundTimer[LOCKSTEP_MAX_LANES];
+    _Alignas(32) uint16_t keypad[LOCKSTEP_MAX_LANES];
+    _Alignas(32) uint16_t budget[LOCKSTEP_MAX_LANES]; // Instructions each lane has left in the current slice
+
+    uint16_t stack[LOCKSTEP_MAX_LANES][16];
+    uint8_t sp[LOCKSTEP_MAX_LANES];
+    uint8_t planeMask[LOCKSTEP_MAX_LANES];
+    uint64_t rngState[LOCKSTEP_MAX_LANES];
+    uint64_t ticks[LOCKSTEP_MAX_LANES];
+    uint64_t haltCycle[LOCKSTEP_MAX_LANES]; // Cycle count a lane stopped at
+    framebuffer display[LOCKSTEP_MAX_LANES]; // Shared by the lanes showing the same picture, see ExecuteDisplay
+    uint8_t screen[LOCKSTEP_MAX_LANES]; // The framebuffer each lane shows
+    uint32_t screenLanes[LOCKSTEP_MAX_LANES]; // The lanes showing each framebuffer, 0 for a free one
+    uint8_t* memory; // LANE_MEMORY_STRIDE bytes per lane, for all LOCKSTEP_MAX_LANES
+    uint64_t written; // Bit i is set once any lane wrote to bytes 64*i to 64*i+63, the rest is the same in every lane
+
+    int lanes;
+    uint32_t running; // Bit i is set while lane i hasn't halted
+    uint64_t cycles; // Where every running lane is between slices, the start of the current one during it
+    uint32_t sliceLength;
+    uint64_t timerTicks; // Shared timer ticks, the lanes only differ once they halt
+    uint32_t clockHz;
+    const profile* profile; // Shared by every lane
+    bool avx2;
+
+    // Stats, lanes per group shows how far the lanes drifted apart
+    uint64_t groups;
+    uint64_t laneSteps; // Instructions run in groups, summed over their lanes
+    uint64_t vectorGroups;
+    uint64_t idleCycles;
+};
+
+static inline uint8_t* LaneMemory(const lockstep* ls, int lane)
+{
+    return ls->memory + (size_t)lane * LANE_MEMORY_STRIDE;
+}
+
+// Memory outside the 4kB reads as 0 and ignores writes instead of running into the next lane
+static inline uint8_t LaneRead(const lockstep* ls, int lane, uint32_t address)
+{
+    return (address < LANE_MEMORY) ? LaneMemory(ls, lane)[address] : 0;
+}
+
+static inline void LaneWrite(lockstep* ls, int lane, uint32_t address, uint8_t value)
+{
+    if (address < LANE_MEMORY)
+    {
+        LaneMemory(ls, lane)[address] = value;
+        ls->written |= 1ull << (address / 64);
+    }
+}
+
+// Whether any lane may have changed the `length` bytes at `address`, true for anything running past the 4kB
+static inline bool LanesWritten(const lockstep* ls, uint32_t address, uint32_t length)
+{
+    if (address + length > LANE_MEMORY) return true;
+    uint32_t first = address / 64;
+    uint32_t last = (address + length - 1) / 64;
+    return (ls->written & (((2ull << (last - first)) - 1) << first)) != 0;
+}
+
+static void HaltLane(lockstep* ls, int lane)
+{
+    ls->running &= ~(1u << lane);
+    ls->haltCycle[lane] = ls->cycles + ls->sliceLength - ls->budget[lane] + 1; // The instruction that halted counts, like in the other cores
+}
+
+lockstep* CreateLockstep(const chip8* prototype, int lanes)
+{
+    if (lanes < 1 || lanes > LOCKSTEP_MAX_LANES)
+    {
+        printf("[ERROR]: Lockstep runs 1 to %d lanes, not %d.\n", LOCKSTEP_MAX_LANES, lanes);
+        return NULL;
+    }
+
+    lockstep* ls = aligned_alloc(64, (sizeof(lockstep) + 63) & ~(size_t)63);
+    memset(ls, 0, sizeof(lockstep));
+    // Every lane gets memory even if unused, the vector fetch always reads 32 lanes
+    ls->memory = aligned_alloc(64, LOCKSTEP_MAX_LANES * LANE_MEMORY_STRIDE);
+    memset(ls->memory, 0, LOCKSTEP_MAX_LANES * LANE_MEMORY_STRIDE);
+
+    ls->lanes = lanes;
+    ls->running = (prototype->halted) ? 0 : ALL_LANES(ls);
+    ls->cycles = prototype->cycles;
+    ls->timerTicks = prototype->ticks;
+    ls->clockHz = prototype->clockHz;
+    ls->profile = prototype->profile;
+#if defined(__x86_64__) && defined(__GNUC__)
+    ls->avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+    ls->display[0] = prototype->display;
+    ls->screenLanes[0] = ALL_LANES(ls);
+    for (int l=0; l<lanes; l++)
+    {
+        memcpy(LaneMemory(ls, l), prototype->memory, LANE_MEMORY);
+        ls->screen[l] = 0;
+        memcpy(ls->stack[l], prototype->stack, sizeof(prototype->stack));
+        for (int r=0; r<16; r++) ls->V[r][l] = prototype->V[r];
+        ls->I[l] = prototype->I;
+        ls->pc[l] = prototype->pc;
+        ls->opcode[l] = prototype->opcode;
+        ls->delayTimer[l] = prototype->delayTimer;
+        ls->soundTimer[l] = prototype->soundTimer;
+        ls->sp[l] = prototype->sp;
+        ls->planeMask[l] = prototype->planeMask;
+        ls->keypad[l] = prototype->keypad;
+        ls->rngState[l] = prototype->rngState;
+        ls->ticks[l] = prototype->ticks;
+        ls->haltCycle[l] = prototype->cycles;
+    }
+    return ls;
+}
+
+void DestroyLockstep(lockstep* ls)
+{
+    free(ls->memory);
+    free(ls);
+}
+
+void LockstepSeed(lockstep* ls, int lane, uint64_t seed)
+{
+    chip8 scratch;
+    SeedRandom(&scratch, seed);
+    ls->rngState[lane] = scratch.rngState;
+}
+
+void LockstepSetKeypad(lockstep* ls, int lane, uint16_t keys)
+{
+    ls->keypad[lane] = keys;
+}
+
+// Copies one lane out into a machine, everything but its core, block cache and stats
+void LockstepExtract(const lockstep* ls, int lane, chip8* cpu)
+{
+    memcpy(cpu->memory, LaneMemory(ls, lane), LANE_MEMORY);
+    cpu->display = ls->display[ls->screen[lane]];
+    memcpy(cpu->stack, ls->stack[lane], sizeof(cpu->stack));
+    for (int r=0; r<16; r++) cpu->V[r] = ls->V[r][lane];
+    cpu->I = ls->I[lane];
+    cpu->pc = ls->pc[lane];
+    cpu->opcode = ls->opcode[lane];
+    cpu->delayTimer = ls->delayTimer[lane];
+    cpu->soundTimer = ls->soundTimer[lane];
+    cpu->sp = ls->sp[lane];
+    cpu->planeMask = ls->planeMask[lane];
+    cpu->keypad = ls->keypad[lane];
+    cpu->rngState = ls->rngState[lane];
+    cpu->halted = !((ls->running >> lane) & 1);
+    cpu->cycles = (cpu->halted) ? ls->haltCycle[lane] : ls->cycles;
+    cpu->ticks = ls->ticks[lane];
+    cpu->clockHz = ls->clockHz;
+    cpu->profile = ls->profile;
+    cpu->dirtyRows = ~0ull;
+    cpu->drawFlag = 1;
+    cpu->dirtyPages = ~0u;
+    if (cpu->blockCache) FlushBlocks(cpu->blockCache);
+}
+
+// Lane `l`'s sprite for a draw, read in place like DrawSprite. Only a sprite running off the end of memory
+// is copied out into `padded` and padded with zeros.
+static const uint8_t* LaneSprite(const lockstep* ls, int l, uint8_t padded[16 * 2 * DISPLAY_PLANES])
+{
+    if (ls->I[l] <= LANE_MEMORY - 16 * 2 * DISPLAY_PLANES) return LaneMemory(ls, l) + ls->I[l];
+    for (int i=0; i<16 * 2 * DISPLAY_PLANES; i++) padded[i] = LaneRead(ls, l, ls->I[l] + i);
+    return padded;
+}
+
+// Whether display instruction `d` changes lane `l`'s framebuffer the same way as lane `first`'s
+static bool SameDisplayInput(const lockstep* ls, const decodedOp* d, int l, int first)
+{
+    if (d->op == OP_LORES || d->op == OP_HIRES) return true;
+    if (ls->planeMask[l] != ls->planeMask[first]) return false;
+    if (d->op != OP_DISPLAY) return true;
+    if (ls->V[d->x][l] != ls->V[d->x][first] || ls->V[d->y][l] != ls->V[d->y][first] || ls->I[l] != ls->I[first]) return false;
+
+    uint32_t length = ((d->n) ? d->n : 32) * __builtin_popcount(ls->planeMask[l]);
+    if (!LanesWritten(ls, ls->I[l], length)) return true;
+    return ls->I[l] + length <= LANE_MEMORY && !memcmp(LaneMemory(ls, l) + ls->I[l], LaneMemory(ls, first) + ls->I[l], length);
+}
+
+// Moves `lanes` onto framebuffer `screen`
+static void ShowScreen(lockstep* ls, uint32_t lanes, int screen)
+{
+    for (uint32_t m = lanes; m; m &= m - 1)
+    {
+        int l = __builtin_ctz(m);
+        ls->screenLanes[ls->screen[l]] &= ~(1u << l);
+        ls->screen[l] = screen;
+    }
+    ls->screenLanes[screen] |= lanes;
+}
+
+// A framebuffer nobody shows. Each one in use has a lane, so while some lanes share one there is a free one.
+static int FreeScreen(const lockstep* ls)
+{
+    int screen = 0;
+    while (ls->screenLanes[screen]) screen++;
+    return screen;
+}
+
+// Runs a display instruction for the lanes in `mask`. Lanes still showing the same picture that give it the
+// same input end up with the same picture again, so it runs once on the framebuffer they share. Lanes that
+// change it differently from the others showing it move to a copy first.
+static void ExecuteDisplay(lockstep* ls, const decodedOp* d, uint32_t mask)
+{
+    if (d->op == OP_DISPLAY)
+        for (uint32_t m = mask; m; m &= m - 1) ls->V[0xF][__builtin_ctz(m)] = 0; // Before reading the coordinates, like DrawSprite
+
+    while (mask)
+    {
+        int first = __builtin_ctz(mask);
+        int screen = ls->screen[first];
+        uint32_t same = 1u << first;
+        for (uint32_t m = (mask & ls->screenLanes[screen]) & (mask - 1); m; m &= m - 1)
+            if (SameDisplayInput(ls, d, __builtin_ctz(m), first)) same |= m & -m;
+        mask &= ~same;
+
+        if (ls->screenLanes[screen] != same)
+        {
+            int copy = FreeScreen(ls);
+            ls->display[copy] = ls->display[screen];
+            ShowScreen(ls, same, copy);
+            screen = copy;
+        }
+
+        framebuffer* fb = &ls->display[screen];
+        uint8_t planes = ls->planeMask[first];
+        switch (d->op)
+        {
+            case OP_CLEAR_SCREEN: DisplayClear(fb, planes); break;
+            case OP_SCROLL_DOWN: DisplayScrollVertical(fb, planes, d->n); break;
+            case OP_SCROLL_UP: DisplayScrollVertical(fb, planes, -d->n); break;
+            case OP_SCROLL_RIGHT: DisplayScrollHorizontal(fb, planes, 4); break;
+            case OP_SCROLL_LEFT: DisplayScrollHorizontal(fb, planes, -4); break;
+            case OP_LORES: DisplaySetResolution(fb, false); break;
+            case OP_HIRES: DisplaySetResolution(fb, true); break;
+            default:
+            {
+                uint8_t padded[16 * 2 * DISPLAY_PLANES]; // The most a DXY0 on every plane takes
+                uint64_t dirty = 0;
+                uint8_t collision = DisplayDraw(fb, planes, ls->V[d->x][first], ls->V[d->y][first], d->n, LaneSprite(ls, first, padded), &dirty);
+                for (uint32_t m = same; m; m &= m - 1) ls->V[0xF][__builtin_ctz(m)] = collision;
+            } break;
+        }
+    }
+}
+
+// Runs one decoded instruction on every lane in `mask`, one lane at a time except for the display ones.
+// Handles every opcode, the vector path below falls back to it for the ones it doesn't cover.
+SPECIALIZED void ExecuteGroupScalar(lockstep* ls, const decodedOp* d, uint32_t mask, const uint32_t quirks)
+{
+    switch (d->op)
+    {
+        case OP_CLEAR_SCREEN: case OP_SCROLL_DOWN: case OP_SCROLL_UP: case OP_SCROLL_RIGHT: case OP_SCROLL_LEFT:
+        case OP_LORES: case OP_HIRES: case OP_DISPLAY:
+            ExecuteDisplay(ls, d, mask);
+            return;
+    }
+
+    for (uint32_t m = mask; m; m &= m - 1)
+    {
+        int l = __builtin_ctz(m);
+        uint8_t* vx = &ls->V[d->x][l];
+        uint8_t vy = ls->V[d->y][l];
+        uint8_t* vf = &ls->V[0xF][l];
+        switch (d->op)
+        {
+            case OP_INVALID:
+                printf("[ERROR]: Invalid opcode: '%04x'\n", ls->opcode[l]);
+                HaltLane(ls, l);
+                break;
+
+            case OP_NOP: break;
+            case OP_EXIT: HaltLane(ls, l); break;
+            case OP_SELECT_PLANES: ls->planeMask[l] = d->x & ((1 << DISPLAY_PLANES) - 1); break;
+
+            case OP_RETURN_SUBROUTINE:
+                if (ls->sp[l] == 0) printf("[WARNING]: Stack is empty. Ignoring instruction.\n");
+                else ls->pc[l] = ls->stack[l][--ls->sp[l]];
+                break;
+
+            case OP_JUMP: ls->pc[l] = d->nnn; break;
+
+            case OP_CALL_SUBROUTINE:
+                if (ls->sp[l] >= 16)
+                {
+                    printf("[ERROR]: Stack overflow.\n");
+                    HaltLane(ls, l);
+                    break;
+                }
+                ls->stack[l][ls->sp[l]++] = ls->pc[l];
+                ls->pc[l] = d->nnn;
+                break;
+
+            case OP_REG_IS_VALUE: if (*vx == d->nn) ls->pc[l] += 2; break;
+            case OP_REG_IS_NOT_VALUE: if (*vx != d->nn) ls->pc[l] += 2; break;
+            case OP_REG_IS_REG: if (*vx == vy) ls->pc[l] += 2; break;
+            case OP_REG_IS_NOT_REG: if (*vx != vy) ls->pc[l] += 2; break;
+            case OP_SET_REG: *vx = d->nn; break;
+            case OP_ADD_TO_REG: *vx += d->nn; break;
+            case OP_SET: *vx = vy; break;
+
+            case OP_BINARY_OR: *vx |= vy; if (quirks & QUIRK_VF_RESET) *vf = 0; break;
+            case OP_BINARY_AND: *vx &= vy; if (quirks & QUIRK_VF_RESET) *vf = 0; break;
+            case OP_LOGICAL_XOR: *vx ^= vy; if (quirks & QUIRK_VF_RESET) *vf = 0; break;
+
+            case OP_ADD:
+            {
+                int sum = *vx + vy;
+                *vx = sum;
+                *vf = sum > 255;
+            } break;
+
+            case OP_SUBTRACT_XY:
+            {
+                uint8_t a = *vx;
+                *vx = a - vy;
+                *vf = a >= vy;
+            } break;
+
+            case OP_SUBTRACT_YX:
+            {
+                uint8_t a = *vx;
+                *vx = vy - a;
+                *vf = vy >= a;
+            } break;
+
+            case OP_SHIFT_RIGHT:
+            {
+                if (quirks & QUIRK_SHIFT_VY) *vx = vy;
+                uint8_t removedBit = *vx & 1;
+                *vx >>= 1;
+                *vf = removedBit;
+            } break;
+
+            case OP_SHIFT_LEFT:
+            {
+                if (quirks & QUIRK_SHIFT_VY) *vx = vy;
+                uint8_t removedBit = *vx >> 7;
+                *vx <<= 1;
+                *vf = removedBit;
+            } break;
+
+            case OP_SET_INDEX_REG: ls->I[l] = d->nnn; break;
+            case OP_JUMP_OFFSET: ls->pc[l] = d->nnn + ((quirks & QUIRK_JUMP_VX) ? *vx : ls->V[0][l]); break;
+            case OP_RANDOM: *vx = (XorShift(&ls->rngState[l]) % 0xFF) & d->nn; break;
+            case OP_SKIP_IF_KEY: if ((ls->keypad[l] >> (*vx & 0xF)) & 1) ls->pc[l] += 2; break;
+            case OP_SKIP_IF_NOT_KEY: if (!((ls->keypad[l] >> (*vx & 0xF)) & 1)) ls->pc[l] += 2; break;
+            case OP_GET_DELAY_TIMER: *vx = ls->delayTimer[l]; break;
+
+            case OP_AWAIT_KEY:
+                ls->pc[l] -= 2;
+                for (int i=0; i<16; i++)
+                {
+                    if ((ls->keypad[l] >> i) & 1)
+                    {
+                        *vx = i;
+                        ls->pc[l] += 2;
+                        break;
+                    }
+                }
+                break;
+
+            case OP_SET_DELAY_TIMER: ls->delayTimer[l] = *vx; break;
+            case OP_SET_SOUND_TIMER: ls->soundTimer[l] = *vx; break;
+            case OP_ADD_TO_INDEX: ls->I[l] += *vx; break;
+            case OP_FONT_CHARACTER: ls->I[l] = (*vx & 0x0F) * 5; break;
+            case OP_BIG_FONT_CHARACTER: ls->I[l] = BIG_FONT_START + (*vx & 0x0F) * 10; break;
+
+            case OP_CONVERT_DECIMAL:
+                LaneWrite(ls, l, ls->I[l], *vx / 100);
+                LaneWrite(ls, l, ls->I[l] + 1, (*vx / 10) % 10);
+                LaneWrite(ls, l, ls->I[l] + 2, *vx % 10);
+                break;
+
+            case OP_STORE_MEMORY:
+                for (int i=0; i<=d->x; i++)
+                {
+                    uint16_t memoryPos = (quirks & QUIRK_MEMORY_INCREMENT) ? ls->I[l]++ : ls->I[l]+i;
+                    LaneWrite(ls, l, memoryPos, ls->V[i][l]);
+                }
+                break;
+
+            case OP_LOAD_MEMORY:
+                for (int i=0; i<=d->x; i++)
+                {
+                    uint16_t memoryPos = (quirks & QUIRK_MEMORY_INCREMENT) ? ls->I[l]++ : ls->I[l]+i;
+                    ls->V[i][l] = LaneRead(ls, l, memoryPos);
+                }
+                break;
+        }
+    }
+}
+
+// Reads the opcode at `pc` for `lanes`, which all sit there. Code no lane wrote to is the same in every lane,
+// one read does for all of them. Otherwise only the lanes agreeing with the first one are kept, the others
+// are left for the next round. Returns the lanes kept, a pc past the end of memory fetches 0000.
+static uint32_t FetchGroup(const lockstep* ls, uint16_t pc, uint32_t lanes, uint16_t* opcode)
+{
+    if (pc + 1 >= LANE_MEMORY)
+    {
+        *opcode = 0;
+        return lanes;
+    }
+    const uint8_t* first = LaneMemory(ls, __builtin_ctz(lanes)) + pc;
+    *opcode = first[0] << 8 | first[1];
+    if (!LanesWritten(ls, pc, 2)) return lanes;
+
+    uint32_t group = 0;
+    for (uint32_t m = lanes; m; m &= m - 1)
+    {
+        int l = __builtin_ctz(m);
+        const uint8_t* code = LaneMemory(ls, l) + pc;
+        if ((code[0] << 8 | code[1]) == *opcode) group |= 1u << l;
+    }
+    return group;
+}
+
+// Whether `op` can send the lanes running it different ways, or halt or wait. Runs stop at those unless
+// FollowBranch finds every lane going the same way.
+static inline bool IsBranch(uint8_t op)
+{
+    switch (op)
+    {
+        case OP_INVALID: case OP_EXIT: case OP_RETURN_SUBROUTINE: case OP_JUMP: case OP_CALL_SUBROUTINE:
+        case OP_REG_IS_VALUE: case OP_REG_IS_NOT_VALUE: case OP_REG_IS_REG: case OP_REG_IS_NOT_REG:
+        case OP_JUMP_OFFSET: case OP_SKIP_IF_KEY: case OP_SKIP_IF_NOT_KEY: case OP_AWAIT_KEY:
+            return true;
+        default: return false;
+    }
+}
+
+static inline bool IsSkip(uint8_t op)
+{
+    return op == OP_REG_IS_VALUE || op == OP_REG_IS_NOT_VALUE || op == OP_REG_IS_REG || op == OP_REG_IS_NOT_REG
+        || op == OP_SKIP_IF_KEY || op == OP_SKIP_IF_NOT_KEY;
+}
+
+// The lanes in `lanes` that a skip instruction skips on
+static uint32_t SkipLanesScalar(const lockstep* ls, const decodedOp* d, uint32_t lanes)
+{
+    uint32_t skip = 0;
+    for (uint32_t m = lanes; m; m &= m - 1)
+    {
+        int l = __builtin_ctz(m);
+        uint8_t vx = ls->V[d->x][l];
+        uint8_t vy = ls->V[d->y][l];
+        bool key = (ls->keypad[l] >> (vx & 0xF)) & 1;
+        bool taken;
+        switch (d->op)
+        {
+            case OP_REG_IS_VALUE: taken = vx == d->nn; break;
+            case OP_REG_IS_NOT_VALUE: taken = vx != d->nn; break;
+            case OP_REG_IS_REG: taken = vx == vy; break;
+            case OP_REG_IS_NOT_REG: taken = vx != vy; break;
+            case OP_SKIP_IF_KEY: taken = key; break;
+            default: taken = !key; break;
+        }
+        if (taken) skip |= 1u << l;
+    }
+    return skip;
+}
+
+// Moves `pc`, already past the branch, to where it sends `lanes` when it sends all of them the same way.
+// `skip` has the lanes a skip skips on. Returns false, changing nothing, when the lanes split up or the
+// instruction can halt or wait, those take the one instruction at a time way.
+static bool FollowBranch(lockstep* ls, const decodedOp* d, uint32_t lanes, uint32_t skip, uint16_t* pc, const uint32_t quirks)
+{
+    int first = __builtin_ctz(lanes);
+    switch (d->op)
+    {
+        case OP_JUMP:
+            *pc = d->nnn;
+            return true;
+
+        case OP_REG_IS_VALUE: case OP_REG_IS_NOT_VALUE: case OP_REG_IS_REG: case OP_REG_IS_NOT_REG:
+        case OP_SKIP_IF_KEY: case OP_SKIP_IF_NOT_KEY:
+            if (skip != 0 && skip != lanes) return false;
+            if (skip) *pc += 2;
+            return true;
+
+        case OP_JUMP_OFFSET:
+        {
+            const uint8_t* offset = ls->V[(quirks & QUIRK_JUMP_VX) ? d->x : 0];
+            for (uint32_t m = lanes; m; m &= m - 1) if (offset[__builtin_ctz(m)] != offset[first]) return false;
+            *pc = d->nnn + offset[first];
+            return true;
+        }
+
+        case OP_CALL_SUBROUTINE:
+            for (uint32_t m = lanes; m; m &= m - 1) if (ls->sp[__builtin_ctz(m)] >= 16) return false;
+            for (uint32_t m = lanes; m; m &= m - 1)
+            {
+                int l = __builtin_ctz(m);
+                ls->stack[l][ls->sp[l]++] = *pc;
+            }
+            *pc = d->nnn;
+            return true;
+
+        case OP_RETURN_SUBROUTINE:
+        {
+            if (ls->sp[first] == 0) return false;
+            uint16_t target = ls->stack[first][ls->sp[first] - 1];
+            for (uint32_t m = lanes; m; m &= m - 1)
+            {
+                int l = __builtin_ctz(m);
+                if (ls->sp[l] == 0 || ls->stack[l][ls->sp[l] - 1] != target) return false;
+            }
+            for (uint32_t m = lanes; m; m &= m - 1) ls->sp[__builtin_ctz(m)]--;
+            *pc = target;
+            return true;
+        }
+
+        default: return false;
+    }
+}
+
+// The lanes in `lanes` where words[lane] is `value`
+static uint32_t MatchScalar(const uint16_t* words, uint32_t lanes, uint16_t value)
+{
+    uint32_t match = 0;
+    for (uint32_t m = lanes; m; m &= m - 1) if (words[__builtin_ctz(m)] == value) match |= m & -m;
+    return match;
+}
+
+// The lowest of `words` over `lanes`, and the lanes holding it
+static uint32_t LowestScalar(const uint16_t* words, uint32_t lanes, uint16_t* lowest)
+{
+    uint32_t at = 0;
+    *lowest = 0xFFFF;
+    for (uint32_t m = lanes; m; m &= m - 1)
+    {
+        int l = __builtin_ctz(m);
+        if (words[l] < *lowest) at = 0;
+        if (words[l] <= *lowest)
+        {
+            *lowest = words[l];
+            at |= 1u << l;
+        }
+    }
+    return at;
+}
+
+// The lanes in `lanes` whose registers or I differ from `V` and `I`
+static uint32_t ChangedScalar(const lockstep* ls, uint8_t V[16][LOCKSTEP_MAX_LANES], const uint16_t* I, uint32_t lanes)
+{
+    uint32_t changed = 0;
+    for (uint32_t m = lanes; m; m &= m - 1)
+    {
+        int l = __builtin_ctz(m);
+        bool same = ls->I[l] == I[l];
+        for (int r=0; r<16; r++) same &= ls->V[r][l] == V[r][l];
+        if (!same) changed |= 1u << l;
+    }
+    return changed;
+}
+
+// The same skip ExecuteCycles does. `stable` went round a wait loop of `length` instructions, none of which
+// write anything but registers and I, and came back with those unchanged. Each iteration left will do the
+// same, so whole ones come off their budgets at once. The last `ran` instructions aren't off them yet.
+static void SkipWaitLoop(lockstep* ls, uint32_t stable, uint16_t ran, uint16_t length)
+{
+    for (uint32_t m = stable; m; m &= m - 1)
+    {
+        int l = __builtin_ctz(m);
+        uint16_t left = ls->budget[l] - ran;
+        uint16_t skipped = left - left % length;
+        ls->budget[l] -= skipped;
+        ls->idleCycles += skipped;
+    }
+}
+
+// FX0A with none of its keys down leaves a lane where it was, so it waits out the slice at once. Its last
+// instruction is still to come off its budget.
+static void SkipKeyWait(lockstep* ls, uint32_t lanes)
+{
+    for (uint32_t m = lanes; m; m &= m - 1)
+    {
+        int l = __builtin_ctz(m);
+        if (ls->keypad[l]) continue;
+        ls->idleCycles += ls->budget[l] - 1;
+        ls->budget[l] = 1;
+    }
+}
+
+// Runs the lanes in `pool` until each has used up its budget or halted. Every round takes the lanes at the
+// lowest pc and runs them as a group for as long as they go the same way, so lanes that branched apart wait
+// at the point where the code joins again. The instruction that sends a group different ways, or that can
+// halt or wait, runs one at a time for the lanes agreeing on its opcode.
+SPECIALIZED void RunSliceScalar(lockstep* ls, uint32_t pool, const uint32_t quirks)
+{
+    while (pool)
+    {
+        uint16_t pc, length;
+        uint32_t group = LowestScalar(ls->pc, pool, &pc);
+        LowestScalar(ls->budget, group, &length);
+        uint32_t others = pool & ~group;
+        const uint8_t* code = LaneMemory(ls, __builtin_ctz(group));
+
+        // The group's pc stays in `pc` while it runs, its code is the same in every lane as long as no lane wrote to it.
+        // A skip that splits it up still runs, the lanes taking it are moved on afterwards. Each short jump back
+        // saves the registers, to find the lanes that come round a wait loop without changing.
+        uint16_t ran = 0, opcode = 0;
+        uint32_t skipped = 0;
+        uint16_t loopStart = 0, loopRan = 0;
+        bool waiting = false; // Only wait loop ops since the jump to loopStart
+        uint8_t savedV[16][LOCKSTEP_MAX_LANES];
+        uint16_t savedI[LOCKSTEP_MAX_LANES];
+        while (ran < length && pc + 1 < LANE_MEMORY && !LanesWritten(ls, pc, 2))
+        {
+            if (others && MatchScalar(ls->pc, others, pc)) break; // Lanes waiting here join the group
+            uint16_t next = code[pc] << 8 | code[pc+1];
+            const decodedOp* d = &decodeTable[next];
+            uint16_t after = pc + 2;
+            waiting &= IsIdleOp(d->op);
+            if (IsBranch(d->op))
+            {
+                uint32_t skip = (IsSkip(d->op)) ? SkipLanesScalar(ls, d, group) : 0;
+                if (!FollowBranch(ls, d, group, skip, &after, quirks))
+                {
+                    if (!IsSkip(d->op)) break;
+                    skipped = skip;
+                }
+                if (d->op == OP_JUMP && d->nnn <= pc && (pc - d->nnn)/2 < IDLE_MAX_LOOP)
+                {
+                    uint32_t stable = (waiting && loopStart == d->nnn) ? group & ~ChangedScalar(ls, savedV, savedI, group) : 0;
+                    if (stable)
+                    {
+                        SkipWaitLoop(ls, stable, ran + 1, ran + 1 - loopRan);
+                        LowestScalar(ls->budget, group, &length);
+                    }
+                    memcpy(savedV, ls->V, sizeof(savedV));
+                    memcpy(savedI, ls->I, sizeof(savedI));
+                    loopStart = d->nnn;
+                    loopRan = ran + 1;
+                    waiting = true;
+                }
+            }
+            else ExecuteGroupScalar(ls, d, group, quirks);
+            pc = after;
+            opcode = next;
+            ran++;
+            if (skipped) break;
+        }
+        if (ran)
+        {
+            for (uint32_t m = group; m; m &= m - 1)
+            {
+                int l = __builtin_ctz(m);
+                ls->pc[l] = (skipped >> l) & 1 ? pc + 2 : pc;
+                ls->opcode[l] = opcode;
+                if ((ls->budget[l] -= ran) == 0) pool &= ~(1u << l);
+            }
+            ls->groups += ran;
+            ls->laneSteps += (uint64_t)ran * __builtin_popcount(group);
+            continue;
+        }
+
+        group = FetchGroup(ls, pc, group, &opcode);
+        for (uint32_t m = group; m; m &= m - 1)
+        {
+            int l = __builtin_ctz(m);
+            ls->pc[l] = pc + 2;
+            ls->opcode[l] = opcode;
+        }
+        ExecuteGroupScalar(ls, &decodeTable[opcode], group, quirks);
+        if (decodeTable[opcode].op == OP_AWAIT_KEY) SkipKeyWait(ls, group);
+        for (uint32_t m = group; m; m &= m - 1)
+        {
+            int l = __builtin_ctz(m);
+            if (--ls->budget[l] == 0) pool &= ~(1u << l);
+        }
+        pool &= ls->running;
+        ls->groups++;
+        ls->laneSteps += __builtin_popcount(group);
+    }
+}
+
+#define RUN_SLICE_SCALAR_INSTANCE(id, quirks) static void RunSliceScalar##id(lockstep* ls, uint32_t pool) { RunSliceScalar(ls, pool, quirks); }
+PROFILE_LIST(RUN_SLICE_SCALAR_INSTANCE)
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+#define LOCKSTEP_AVX2 __attribute__((target("avx2")))
+
+// One byte per lane, 0xFF for the lanes in `mask`
+LOCKSTEP_AVX2 static inline __m256i ExpandMask(uint32_t mask)
+{
+    const __m256i spread = _mm256_setr_epi8(0,0,0,0,0,0,0,0, 1,1,1,1,1,1,1,1, 2,2,2,2,2,2,2,2, 3,3,3,3,3,3,3,3);
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201);
+    __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(mask), spread);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+}
+
+// Byte lanes widened to words, lanes 0-15 in `low` and 16-31 in `high`. Sign extends so masks stay masks.
+LOCKSTEP_AVX2 static inline void Widen(__m256i bytes, __m256i* low, __m256i* high, bool sign)
+{
+    __m128i a = _mm256_castsi256_si128(bytes);
+    __m128i b = _mm256_extracti128_si256(bytes, 1);
+    *low = (sign) ? _mm256_cvtepi8_epi16(a) : _mm256_cvtepu8_epi16(a);
+    *high = (sign) ? _mm256_cvtepi8_epi16(b) : _mm256_cvtepu8_epi16(b);
+}
+
+LOCKSTEP_AVX2 static inline void BlendWords(uint16_t* words, __m256i low, __m256i high, __m256i mask8)
+{
+    __m256i maskLow, maskHigh;
+    Widen(mask8, &maskLow, &maskHigh, true);
+    __m256i* out = (__m256i*)words;
+    _mm256_store_si256(out, _mm256_blendv_epi8(_mm256_load_si256(out), low, maskLow));
+    _mm256_store_si256(out + 1, _mm256_blendv_epi8(_mm256_load_si256(out + 1), high, maskHigh));
+}
+
+// pc += 2 in the lanes where `condition` is 0xFF
+LOCKSTEP_AVX2 static inline void SkipWhere(lockstep* ls, __m256i condition)
+{
+    __m256i low, high;
+    Widen(condition, &low, &high, true);
+    const __m256i two = _mm256_set1_epi16(2);
+    __m256i* pc = (__m256i*)ls->pc;
+    _mm256_store_si256(pc, _mm256_add_epi16(_mm256_load_si256(pc), _mm256_and_si256(low, two)));
+    _mm256_store_si256(pc + 1, _mm256_add_epi16(_mm256_load_si256(pc + 1), _mm256_and_si256(high, two)));
+}
+
+// 0xFF in the lanes where the key in the low nibble of `keys` is down. The keypads are split into their low
+// and high bytes, then the key picks the byte and a shuffle turns its low 3 bits into the bit to test.
+LOCKSTEP_AVX2 static inline __m256i KeyDown(const lockstep* ls, __m256i keys)
+{
+    const __m256i byteMask = _mm256_set1_epi16(0xFF);
+    const __m256i bits = _mm256_setr_epi8(1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128);
+    __m256i low = _mm256_load_si256((const __m256i*)ls->keypad);
+    __m256i high = _mm256_load_si256((const __m256i*)ls->keypad + 1);
+    __m256i lowBytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(low, byteMask), _mm256_and_si256(high, byteMask)), 0xD8);
+    __m256i highBytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(low, 8), _mm256_srli_epi16(high, 8)), 0xD8);
+
+    keys = _mm256_and_si256(keys, _mm256_set1_epi8(0x0F));
+    __m256i byte = _mm256_blendv_epi8(lowBytes, highBytes, _mm256_cmpgt_epi8(keys, _mm256_set1_epi8(7)));
+    __m256i bit = _mm256_shuffle_epi8(bits, keys);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(byte, bit), bit);
+}
+
+// Bit i is set where words[i] is `value`
+LOCKSTEP_AVX2 static inline uint32_t MatchAVX2(const uint16_t* words, uint16_t value)
+{
+    const __m256i target = _mm256_set1_epi16(value);
+    __m256i low = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i*)words), target);
+    __m256i high = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i*)words + 1), target);
+    return _mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8));
+}
+
+// SkipLanesScalar over a whole row at once
+LOCKSTEP_AVX2 static inline uint32_t SkipLanesAVX2(const lockstep* ls, const decodedOp* d, uint32_t lanes)
+{
+    __m256i vx = _mm256_load_si256((const __m256i*)ls->V[d->x]);
+    __m256i vy = _mm256_load_si256((const __m256i*)ls->V[d->y]);
+    __m256i taken;
+    switch (d->op)
+    {
+        case OP_REG_IS_VALUE: case OP_REG_IS_NOT_VALUE: taken = _mm256_cmpeq_epi8(vx, _mm256_set1_epi8(d->nn)); break;
+        case OP_REG_IS_REG: case OP_REG_IS_NOT_REG: taken = _mm256_cmpeq_epi8(vx, vy); break;
+        default: taken = KeyDown(ls, vx); break;
+    }
+    uint32_t skip = _mm256_movemask_epi8(taken);
+    if (d->op == OP_REG_IS_NOT_VALUE || d->op == OP_REG_IS_NOT_REG || d->op == OP_SKIP_IF_NOT_KEY) skip = ~skip;
+    return skip & lanes;
+}
+
+// Runs one decoded instruction on every lane in `mask` at once, returns false for the opcodes it can't vectorize
+LOCKSTEP_AVX2 SPECIALIZED bool ExecuteGroupAVX2(lockstep* ls, const decodedOp* d, uint32_t mask, const uint32_t quirks)
+{
+    #define LOAD(row) _mm256_load_si256((const __m256i*)(row))
+    #define STORE(row, value) _mm256_store_si256((__m256i*)(row), _mm256_blendv_epi8(LOAD(row), value, m8))
+
+    const __m256i m8 = ExpandMask(mask);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i vx = LOAD(ls->V[d->x]);
+    __m256i vy = LOAD(ls->V[d->y]);
+    __m256i low, high;
+
+    switch (d->op)
+    {
+        case OP_NOP: break;
+
+        case OP_JUMP:
+            BlendWords(ls->pc, _mm256_set1_epi16(d->nnn), _mm256_set1_epi16(d->nnn), m8);
+            break;
+
+        case OP_REG_IS_VALUE: case OP_REG_IS_NOT_VALUE: case OP_REG_IS_REG: case OP_REG_IS_NOT_REG:
+        case OP_SKIP_IF_KEY: case OP_SKIP_IF_NOT_KEY:
+            SkipWhere(ls, ExpandMask(SkipLanesAVX2(ls, d, mask)));
+            break;
+
+        case OP_SET_REG: STORE(ls->V[d->x], _mm256_set1_epi8(d->nn)); break;
+        case OP_ADD_TO_REG: STORE(ls->V[d->x], _mm256_add_epi8(vx, _mm256_set1_epi8(d->nn))); break;
+        case OP_SET: STORE(ls->V[d->x], vy); break;
+
+        case OP_BINARY_OR:
+            STORE(ls->V[d->x], _mm256_or_si256(vx, vy));
+            if (quirks & QUIRK_VF_RESET) STORE(ls->V[0xF], zero);
+            break;
+
+        case OP_BINARY_AND:
+            STORE(ls->V[d->x], _mm256_and_si256(vx, vy));
+            if (quirks & QUIRK_VF_RESET) STORE(ls->V[0xF], zero);
+            break;
+
+        case OP_LOGICAL_XOR:
+            STORE(ls->V[d->x], _mm256_xor_si256(vx, vy));
+            if (quirks & QUIRK_VF_RESET) STORE(ls->V[0xF], zero);
+            break;
+
+        case OP_ADD:
+        {
+            // The wrapped sum only differs from the saturated one when it carried
+            __m256i sum = _mm256_add_epi8(vx, vy);
+            __m256i carry = _mm256_andnot_si256(_mm256_cmpeq_epi8(sum, _mm256_adds_epu8(vx, vy)), one);
+            STORE(ls->V[d->x], sum);
+            STORE(ls->V[0xF], carry);
+        } break;
+
+        case OP_SUBTRACT_XY:
+            STORE(ls->V[d->x], _mm256_sub_epi8(vx, vy));
+            STORE(ls->V[0xF], _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vx), one));
+            break;
+
+        case OP_SUBTRACT_YX:
+            STORE(ls->V[d->x], _mm256_sub_epi8(vy, vx));
+            STORE(ls->V[0xF], _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vy), one));
+            break;
+
+        case OP_SHIFT_RIGHT:
+        {
+            __m256i value = (quirks & QUIRK_SHIFT_VY) ? vy : vx;
+            STORE(ls->V[d->x], _mm256_and_si256(_mm256_srli_epi16(value, 1), _mm256_set1_epi8(0x7F)));
+            STORE(ls->V[0xF], _mm256_and_si256(value, one));
+        } break;
+
+        case OP_SHIFT_LEFT:
+        {
+            __m256i value = (quirks & QUIRK_SHIFT_VY) ? vy : vx;
+            STORE(ls->V[d->x], _mm256_add_epi8(value, value));
+            STORE(ls->V[0xF], _mm256_and_si256(_mm256_srli_epi16(value, 7), one));
+        } break;
+
+        case OP_SET_INDEX_REG:
+            BlendWords(ls->I, _mm256_set1_epi16(d->nnn), _mm256_set1_epi16(d->nnn), m8);
+            break;
+
+        case OP_JUMP_OFFSET:
+        {
+            __m256i base = _mm256_set1_epi16(d->nnn);
+            Widen((quirks & QUIRK_JUMP_VX) ? vx : LOAD(ls->V[0]), &low, &high, false);
+            BlendWords(ls->pc, _mm256_add_epi16(base, low), _mm256_add_epi16(base, high), m8);
+        } break;
+
+
+        case OP_GET_DELAY_TIMER: STORE(ls->V[d->x], LOAD(ls->delayTimer)); break;
+        case OP_SET_DELAY_TIMER: STORE(ls->delayTimer, vx); break;
+        case OP_SET_SOUND_TIMER: STORE(ls->soundTimer, vx); break;
+
+        case OP_ADD_TO_INDEX:
+            Widen(vx, &low, &high, false);
+            BlendWords(ls->I, _mm256_add_epi16(LOAD(ls->I), low), _mm256_add_epi16(LOAD(ls->I + 16), high), m8);
+            break;
+
+        case OP_FONT_CHARACTER:
+        {
+            const __m256i five = _mm256_set1_epi16(5);
+            Widen(_mm256_and_si256(vx, _mm256_set1_epi8(0x0F)), &low, &high, false);
+            BlendWords(ls->I, _mm256_mullo_epi16(low, five), _mm256_mullo_epi16(high, five), m8);
+        } break;
+
+        case OP_LOAD_MEMORY:
+        {
+            // Lanes pointing at the same bytes, which no lane wrote to, all load the same values
+            const int first = __builtin_ctz(mask);
+            const uint16_t index = ls->I[first];
+            if ((MatchAVX2(ls->I, index) & mask) != mask || LanesWritten(ls, index, d->x + 1)) return false;
+            const uint8_t* memory = LaneMemory(ls, first) + index;
+            for (int i=0; i<=d->x; i++) STORE(ls->V[i], _mm256_set1_epi8(memory[i]));
+            __m256i after = _mm256_set1_epi16(index + d->x + 1);
+            if (quirks & QUIRK_MEMORY_INCREMENT) BlendWords(ls->I, after, after, m8);
+        } break;
+
+        default: return false;
+    }
+    return true;
+
+    #undef LOAD
+    #undef STORE
+}
+
+// ChangedScalar over whole rows
+LOCKSTEP_AVX2 static inline uint32_t ChangedAVX2(const lockstep* ls, uint8_t V[16][LOCKSTEP_MAX_LANES], const uint16_t* I)
+{
+    __m256i same = _mm256_set1_epi8(-1);
+    for (int r=0; r<16; r++)
+        same = _mm256_and_si256(same, _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*)ls->V[r]), _mm256_load_si256((const __m256i*)V[r])));
+    __m256i low = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i*)ls->I), _mm256_load_si256((const __m256i*)I));
+    __m256i high = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i*)ls->I + 1), _mm256_load_si256((const __m256i*)I + 1));
+    same = _mm256_and_si256(same, _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8));
+    return ~(uint32_t)_mm256_movemask_epi8(same);
+}
+
+// The lowest of `words` over `lanes`, and the lanes holding it. The other lanes are read as 0xFFFF.
+LOCKSTEP_AVX2 static uint32_t LowestAVX2(const uint16_t* words, uint32_t lanes, uint16_t* lowest)
+{
+    const __m256i none = _mm256_set1_epi16(-1);
+    __m256i inLow, inHigh;
+    Widen(ExpandMask(lanes), &inLow, &inHigh, true);
+    __m256i low = _mm256_or_si256(_mm256_load_si256((const __m256i*)words), _mm256_andnot_si256(inLow, none));
+    __m256i high = _mm256_or_si256(_mm256_load_si256((const __m256i*)words + 1), _mm256_andnot_si256(inHigh, none));
+    __m256i both = _mm256_min_epu16(low, high);
+    __m128i half = _mm_min_epu16(_mm256_castsi256_si128(both), _mm256_extracti128_si256(both, 1));
+    *lowest = _mm_extract_epi16(_mm_minpos_epu16(half), 0);
+    return MatchAVX2(words, *lowest) & lanes;
+}
+
+LOCKSTEP_AVX2 SPECIALIZED void RunSliceAVX2(lockstep* ls, uint32_t pool, const uint32_t quirks)
+{
+    while (pool)
+    {
+        uint16_t pc, length;
+        uint32_t group = LowestAVX2(ls->pc, pool, &pc);
+        LowestAVX2(ls->budget, group, &length);
+        uint32_t others = pool & ~group;
+        const bool vector = (group & (group - 1)) != 0; // A lone lane is cheaper scalar
+        const uint8_t* code = LaneMemory(ls, __builtin_ctz(group));
+
+        // The group's pc stays in `pc` while it runs, see RunSliceScalar
+        uint16_t ran = 0, opcode = 0;
+        uint32_t skipped = 0;
+        uint16_t loopStart = 0, loopRan = 0;
+        bool waiting = false;
+        _Alignas(32) uint8_t savedV[16][LOCKSTEP_MAX_LANES];
+        _Alignas(32) uint16_t savedI[LOCKSTEP_MAX_LANES];
+        while (ran < length && pc + 1 < LANE_MEMORY && !LanesWritten(ls, pc, 2))
+        {
+            if (others && (MatchAVX2(ls->pc, pc) & others)) break; // Lanes waiting here join the group
+            uint16_t next = code[pc] << 8 | code[pc+1];
+            const decodedOp* d = &decodeTable[next];
+            uint16_t after = pc + 2;
+            waiting &= IsIdleOp(d->op);
+            if (IsBranch(d->op))
+            {
+                uint32_t skip = 0;
+                if (IsSkip(d->op)) skip = (vector) ? SkipLanesAVX2(ls, d, group) : SkipLanesScalar(ls, d, group);
+                if (!FollowBranch(ls, d, group, skip, &after, quirks))
+                {
+                    if (!IsSkip(d->op)) break;
+                    skipped = skip;
+                }
+                if (d->op == OP_JUMP && d->nnn <= pc && (pc - d->nnn)/2 < IDLE_MAX_LOOP)
+                {
+                    uint32_t stable = (waiting && loopStart == d->nnn) ? group & ~ChangedAVX2(ls, savedV, savedI) : 0;
+                    if (stable)
+                    {
+                        SkipWaitLoop(ls, stable, ran + 1, ran + 1 - loopRan);
+                        LowestAVX2(ls->budget, group, &length);
+                    }
+                    memcpy(savedV, ls->V, sizeof(savedV));
+                    memcpy(savedI, ls->I, sizeof(savedI));
+                    loopStart = d->nnn;
+                    loopRan = ran + 1;
+                    waiting = true;
+                }
+            }
+            else if (vector && ExecuteGroupAVX2(ls, d, group, quirks)) ls->vectorGroups++;
+            else ExecuteGroupScalar(ls, d, group, quirks);
+            pc = after;
+            opcode = next;
+            ran++;
+            if (skipped) break;
+        }
+        if (ran)
+        {
+            __m256i mask = ExpandMask(group);
+            __m256i at = _mm256_set1_epi16(pc);
+            __m256i last = _mm256_set1_epi16(opcode);
+            BlendWords(ls->pc, at, at, mask);
+            if (skipped) SkipWhere(ls, ExpandMask(skipped));
+            BlendWords(ls->opcode, last, last, mask);
+            __m256i low, high;
+            Widen(mask, &low, &high, true);
+            __m256i used = _mm256_set1_epi16(ran);
+            __m256i* budget = (__m256i*)ls->budget;
+            _mm256_store_si256(budget, _mm256_sub_epi16(_mm256_load_si256(budget), _mm256_and_si256(low, used)));
+            _mm256_store_si256(budget + 1, _mm256_sub_epi16(_mm256_load_si256(budget + 1), _mm256_and_si256(high, used)));
+            pool &= ~MatchAVX2(ls->budget, 0);
+            ls->groups += ran;
+            ls->laneSteps += (uint64_t)ran * __builtin_popcount(group);
+            continue;
+        }
+
+        group = FetchGroup(ls, pc, group, &opcode);
+        const decodedOp* d = &decodeTable[opcode];
+        if (group & (group - 1))
+        {
+            __m256i mask = ExpandMask(group);
+            __m256i next = _mm256_set1_epi16(pc + 2);
+            __m256i fetched = _mm256_set1_epi16(opcode);
+            BlendWords(ls->pc, next, next, mask);
+            BlendWords(ls->opcode, fetched, fetched, mask);
+            if (ExecuteGroupAVX2(ls, d, group, quirks)) ls->vectorGroups++;
+            else ExecuteGroupScalar(ls, d, group, quirks);
+            if (d->op == OP_AWAIT_KEY) SkipKeyWait(ls, group);
+
+            // The widened mask is -1 in the group's lanes, adding it takes one off their budgets
+            __m256i low, high;
+            Widen(mask, &low, &high, true);
+            __m256i* budget = (__m256i*)ls->budget;
+            _mm256_store_si256(budget, _mm256_add_epi16(_mm256_load_si256(budget), low));
+            _mm256_store_si256(budget + 1, _mm256_add_epi16(_mm256_load_si256(budget + 1), high));
+            pool &= ~MatchAVX2(ls->budget, 0);
+        }
+        else
+        {
+            int l = __builtin_ctz(group);
+            ls->pc[l] = pc + 2;
+            ls->opcode[l] = opcode;
+            ExecuteGroupScalar(ls, d, group, quirks);
+            if (d->op == OP_AWAIT_KEY) SkipKeyWait(ls, group);
+            if (--ls->budget[l] == 0) pool &= ~group;
+        }
+        pool &= ls->running;
+        ls->groups++;
+        ls->laneSteps += __builtin_popcount(group);
+    }
+}
+
+#define RUN_SLICE_AVX2_INSTANCE(id, quirks) LOCKSTEP_AVX2 static void RunSliceAVX2##id(lockstep* ls, uint32_t pool) { RunSliceAVX2(ls, pool, quirks); }
+PROFILE_LIST(RUN_SLICE_AVX2_INSTANCE)
+#endif
+
+static uint64_t LockstepNextTick(const lockstep* ls)
+{
+    return (ls->timerTicks + 1) * ls->clockHz / TIMER_HZ;
+}
+
+// A halted lane still gets the ticks that were due by the cycle it stopped at, like ExecuteCycles gives it
+static void TickLanes(lockstep* ls)
+{
+    uint64_t due = LockstepNextTick(ls);
+    for (int l=0; l<ls->lanes; l++)
+    {
+        if (!((ls->running >> l) & 1) && ls->haltCycle[l] < due) continue;
+        if (ls->delayTimer[l] > 0) ls->delayTimer[l]--;
+        if (ls->soundTimer[l] > 0) ls->soundTimer[l]--;
+        ls->ticks[l]++;
+    }
+    ls->timerTicks++;
+}
+
+// Runs `cycles` instructions on every lane that hasn't halted, returns the instructions run over all lanes
+uint64_t LockstepExecute(lockstep* ls, uint64_t cycles)
+{
+    #define RUN_SLICE_SCALAR_ENTRY(id, quirks) RunSliceScalar##id,
+    static void (*const scalarRuns[PROFILE_COUNT])(lockstep*, uint32_t) = { PROFILE_LIST(RUN_SLICE_SCALAR_ENTRY) };
+    void (*run)(lockstep*, uint32_t) = scalarRuns[ls->profile - profiles];
+#ifdef LOCKSTEP_AVX2
+    #define RUN_SLICE_AVX2_ENTRY(id, quirks) RunSliceAVX2##id,
+    static void (*const avx2Runs[PROFILE_COUNT])(lockstep*, uint32_t) = { PROFILE_LIST(RUN_SLICE_AVX2_ENTRY) };
+    if (ls->avx2) run = avx2Runs[ls->profile - profiles];
+#endif
+
+    uint64_t done = 0;
+    uint64_t end = ls->cycles + cycles;
+    while (ls->cycles < end && ls->running)
+    {
+        while (ls->cycles >= LockstepNextTick(ls)) TickLanes(ls);
+
+        // Between two ticks the lanes don't depend on each other, each one gets the whole slice as its budget
+        uint64_t stop = LockstepNextTick(ls);
+        if (stop > end) stop = end;
+        if (stop - ls->cycles > SLICE_MAX) stop = ls->cycles + SLICE_MAX;
+        ls->sliceLength = stop - ls->cycles;
+        uint32_t lanes = ls->running;
+        for (uint32_t m = lanes; m; m &= m - 1) ls->budget[__builtin_ctz(m)] = ls->sliceLength;
+
+        uint32_t pool = 0;
+        for (uint32_t m = lanes; m; m &= m - 1) if (ls->budget[__builtin_ctz(m)]) pool |= m & -m;
+        run(ls, pool);
+        for (uint32_t m = lanes; m; m &= m - 1) done += ls->sliceLength - ls->budget[__builtin_ctz(m)];
+        ls->cycles = stop;
+    }
+    while (ls->cycles >= LockstepNextTick(ls)) TickLanes(ls);
+    return done;
+}
+
+void PrintLockstepStats(const lockstep* ls)
+{
+    int screens = 0;
+    for (int i=0; i<LOCKSTEP_MAX_LANES; i++) screens += ls->screenLanes[i] != 0;
+    printf("Lockstep: %d lanes (%s), %d running, %d different screens, %lu opcode groups of %.2f lanes on average, %.1f%% of them vectorized, %lu instructions skipped in wait loops\n",
+        ls->lanes, (ls->avx2) ? "AVX2" : "scalar", __builtin_popcount(ls->running), screens, ls->groups,
+        ls->groups ? (double)ls->laneSteps / ls->groups : 0.0, ls->groups ? 100.0 * ls->vectorGroups / ls->groups : 0.0, ls->idleCycles);
+}
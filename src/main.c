@@ -1,93 +1,92 @@
+// SDL frontend over the core library: owns the window, the keyboard and the host clock. The machine runs on
+// the main thread, frames are presented on a render thread (render.c), which scales and filters them into
+// the texture at the window's size (filters.c), and the buzzer on SDL's audio thread (audio.c). --software
+// uses SDL's software renderer, which together with SDL_VIDEODRIVER=dummy and SDL_AUDIODRIVER=dummy or disk
+// runs on a machine without a GPU, a display or a sound card.
 #include <SDL.h>
-#include <stdio.h>
-#include <stdint.h>
-#include <string.h>
 #include <time.h>
-#include <stdlib.h>
 #include <math.h>
 
-typedef uint8_t bool;
-#define false 0
-#define true 1
+#include "chip8.h"
 
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
 #define SCALE 16
 
-#define COLOR_ON 0x77FF33
-#define COLOR_OFF 0x223500
+#include "filters.c"
 
 struct {
-    SDL_Texture* texture;
+    SDL_Texture* texture; // The texture and renderer are only used on the render thread
     SDL_Window* window;
     SDL_Renderer* renderer;
-    
-    uint32_t SDL_display[SCREEN_WIDTH * SCREEN_HEIGHT];
+    SDL_AudioDeviceID audio; // 0 when there is no sound
 
+    int width; // Of the window and the texture
+    int height;
+    displayFilter* filter; // Renders frames into the texture, see filters.c
+    bool shownValid; // False until the whole texture has been rendered once
+
+    // Stats, kept by the render thread
+    uint64_t framesPresented;
+    uint64_t framesSkipped;
+    uint64_t rowsUploaded;
 } SDL_state;
 
 #include "window.c"
 
-typedef struct {
-    uint16_t opcode;
-
-    uint8_t memory[4090]; // 4kB ram
-    uint8_t display[SCREEN_WIDTH][SCREEN_HEIGHT]; // 1-bit screen
-   
-    // Registers
-    uint8_t V[16]; // General purpose registers VF is also carry flag
-    uint16_t I; // Index register
-    uint16_t pc; // Program counter
-    //uint8_t VF; // Carry flag
-
-    uint16_t stack[16]; // We love the stack
-    uint8_t sp; // Stack pointer
-
-    char* keys; // Input (would be an array of 16 but a pointer works better with SDL)
+// Renders the rows of a frame whose filtered output changed into the texture and presents, skips presenting if none did.
+// `rows` are the ones the machine changed since the last frame shown.
+void UpdateWindowDisplay(const framebuffer* frame, uint64_t rows, bool exposed)
+{
+    // The filter compares its output rows, which also catches rows that were drawn to and still ended up the same
+    uint64_t dirty = FilterFrame(SDL_state.filter, frame, rows);
+    if (!SDL_state.shownValid) dirty = ~0ull >> (64 - SCREEN_HEIGHT);
 
-    uint8_t delayTimer;
-    uint8_t soundTimer;
+    if (dirty == 0 && !exposed)
+    {
+        SDL_state.framesSkipped++;
+        return;
+    }
 
-    uint8_t halted;
+    // Each run of consecutive dirty rows is rendered straight into the locked texture
+    int y = 0;
+    while (y < SCREEN_HEIGHT)
+    {
+        if (!((dirty >> y) & 1)) { y++; continue; }
 
-    uint8_t drawFlag;
-} chip8;
+        int first = y;
+        while (y < SCREEN_HEIGHT && ((dirty >> y) & 1)) y++;
 
-void UpdateWindowDisplay(chip8* cpu)
-{
-    // Blit to SDL display
-    for (int x=0; x<SCREEN_WIDTH; x++)
-    {
-        for (int y=0; y<SCREEN_HEIGHT; y++)
+        int outFirst, outLast;
+        FilterRows(SDL_state.filter, first, y, &outFirst, &outLast);
+        SDL_Rect rect = { 0, outFirst, SDL_state.width, outLast - outFirst };
+        void* pixels;
+        int pitch;
+        if (SDL_LockTexture(SDL_state.texture, &rect, &pixels, &pitch) != 0)
         {
-            uint32_t color = (cpu->display[x][y]) ? COLOR_ON : COLOR_OFF;
-            SDL_state.SDL_display[y*SCREEN_WIDTH+x] = color;
+            printf("[WARNING]: Could not lock texture! SDL_Error: %s\n", SDL_GetError());
+            return;
         }
+        FilterRender(SDL_state.filter, pixels, pitch, outFirst, outLast);
+        SDL_UnlockTexture(SDL_state.texture);
+
+        SDL_state.rowsUploaded += y - first;
     }
+    SDL_state.shownValid = true;
+
     // Present display
-    SDL_UpdateTexture(SDL_state.texture, NULL, SDL_state.SDL_display, SCREEN_WIDTH * 4);
     SDL_RenderCopy(SDL_state.renderer, SDL_state.texture, NULL, NULL);
     SDL_RenderPresent(SDL_state.renderer);
+    SDL_state.framesPresented++;
 }
 
-uint8_t fontSet[80] = {
-  0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-  0x20, 0x60, 0x20, 0x20, 0x70, // 1
-  0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-  0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-  0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-  0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-  0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-  0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-  0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-  0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-  0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-  0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-  0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-  0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-  0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-  0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
+#include "render.c"
+
+// After the render thread stopped
+void PrintDisplayStats()
+{
+    printf("Display: %lu frames published, %lu dropped for a newer one, %lu presented, %lu skipped as unchanged, %.2f rows rendered per presented frame\n",
+        renderState.framesPublished, renderState.framesDropped, SDL_state.framesPresented, SDL_state.framesSkipped,
+        SDL_state.framesPresented ? (double)SDL_state.rowsUploaded / SDL_state.framesPresented : 0.0);
+}
 
 // Keys
 SDL_Scancode SDL_inputs[16] = {
@@ -97,543 +96,284 @@ SDL_Scancode SDL_inputs[16] = {
     SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V,
 };
 
-chip8 InitProgram(char* path)
+// Keypad state as a bitmask, from SDL's keyboard array
+uint16_t ReadKeypad(const Uint8* keyboard)
 {
-    chip8 cpu = { 0 };
-
-    srand(time(NULL)); // Initialize rng
-
-    // Load font
-    for (int i=0; i<80; i++)
+    uint16_t mask = 0;
+    for (int i=0; i<16; i++)
     {
-        cpu.memory[i] = fontSet[i];
+        if (keyboard[SDL_inputs[i]]) mask |= 1 << i;
     }
-
-    cpu.pc = 0x200; // Program starts at 200
-
-    // Load ROM
-    FILE* romFile = fopen(path, "rb"); // Read in binary mode
-    if (romFile == NULL)
-    {
-        printf("Failed to open file: '%s'\n", path);
-        exit(-1);
-    }
-
-    // Get ROM size
-    fseek(romFile, 0, SEEK_END);
-    uint64_t fileSize = ftell(romFile);
-    rewind(romFile);
-
-    printf("Read %lu bytes from %s\n", fileSize, path);
-
-    uint8_t* buffer = malloc(fileSize+1 * sizeof(uint8_t));
-    fread(buffer, fileSize, 1, romFile);
-
-    fclose(romFile);
-
-    for (int i=0; i<fileSize; i++)
-    {
-        cpu.memory[0x200 + i] = buffer[i]; // Remember program starts at 0x200 (512)
-    }
-
-    return cpu;
+    return mask;
 }
 
-// Opcode types
-#define OPCODE_NO_ARGS 0x0000 // Opcodes with no arguments
-    #define OPCODE_CLEAR_SCREEN 0x00E0 // Clear the screen
-
-#define OPCODE_RETURN_SUBROUTINE 0x00EE // Returns from subroutine/function
-#define OPCODE_JUMP 0x1000 // Jumps to position
-#define OPCODE_CALL_SUBROUTINE 0x2000 // Calls subroutine/function
-
-#define OPCODE_REG_IS_VALUE 0x3000 // If register is equal to value
-#define OPCODE_REG_IS_NOT_VALUE 0x4000 // If register is not equal to value
-#define OPCODE_REG_IS_REG 0x5000 // If register is equal to other register
-#define OPCODE_REG_IS_NOT_REG 0x9000 // If register is not equal to other registers
-
-#define OPCODE_SET_REG 0x6000 // Set register to value
-#define OPCODE_ADD_TO_REG 0x7000 // Add value to register
-#define OPCODE_SET_INDEX_REG 0xA000 // Set index register
-#define OPCODE_JUMP_OFFSET 0xB000 // Jumps with the offset of V0 (COSMAC VIP implementation)
-#define OPCODE_RANDOM 0xC000 // Sets VX to a random number binary ANDed with NN
-#define OPCODE_DISPLAY 0xD000 // Draw sprite
-
-#define OPCODE_ARITHMETIC 0x8000 // Various logic and arithmetic opcodes 
-    #define OPCODE_SET 0x0 // VX is set to the value of VY
-    #define OPCODE_BINARY_OR 0x1 // VX is set to the binary OR of VX and VY
-    #define OPCODE_BINARY_AND 0x2 // VX is set to the binary AND of VX and VY
-    #define OPCODE_LOGICAL_XOR 0x3 // VX is set to the XOR of VX and VY
-    #define OPCODE_ADD 0x4 // VX is set to VX + VY
-    #define OPCODE_SUBTRACT_XY 0x5 // VX is set to VX - VY
-    #define OPCODE_SUBTRACT_YX 0x7 // VX is set to VY - VX
-    #define OPCODE_SHIFT_RIGHT 0x6 // Sets VX to VY and shifts VX to the right (We are using the COSMAC VIP implementation for now)
-    #define OPCODE_SHIFT_LEFT 0xE // Like OPCODE_SHIFT_RIGHT but we shift left
-
-#define OPCODE_KEY_SKIP 0xE000
-    #define OPCODE_SKIP_IF_KEY 0x9E
-    #define OPCODE_SKIP_IF_NOT_KEY 0xA1
-
-#define OPCODE_F 0xF000 // Group of misc opcodes
-    #define OPCODE_STORE_MEMORY 0x55 // Stores registers to memory
-    #define OPCODE_LOAD_MEMORY 0x65 // Loads registers from memory
-    #define OPCODE_CONVERT_DECIMAL 0x33 // Finds the 3 decimal digits of VX and stores it in memory
-    #define OPCODE_ADD_TO_INDEX 0x1E // Adds VX to index
-    #define OPCODE_GET_DELAY_TIMER 0x07 // Sets VX to current value of delay delayTimer
-    #define OPCODE_SET_DELAY_TIMER 0x15 // Sets delayTimer to VX
-    #define OPCODE_SET_SOUND_TIMER 0x18 // Sets soundTimer to VX
-    #define OPCODE_AWAIT_KEY 0x0A // Traps program in loop until key pressed
-    #define OPCODE_FONT_CHARACTER 0x29 // Sets I to specified character
-
-#define OPCODE_X(opcode) ((opcode & 0x0F00) >> 8)
-#define OPCODE_Y(opcode) ((opcode & 0x00F0) >> 4)
-#define OPCODE_NNN(opcode) (opcode & 0x0FFF)
-#define OPCODE_NN(opcode) (opcode & 0x00FF)
-#define OPCODE_N(opcode) (opcode & 0x000F)
-
-// Quirks
-const bool vfReset = false; // Reset VF when running AND, OR and XOR opcodes
-const bool memoryIncr = false; // Increments I when writing or loading memory
-const bool shiftSwap = false; // Uses Y when doing a bitshift
-const bool jumpX = false; // When jumping with offset use XNN instead of NNN
-
-// We do both at the same time because it is simpler, atleast for the CHIP-8
-void DecodeAndExecute(chip8* cpu)
+int main( int argc, char* args[] )
 {
-    switch (cpu->opcode & 0xF000)
+    // Error handling yippe :D
+    char* romPath = NULL;
+    char* tracePath = NULL;
+    char* hotspotPath = NULL;
+    char* loadPath = NULL;
+    char* recordPath = NULL;
+    uint64_t seed = time(NULL);
+    char* coreName = "switch";
+    char* profileName = NULL; // Detected from the ROM when not given
+    uint32_t clockHz = CLOCK_HZ;
+    bool turbo = false;
+    bool software = false;
+    int scale = SCALE;
+    char* filterNames = "none";
+    int audioBuffer = 512;
+    bool mute = false;
+    const char* capturePaths[CAPTURE_MAX_FILES];
+    int captureCount = 0;
+    bool captureDrop = false;
+    for (int i=1; i<argc; i++)
     {
-        case 0x0000: // 0NNN 
-            switch (cpu->opcode)
-            {
-                case OPCODE_CLEAR_SCREEN:
-                {
-                    printf("Clear screen\n");
-                    // We clear the screen this way because it is a 2D array
-                    for (int x=0; x<SCREEN_WIDTH; x++) { memset(cpu->display[x], 0, SCREEN_HEIGHT); }
-                } break;
-
-                case OPCODE_RETURN_SUBROUTINE:
-                {
-                    printf("RETURN\n");
-                    if (cpu->sp == 0)
-                    {
-                        printf("[WARNING]: Stack is empty. Ignoring instruction.\n");
-                        break;
-                    }
-                    cpu->sp--;
-                    cpu->pc = cpu->stack[cpu->sp];
-                } break;
-
-                default:
-                {
-                    printf("[ERROR]: Invalid opcode: '%04x'\n", cpu->opcode);
-                    cpu->halted = 1;
-                } break;
-            } break;
-
-        case OPCODE_ARITHMETIC:
-        {
-            switch (OPCODE_N(cpu->opcode))
-            {
-                case OPCODE_SET:
-                {
-                    printf("SETREG %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    cpu->V[OPCODE_X(cpu->opcode)] = cpu->V[OPCODE_Y(cpu->opcode)];
-                } break;
-
-                case OPCODE_BINARY_OR:
-                {
-                    printf("OR %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    cpu->V[OPCODE_X(cpu->opcode)] |= cpu->V[OPCODE_Y(cpu->opcode)];
-                    if (vfReset) cpu->V[0xF] = 0;
-                } break;
-
-                case OPCODE_BINARY_AND:
-                {
-                    printf("AND %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    cpu->V[OPCODE_X(cpu->opcode)] &= cpu->V[OPCODE_Y(cpu->opcode)];
-                    if (vfReset) cpu->V[0xF] = 0;
-                } break;
-
-                case OPCODE_LOGICAL_XOR:
-                {
-                    printf("XOR %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    cpu->V[OPCODE_X(cpu->opcode)] ^= cpu->V[OPCODE_Y(cpu->opcode)];
-                    if (vfReset) cpu->V[0xF] = 0;
-                } break;
-
-                case OPCODE_ADD:
-                {
-                    printf("REGADDREG %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    int vX = cpu->V[OPCODE_X(cpu->opcode)];
-                    int vY = cpu->V[OPCODE_Y(cpu->opcode)];
-
-                    cpu->V[OPCODE_X(cpu->opcode)] += cpu->V[OPCODE_Y(cpu->opcode)];
-
-                    cpu->V[0xF] = (vX + vY > 255) ? 1 : 0; // Check for overflow
-
-                } break;
-
-                case OPCODE_SUBTRACT_XY:
-                {
-                    printf("SUBXY %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    uint8_t vX = cpu->V[OPCODE_X(cpu->opcode)];
-                    uint8_t vY = cpu->V[OPCODE_Y(cpu->opcode)];
-
-                    cpu->V[OPCODE_X(cpu->opcode)] = vX - vY;
-
-                    cpu->V[0xF] = (vY > vX) ? 0 : 1;
-
-                } break;
-
-                case OPCODE_SUBTRACT_YX:
-                {
-                    printf("SUBYX %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    uint8_t vX = cpu->V[OPCODE_X(cpu->opcode)];
-                    uint8_t vY = cpu->V[OPCODE_Y(cpu->opcode)];
-
-                    cpu->V[OPCODE_X(cpu->opcode)] = vY - vX;
-
-                    cpu->V[0xF] = (vX > vY) ? 0 : 1;
-
-                } break;
-
-                case OPCODE_SHIFT_RIGHT:
-                {
-                    printf("SHIFTR %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    if (shiftSwap) cpu->V[OPCODE_X(cpu->opcode)] = cpu->V[OPCODE_Y(cpu->opcode)];
-                    uint8_t removedBit = cpu->V[OPCODE_X(cpu->opcode)] & 0b00000001;
-
-                    cpu->V[OPCODE_X(cpu->opcode)] >>= 1;
-
-                    cpu->V[0xF] = removedBit; 
- 
-                } break;
-
-                case OPCODE_SHIFT_LEFT:
-                {
-                    printf("SHIFTL %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                    if (shiftSwap) cpu->V[OPCODE_X(cpu->opcode)] = cpu->V[OPCODE_Y(cpu->opcode)];
-                    uint8_t removedBit = (cpu->V[OPCODE_X(cpu->opcode)] & 0b10000000) >> 7;
-
-                    cpu->V[OPCODE_X(cpu->opcode)] <<= 1;
-
-                    cpu->V[0xF] = removedBit; 
-                } break;
-
-                default:
-                {
-                    printf("[ERROR]: Invalid opcode: '%04x'\n", cpu->opcode);
-                    cpu->halted = 1;
-                } break;
-
-            } break;
-        } break;
-
-        case OPCODE_JUMP:
-            {
-                printf("JUMP %03x\n", OPCODE_NNN(cpu->opcode));
-                cpu->pc = OPCODE_NNN(cpu->opcode); // Jump to target
-            } break;
-
-        case OPCODE_RANDOM:
-            {
-                printf("RNG %x %02x\n", OPCODE_X(cpu->opcode), OPCODE_NN(cpu->opcode));
-                cpu->V[OPCODE_X(cpu->opcode)] = (rand() % 0xFF) & OPCODE_NN(cpu->opcode);
-            } break;
-
-        case OPCODE_CALL_SUBROUTINE:
-        {
-            printf("SUBROUTINE CALL %03x\n", OPCODE_NNN(cpu->opcode));
-            uint16_t prevPos = cpu->pc; // Store previous pc position
-
-            // Push previous position to stack
-            if (cpu->sp >=16) // Not if there is no space
-            {
-                printf("[ERROR]: Stack overflow.\n");
-                cpu->halted = 1;
-                break;
-            }
-            cpu->stack[cpu->sp] = prevPos;
-            cpu->sp++;
-
-            cpu->pc = OPCODE_NNN(cpu->opcode); // Jump 2.0
-        } break;
-
-        case OPCODE_REG_IS_VALUE:
+        if (!strcmp(args[i], "--trace") && i+1 < argc) tracePath = args[++i];
+        else if (!strcmp(args[i], "--hotspots") && i+1 < argc) hotspotPath = args[++i];
+        else if (!strcmp(args[i], "--core") && i+1 < argc) coreName = args[++i];
+        else if (!strcmp(args[i], "--profile") && i+1 < argc) profileName = args[++i];
+        else if (!strcmp(args[i], "--ips") && i+1 < argc) clockHz = strtoul(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--turbo")) turbo = true;
+        else if (!strcmp(args[i], "--software")) software = true;
+        else if (!strcmp(args[i], "--scale") && i+1 < argc) scale = atoi(args[++i]);
+        else if (!strcmp(args[i], "--filter") && i+1 < argc) filterNames = args[++i];
+        else if (!strcmp(args[i], "--audio-buffer") && i+1 < argc) audioBuffer = atoi(args[++i]);
+        else if (!strcmp(args[i], "--mute")) mute = true;
+        else if (!strcmp(args[i], "--capture") && i+1 < argc)
         {
-            printf("REGISVAL %x %02x\n", OPCODE_X(cpu->opcode), OPCODE_NN(cpu->opcode));
-            if (cpu->V[OPCODE_X(cpu->opcode)] == OPCODE_NN(cpu->opcode)) cpu->pc+=2;
-        } break;
-
-        case OPCODE_REG_IS_NOT_VALUE:
-            {
-                printf("REGNOTVAL %x %02x\n", OPCODE_X(cpu->opcode), OPCODE_NN(cpu->opcode));
-                if (cpu->V[OPCODE_X(cpu->opcode)] != OPCODE_NN(cpu->opcode)) cpu->pc+=2;
-            } break;
-
-        case OPCODE_REG_IS_REG:
-            {
-                printf("REGISREG %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                if (cpu->V[OPCODE_X(cpu->opcode)] == cpu->V[OPCODE_Y(cpu->opcode)]) cpu->pc+=2;
-            } break;
-
-        case OPCODE_REG_IS_NOT_REG:
-            {
-                printf("REGNOTREG %x %x\n", OPCODE_X(cpu->opcode), OPCODE_Y(cpu->opcode));
-                if (cpu->V[OPCODE_X(cpu->opcode)] != cpu->V[OPCODE_Y(cpu->opcode)]) cpu->pc+=2;
-            } break;
-
-        case OPCODE_SET_REG:
-            {
-                printf("SETREG %x %02x\n", OPCODE_X(cpu->opcode), OPCODE_NN(cpu->opcode));
-                cpu->V[OPCODE_X(cpu->opcode)] = OPCODE_NN(cpu->opcode); // Bitshift to get value between 0 and F 
-                } break;
-
-        case OPCODE_ADD_TO_REG:
-            {
-                printf("REGADDVAL %x %02x\n", OPCODE_X(cpu->opcode), OPCODE_NN(cpu->opcode));
-                cpu->V[OPCODE_X(cpu->opcode)] += OPCODE_NN(cpu->opcode);
-            } break;
-
-        case OPCODE_SET_INDEX_REG:
-            {
-                printf("ISET %03x\n", OPCODE_NN(cpu->opcode));
-                cpu->I = OPCODE_NNN(cpu->opcode);
-            } break;
-
-        case OPCODE_JUMP_OFFSET:
-            {
-                printf("JUMPOFFSET %03x\n", OPCODE_NNN(cpu->opcode));
-
-                if (jumpX)
-                {
-                    cpu->pc = OPCODE_NN(cpu->opcode) + cpu->V[OPCODE_X(cpu->opcode)];
-                }
-                else {
-                    cpu->pc = OPCODE_NNN(cpu->opcode) + cpu->V[0];
-                }
-            } break;
-
-        case OPCODE_F:
-        {
-            switch (OPCODE_NN(cpu->opcode))
-            {
-                case OPCODE_STORE_MEMORY:
-                {
-                    printf("MEMSTORE %x\n", OPCODE_X(cpu->opcode));
-                    for (int i=0; i<=OPCODE_X(cpu->opcode); i++)
-                    {
-                        uint16_t memoryPos = (memoryIncr) ? cpu->I++ : cpu->I+i;
-                        cpu->memory[memoryPos] = cpu->V[i];
-                    }
-                } break;
-
-                case OPCODE_LOAD_MEMORY:
-                {
-                    printf("MEMLOAD %x\n", OPCODE_X(cpu->opcode));
-                    for (int i=0; i<=OPCODE_X(cpu->opcode); i++)
-                    {
-                        uint16_t memoryPos = (memoryIncr) ? cpu->I++ : cpu->I+i;
-                        cpu->V[i] = cpu->memory[memoryPos];
-                    }
-                } break;
-
-                case OPCODE_CONVERT_DECIMAL:
-                {
-                    printf("CONVERTDEC %x\n", OPCODE_X(cpu->opcode));
-                    cpu->memory[cpu->I] = cpu->V[OPCODE_X(cpu->opcode)] / 100;
-                    cpu->memory[cpu->I+1] = (cpu->V[OPCODE_X(cpu->opcode)] / 10) %10;
-                    cpu->memory[cpu->I+2] = cpu->V[OPCODE_X(cpu->opcode)] % 10;
-                } break;
-
-                case OPCODE_ADD_TO_INDEX:
-                {
-                    printf("IADD %x\n", OPCODE_X(cpu->opcode));
-                    cpu->I += cpu->V[OPCODE_X(cpu->opcode)];
-                } break;
-
-                case OPCODE_GET_DELAY_TIMER:
-                {
-                    printf("GETDELAY %x\n", OPCODE_X(cpu->opcode));
-                    cpu->V[OPCODE_X(cpu->opcode)] = cpu->delayTimer;
-                } break;
-
-                case OPCODE_SET_DELAY_TIMER:
-                {
-                    printf("SETDELAY %x\n", OPCODE_X(cpu->opcode));
-                    cpu->delayTimer = cpu->V[OPCODE_X(cpu->opcode)];
-                } break;
-
-                case OPCODE_SET_SOUND_TIMER:
-                {
-                    printf("SETSOUND %x\n", OPCODE_X(cpu->opcode));
-                    cpu->soundTimer = cpu->V[OPCODE_X(cpu->opcode)];
-                } break;
-
-                case OPCODE_AWAIT_KEY:
-                {
-                    printf("AWAITKEY\n");
-                    for (int i=0; i<16; i++)
-                    {
-                        if (cpu->keys[SDL_inputs[i]])
-                        {
-                            cpu->V[OPCODE_X(cpu->opcode)] = i;
-                            cpu->pc+=2;            
-                            break;
-                        }
-                    }
-                    cpu->pc-=2;
-                } break;
-
-                case OPCODE_FONT_CHARACTER:
-                {
-                    printf("GETCHAR %x\n", OPCODE_X(cpu->opcode));
-                    uint8_t character = cpu->V[OPCODE_X(cpu->opcode)] & 0x0F; // Only use the last nibble
-                    cpu->I = character * 5;
-                    
-                } break;
-
-                default:
-                {
-                    printf("[ERROR]: Invalid opcode: '%04x'\n", cpu->opcode);
-                    cpu->halted = 1;
-                } break;
-            }
-        } break;
-
-        case OPCODE_KEY_SKIP:
-        {
-            switch (OPCODE_NN(cpu->opcode))
-            {
-                case OPCODE_SKIP_IF_KEY:
-                    {
-                        printf("KEYIF %x\n", OPCODE_X(cpu->opcode));
-                        if (cpu->keys[SDL_inputs[cpu->V[OPCODE_X(cpu->opcode)]]]) cpu->pc+=2;
-                    } break;
-
-                case OPCODE_SKIP_IF_NOT_KEY:
-                    {
-                        printf("KEYNOT %x\n", OPCODE_X(cpu->opcode));
-                        if (!(cpu->keys[SDL_inputs[cpu->V[OPCODE_X(cpu->opcode)]]])) cpu->pc+=2;
-                    } break;
-            } 
-        } break;
-
-        case OPCODE_DISPLAY:
-        {
-            printf("DISPLAY\n");
-            cpu->V[0xF] = 0;
-            uint8_t x = cpu->V[OPCODE_X(cpu->opcode)] % SCREEN_WIDTH;
-            uint8_t y = cpu->V[OPCODE_Y(cpu->opcode)] % SCREEN_HEIGHT;
-            uint8_t height = OPCODE_N(cpu->opcode);
-
-            for (int j=0; j<height; j++)
-            {
-                if (y+j>=SCREEN_HEIGHT) break;
-                uint8_t spriteRow = cpu->memory[cpu->I+j];
-                for (int i=0; i<8; i++)
-                {
-                    if (x+i>=SCREEN_WIDTH) break;
-                    if (cpu->display[x+i][y+j] && ((spriteRow >> (7-i)) & 1) == 1) cpu->V[0xF] = 1;
-                    if ((spriteRow >> (7-i)) & 1) cpu->display[x+i][y+j] ^= 1; //!cpu->display[x+i][y+j];
-                }
-            }
-            cpu->drawFlag = 1;
-        } break;
-
-        default:
-        {
-            printf("[ERROR]: Invalid opcode: '%04x'\n", cpu->opcode);
-            cpu->halted = true;
-        } break;
+            if (captureCount < CAPTURE_MAX_FILES) capturePaths[captureCount++] = args[++i];
+            else printf("[WARNING]: At most %d capture files. Ignoring '%s'.\n", CAPTURE_MAX_FILES, args[++i]);
+        }
+        else if (!strcmp(args[i], "--capture-drop")) captureDrop = true;
+        else if (!strcmp(args[i], "--load") && i+1 < argc) loadPath = args[++i];
+        else if (!strcmp(args[i], "--seed") && i+1 < argc) seed = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--record") && i+1 < argc) recordPath = args[++i];
+        else if (romPath == NULL) romPath = args[i];
+        else printf("[WARNING]: Too many arguments. Ignoring '%s'.\n", args[i]);
     }
-}
-
-void EmulateCycle(chip8* cpu)
-{
-    // Fetch instruction
-    cpu->opcode = cpu->memory[cpu->pc] << 8 | cpu->memory[cpu->pc+1]; // Combine the two bytes to create the opcode
-    //printf("[0x%08x]: %04x\n", cpu->pc, cpu->opcode);
-    printf("[0x%08x] %04x | ", cpu->pc, cpu->opcode);
-    cpu->pc+=2; // increment program counter by 2
-
-    DecodeAndExecute(cpu);
-}
-
-#define CLOCK_HZ 10000//500
-#define TIMER_HZ 60
 
-int main( int argc, char* args[] )
-{
-    // Error handling yippe :D
-    if (argc <= 1)
+    if (romPath == NULL)
     {
         printf("[ERROR]: Not enough arguments.\n");
+        printf("Usage: %s [--trace file] [--hotspots file] [--core switch|threaded|block|jit] [--profile modern|vip|schip|xochip] [--ips n] [--turbo] [--software] [--scale n] [--filter phosphor,scale2x|scale3x,scanlines] [--audio-buffer samples] [--mute] [--load state] [--seed n] [--record movie] [--capture file]... [--capture-drop] rom.ch8\n", args[0]);
         return -1;
     }
-    else if (argc > 2) {
-        printf("[WARNING]: Too many arguments. Only using the first one.\n");
-    }
-    if (strlen(args[1]) <= 4)
+    if (strlen(romPath) <= 4)
     {
         printf("[ERROR]: Invalid file name. Must be more than 4 characters long.\n");
         return -1;
     }
-    if (strcmp(((char*)args[1] + strlen(args[1])-4), ".ch8"))
+    if (strcmp(romPath + strlen(romPath)-4, ".ch8"))
     {
         printf("[ERROR]: Invalid filetype. File must have '.ch8' extension.");
         return -1;
     }
+    if (loadPath != NULL && recordPath != NULL)
+    {
+        printf("[ERROR]: Movies start from power on, --load can't be combined with --record.\n");
+        return -1;
+    }
 
+    if (audioBuffer < 16 || audioBuffer > 8192)
+    {
+        printf("[ERROR]: Audio buffer must be between 16 and 8192 samples.\n");
+        return -1;
+    }
+    if (scale < 2)
+    {
+        printf("[ERROR]: Scale must be at least 2, so hi-res pixels stay whole.\n");
+        return -1;
+    }
+
+    if (clockHz == 0)
+    {
+        printf("[ERROR]: Instructions per second must be above 0.\n");
+        return -1;
+    }
+
+    const core* cpuCore = FindCore(coreName);
+    if (cpuCore == NULL)
+    {
+        printf("[ERROR]: Unknown core '%s'.\n", coreName);
+        return -1;
+    }
+    const profile* quirkProfile = (profileName != NULL) ? FindProfile(profileName) : NULL;
+    if (profileName != NULL && quirkProfile == NULL)
+    {
+        printf("[ERROR]: Unknown profile '%s'.\n", profileName);
+        return -1;
+    }
 
-    chip8 cpu = InitProgram(args[1]);
-    InitWindow("CHIP-8", SCREEN_WIDTH*SCALE, SCREEN_HEIGHT*SCALE);
+    if (tracePath != NULL)
+    {
+        if (cpuCore != &cores[0]) printf("[WARNING]: Tracing only works with the switch core. Using it instead.\n");
+        cpuCore = &cores[0];
+        if (!TraceStart(tracePath)) return -1;
+    }
+    if (hotspotPath != NULL && !HotspotsStart(hotspotPath, HOTSPOT_PERIOD)) return -1; // Sampled, so any core and full speed
+    if (captureCount && !CaptureStart(capturePaths, captureCount, captureDrop)) return -1;
+
+    chip8* cpu = CreateMachine(cpuCore);
+    if (!LoadRom(cpu, romPath)) return -1;
+    if (quirkProfile != NULL) SetProfile(cpu, quirkProfile);
+    else if (DetectProfile(cpu->romHash) != NULL) printf("Using the %s quirk profile for this ROM\n", cpu->profile->name);
+    cpu->clockHz = clockHz;
+    SeedRandom(cpu, seed);
+    if (loadPath != NULL && !LoadState(cpu, loadPath)) return -1;
+
+    // The scale is in lo-res pixels, hi-res ones are half as big
+    SDL_state.width = LORES_WIDTH * scale;
+    SDL_state.height = LORES_HEIGHT * scale;
+    SDL_state.filter = CreateFilter(filterNames, SDL_state.width, SDL_state.height);
+    if (SDL_state.filter == NULL) return -1;
+
+    InitWindow("CHIP-8", SDL_state.width, SDL_state.height);
+    StartRenderThread(software);
+
+    // Sound plays in emulated time, which turbo runs faster than, so turbo runs silent
+    if (!turbo && !mute) OpenAudio(audioBuffer, clockHz);
+
+    // F5 saves to and F9 loads from rom.state, holding backspace rewinds
+    char statePath[strlen(romPath) + 3];
+    strcpy(statePath, romPath);
+    strcpy(statePath + strlen(romPath) - 4, ".state");
+    rewindBuffer* history = CreateRewindBuffer();
+    uint64_t rewindTick = cpu->ticks;
+
+    // Keypad changes are logged with the cycle they happened at, see movie.c
+    movie recording = { cpu->romHash, seed, clockHz, cpu->profile };
+    uint16_t recordedKeys = 0;
 
     SDL_Event e;
-    cpu.halted = 0;
+    cpu->halted = 0;
+
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+    const uint64_t startTime = SDL_GetPerformanceCounter();
+    uint64_t lastTime = startTime;
+    double owed = 0; // Instructions the emulator is behind the host clock
 
-    uint32_t lastTime = SDL_GetTicks();
-    uint32_t timerLast = SDL_GetTicks();
-    while (!cpu.halted)
+    uint64_t reportTime = startTime;
+    uint64_t reportCycles = 0;
+    uint64_t lastRewind = startTime;
+    while (!cpu->halted)
     {
         while(SDL_PollEvent(&e))
         {
-            if(e.type==SDL_QUIT) cpu.halted = 1; 
+            if(e.type==SDL_QUIT) cpu->halted = 1;
+            if(e.type==SDL_WINDOWEVENT && e.window.event==SDL_WINDOWEVENT_EXPOSED) ExposeWindow();
+            if(e.type==SDL_KEYDOWN && e.key.keysym.scancode==SDL_SCANCODE_F5 && SaveState(cpu, statePath)) printf("Saved state to '%s'\n", statePath);
+            if(e.type==SDL_KEYDOWN && e.key.keysym.scancode==SDL_SCANCODE_F9 && recordPath != NULL) printf("[WARNING]: Can't load a state while recording a movie.\n");
+            else if(e.type==SDL_KEYDOWN && e.key.keysym.scancode==SDL_SCANCODE_F9 && LoadState(cpu, statePath))
+            {
+                printf("Loaded state from '%s'\n", statePath);
+                owed = 0;
+            }
         }
 
         // Update input
         SDL_PumpEvents();
-        cpu.keys = (char*)SDL_GetKeyboardState(NULL); // Casting to char* because SDL sucks and returns a const char? Not good practice btw
-        
-        uint32_t currentTime = SDL_GetTicks();
-        // Run ~500 opcodes per second
-        if (currentTime - lastTime >= (100 / CLOCK_HZ))
+        const Uint8* keyboard = SDL_GetKeyboardState(NULL);
+        uint16_t keypad = ReadKeypad(keyboard);
+        SetKeypad(cpu, keypad);
+
+        uint64_t currentTime = SDL_GetPerformanceCounter();
+        uint64_t cyclesBefore = cpu->cycles;
+        uint64_t idleBefore = cpu->idleCycles;
+        bool rewinding = keyboard[SDL_SCANCODE_BACKSPACE];
+        if (recordPath != NULL && !rewinding && keypad != recordedKeys)
         {
-            EmulateCycle(&cpu);
-            lastTime = currentTime;
+            MovieAddEvent(&recording, cpu->cycles, keypad);
+            recordedKeys = keypad;
         }
-   
-        // Update timer at 60Hz
-        if (currentTime - timerLast >= (1000 / TIMER_HZ))
+        if (rewinding)
         {
-            if (cpu.delayTimer>0) cpu.delayTimer--;
-            if (cpu.soundTimer>0)
+            // The machine doesn't run while rewinding, step back one recorded frame per frame
+            if (currentTime - lastRewind >= frequency / TIMER_HZ)
             {
-                printf("BEEP!\n");
-                cpu.delayTimer--;
+                RewindStep(history, cpu);
+                lastRewind = currentTime;
             }
-            timerLast = currentTime;
+            owed = 0;
+
+            // Rewinding while recording rerecords from here on
+            while (recording.count > 0 && recording.events[recording.count-1].cycle >= cpu->cycles) recording.count--;
+            recordedKeys = (recording.count > 0) ? recording.events[recording.count-1].keys : 0;
+        }
+        else if (turbo)
+        {
+            // Unthrottled, keep running batches until it is time to show a frame
+            uint64_t frameEnd = currentTime + frequency / TIMER_HZ;
+            do
+            {
+                ExecuteCycles(cpu, clockHz / TIMER_HZ + 1);
+            } while (!cpu->halted && SDL_GetPerformanceCounter() < frameEnd);
+        }
+        else
+        {
+            // Run every instruction that should have happened since the last pass
+            owed += (double)(currentTime - lastTime) * clockHz / frequency;
+            if (owed > clockHz / 10.0) owed = clockHz / 10.0; // Don't try to catch up on more than 100ms after a stall
+            uint64_t batch = (uint64_t)owed;
+            owed -= batch;
+            ExecuteCycles(cpu, batch);
+        }
+        lastTime = currentTime;
+
+        // Record at most one rewind frame per pass, and only when the machine got further
+        if (!rewinding && cpu->ticks != rewindTick)
+        {
+            RewindPush(history, cpu);
+            rewindTick = cpu->ticks;
         }
 
-        if (cpu.drawFlag)
+        if (cpu->drawFlag) PublishFrame(cpu);
+
+        // Show the achieved speed once a second
+        if (currentTime - reportTime >= frequency)
         {
-            UpdateWindowDisplay(&cpu);
-            cpu.drawFlag = 0;
+            char title[64];
+            double achieved = (double)(cpu->cycles - reportCycles) * frequency / (currentTime - reportTime);
+            snprintf(title, sizeof(title), "CHIP-8 | %.0f / %u IPS%s", achieved, clockHz, (turbo) ? " (turbo)" : "");
+            SDL_SetWindowTitle(SDL_state.window, title);
+            reportTime = currentTime;
+            reportCycles = cpu->cycles;
         }
 
-        SDL_Delay(1);
+        // If the whole batch was spent in a wait loop, sleep until the next timer tick or input. An empty
+        // batch only means the pass came early, it says nothing about the program waiting.
+        bool idle = cpu->cycles != cyclesBefore && cpu->cycles - cyclesBefore == cpu->idleCycles - idleBefore;
+        if (idle && !rewinding && (!turbo || (cpu->delayTimer == 0 && cpu->soundTimer == 0)))
+        {
+            uint32_t ms = (NextTickCycle(cpu) - cpu->cycles) * 1000 / clockHz;
+            SDL_WaitEventTimeout(NULL, (ms > 0) ? ms : 1);
+        }
+        else if (!turbo || rewinding) SDL_Delay(1);
     }
 
+    double seconds = (double)(SDL_GetPerformanceCounter() - startTime) / frequency;
+    printf("Ran %lu instructions in %.2fs: %.0f IPS achieved, %u IPS target%s\n", cpu->cycles, seconds,
+        cpu->cycles / seconds, clockHz, (turbo) ? " (turbo)" : "");
+    printf("Skipped %lu instructions (%.2f%%) in wait loops\n", cpu->idleCycles, cpu->cycles ? 100.0 * cpu->idleCycles / cpu->cycles : 0.0);
+
+    StopRenderThread();
+    CloseAudio();
+    PrintCoreStats(cpu);
+    PrintDisplayStats();
+    PrintRewindStats(history);
+    FreeRewindBuffer(history);
+
+    if (recordPath != NULL)
+    {
+        recording.endCycle = cpu->cycles;
+        if (SaveMovie(&recording, recordPath)) printf("Recorded %u key changes over %lu instructions to '%s'\n", recording.count, cpu->cycles, recordPath);
+        FreeMovie(&recording);
+    }
+    HotspotsStop();
+    CaptureStop();
+    DestroyMachine(cpu);
+    TraceStop();
     CloseWindow();
+    FreeFilter(SDL_state.filter);
 }
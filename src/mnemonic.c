@@ -0,0 +1,77 @@
+// Turns an opcode back into the mnemonic text the emulator used to print for every instruction, with the
+// operands the old text left out so a disassembly listing reads unambiguously
+int FormatMnemonic(uint16_t opcode, char* out, size_t size)
+{
+    uint8_t x = OPCODE_X(opcode);
+    uint8_t y = OPCODE_Y(opcode);
+
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            if (opcode == OPCODE_CLEAR_SCREEN) return snprintf(out, size, "Clear screen");
+            if (opcode == OPCODE_RETURN_SUBROUTINE) return snprintf(out, size, "RETURN");
+            if (opcode == OPCODE_SCROLL_RIGHT) return snprintf(out, size, "SCROLLR");
+            if (opcode == OPCODE_SCROLL_LEFT) return snprintf(out, size, "SCROLLL");
+            if (opcode == OPCODE_EXIT) return snprintf(out, size, "EXIT");
+            if (opcode == OPCODE_LORES) return snprintf(out, size, "LORES");
+            if (opcode == OPCODE_HIRES) return snprintf(out, size, "HIRES");
+            if ((opcode & 0xFFF0) == OPCODE_SCROLL_DOWN) return snprintf(out, size, "SCROLLD %x", OPCODE_N(opcode));
+            if ((opcode & 0xFFF0) == OPCODE_SCROLL_UP) return snprintf(out, size, "SCROLLU %x", OPCODE_N(opcode));
+            break;
+
+        case OPCODE_ARITHMETIC:
+            switch (OPCODE_N(opcode))
+            {
+                case OPCODE_SET: return snprintf(out, size, "SETREGREG %x %x", x, y);
+                case OPCODE_BINARY_OR: return snprintf(out, size, "OR %x %x", x, y);
+                case OPCODE_BINARY_AND: return snprintf(out, size, "AND %x %x", x, y);
+                case OPCODE_LOGICAL_XOR: return snprintf(out, size, "XOR %x %x", x, y);
+                case OPCODE_ADD: return snprintf(out, size, "REGADDREG %x %x", x, y);
+                case OPCODE_SUBTRACT_XY: return snprintf(out, size, "SUBXY %x %x", x, y);
+                case OPCODE_SUBTRACT_YX: return snprintf(out, size, "SUBYX %x %x", x, y);
+                case OPCODE_SHIFT_RIGHT: return snprintf(out, size, "SHIFTR %x %x", x, y);
+                case OPCODE_SHIFT_LEFT: return snprintf(out, size, "SHIFTL %x %x", x, y);
+            }
+            break;
+
+        case OPCODE_JUMP: return snprintf(out, size, "JUMP %03x", OPCODE_NNN(opcode));
+        case OPCODE_RANDOM: return snprintf(out, size, "RNG %x %02x", x, OPCODE_NN(opcode));
+        case OPCODE_CALL_SUBROUTINE: return snprintf(out, size, "SUBROUTINE CALL %03x", OPCODE_NNN(opcode));
+        case OPCODE_REG_IS_VALUE: return snprintf(out, size, "REGISVAL %x %02x", x, OPCODE_NN(opcode));
+        case OPCODE_REG_IS_NOT_VALUE: return snprintf(out, size, "REGNOTVAL %x %02x", x, OPCODE_NN(opcode));
+        case OPCODE_REG_IS_REG: return snprintf(out, size, "REGISREG %x %x", x, y);
+        case OPCODE_REG_IS_NOT_REG: return snprintf(out, size, "REGNOTREG %x %x", x, y);
+        case OPCODE_SET_REG: return snprintf(out, size, "SETREG %x %02x", x, OPCODE_NN(opcode));
+        case OPCODE_ADD_TO_REG: return snprintf(out, size, "REGADDVAL %x %02x", x, OPCODE_NN(opcode));
+        case OPCODE_SET_INDEX_REG: return snprintf(out, size, "ISET %03x", OPCODE_NNN(opcode));
+        case OPCODE_JUMP_OFFSET: return snprintf(out, size, "JUMPOFFSET %03x", OPCODE_NNN(opcode));
+        case OPCODE_DISPLAY: return snprintf(out, size, "DISPLAY %x %x %x", x, y, OPCODE_N(opcode));
+
+        case OPCODE_F:
+            switch (OPCODE_NN(opcode))
+            {
+                case OPCODE_STORE_MEMORY: return snprintf(out, size, "MEMSTORE %x", x);
+                case OPCODE_LOAD_MEMORY: return snprintf(out, size, "MEMLOAD %x", x);
+                case OPCODE_CONVERT_DECIMAL: return snprintf(out, size, "CONVERTDEC %x", x);
+                case OPCODE_ADD_TO_INDEX: return snprintf(out, size, "IADD %x", x);
+                case OPCODE_GET_DELAY_TIMER: return snprintf(out, size, "GETDELAY %x", x);
+                case OPCODE_SET_DELAY_TIMER: return snprintf(out, size, "SETDELAY %x", x);
+                case OPCODE_SET_SOUND_TIMER: return snprintf(out, size, "SETSOUND %x", x);
+                case OPCODE_AWAIT_KEY: return snprintf(out, size, "AWAITKEY");
+                case OPCODE_FONT_CHARACTER: return snprintf(out, size, "GETCHAR %x", x);
+                case OPCODE_BIG_FONT_CHARACTER: return snprintf(out, size, "GETBIGCHAR %x", x);
+                case OPCODE_SELECT_PLANES: return snprintf(out, size, "PLANES %x", x);
+            }
+            break;
+
+        case OPCODE_KEY_SKIP:
+            switch (OPCODE_NN(opcode))
+            {
+                case OPCODE_SKIP_IF_KEY: return snprintf(out, size, "KEYIF %x", x);
+                case OPCODE_SKIP_IF_NOT_KEY: return snprintf(out, size, "KEYNOT %x", x);
+            }
+            break;
+    }
+
+    return snprintf(out, size, "INVALID %04x", opcode);
+}
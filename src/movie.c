@@ -0,0 +1,103 @@
+// Input movies. A movie is a text file with the RNG seed, the clock rate and the keypad state every
+// time it changed, stamped with the emulated cycle it changed at. Replaying one feeds the same keys
+// at the same cycles, so the run executes exactly the same instructions as the recorded one.
+//
+//     C8MOVIE 2
+//     rom 5f0a4b39c1d2e3f4    FNV-1a of the ROM file, the machine's romHash
+//     seed 1700000000
+//     ips 10000
+//     profile vip             quirk profile, version 1 movies predate profiles and ran as modern
+//     keys 123456 0010        cycle, bit i set when keypad key i is down
+//     end 600000              cycle the recording stopped at
+
+#define MOVIE_MAGIC "C8MOVIE"
+#define MOVIE_VERSION 2
+
+void MovieAddEvent(movie* m, uint64_t cycle, uint16_t keys)
+{
+    if (m->count == m->capacity)
+    {
+        m->capacity = (m->capacity) ? m->capacity * 2 : 256;
+        m->events = realloc(m->events, m->capacity * sizeof(movieEvent));
+    }
+    m->events[m->count++] = (movieEvent){ cycle, keys };
+}
+
+void FreeMovie(movie* m)
+{
+    free(m->events);
+    m->events = NULL;
+    m->count = m->capacity = 0;
+}
+
+bool SaveMovie(const movie* m, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("[ERROR]: Failed to open movie file: '%s'\n", path);
+        return false;
+    }
+
+    fprintf(file, "%s %d\n", MOVIE_MAGIC, MOVIE_VERSION);
+    fprintf(file, "rom %016lx\nseed %lu\nips %u\nprofile %s\n", m->romHash, m->seed, m->clockHz, m->profile->name);
+    for (uint32_t i=0; i<m->count; i++) fprintf(file, "keys %lu %04x\n", m->events[i].cycle, m->events[i].keys);
+    fprintf(file, "end %lu\n", m->endCycle);
+    fclose(file);
+    return true;
+}
+
+bool LoadMovie(movie* m, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("[ERROR]: Failed to open movie file: '%s'\n", path);
+        return false;
+    }
+
+    char magic[8] = { 0 };
+    int version = 0;
+    *m = (movie){ 0 };
+    if (fscanf(file, "%7s %d rom %lx seed %lu ips %u", magic, &version, &m->romHash, &m->seed, &m->clockHz) != 5
+        || strcmp(magic, MOVIE_MAGIC) || version < 1 || version > MOVIE_VERSION)
+    {
+        printf("[ERROR]: '%s' is not a version 1 to %d movie.\n", path, MOVIE_VERSION);
+        fclose(file);
+        return false;
+    }
+
+    m->profile = &profiles[0];
+    char profileName[32] = { 0 };
+    if (version >= 2 && (fscanf(file, " profile %31s", profileName) != 1 || (m->profile = FindProfile(profileName)) == NULL))
+    {
+        printf("[ERROR]: Movie '%s' has an unknown quirk profile '%s'.\n", path, profileName);
+        fclose(file);
+        return false;
+    }
+
+    uint64_t cycle;
+    unsigned int keys;
+    uint64_t last = 0;
+    while (fscanf(file, " keys %lu %x", &cycle, &keys) == 2)
+    {
+        if (cycle < last)
+        {
+            printf("[ERROR]: Movie events are out of order at cycle %lu.\n", cycle);
+            fclose(file);
+            FreeMovie(m);
+            return false;
+        }
+        MovieAddEvent(m, cycle, keys);
+        last = cycle;
+    }
+
+    bool ok = fscanf(file, " end %lu", &m->endCycle) == 1 && m->endCycle >= last;
+    fclose(file);
+    if (!ok)
+    {
+        printf("[ERROR]: Movie '%s' has no valid end line.\n", path);
+        FreeMovie(m);
+    }
+    return ok;
+}
@@ -0,0 +1,65 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+// Opcode types
+#define OPCODE_NO_ARGS 0x0000 // Opcodes with no arguments
+    #define OPCODE_CLEAR_SCREEN 0x00E0 // Clear the screen
+    #define OPCODE_SCROLL_DOWN 0x00C0 // 00CN scrolls the display down N rows (SUPER-CHIP)
+    #define OPCODE_SCROLL_UP 0x00D0 // 00DN scrolls it up N rows (XO-CHIP)
+    #define OPCODE_SCROLL_RIGHT 0x00FB // Scrolls 4 pixels right
+    #define OPCODE_SCROLL_LEFT 0x00FC // Scrolls 4 pixels left
+    #define OPCODE_EXIT 0x00FD // Stops the machine
+    #define OPCODE_LORES 0x00FE // Switches to 64x32 and clears the display
+    #define OPCODE_HIRES 0x00FF // Switches to 128x64 and clears the display
+
+#define OPCODE_RETURN_SUBROUTINE 0x00EE // Returns from subroutine/function
+#define OPCODE_JUMP 0x1000 // Jumps to position
+#define OPCODE_CALL_SUBROUTINE 0x2000 // Calls subroutine/function
+
+#define OPCODE_REG_IS_VALUE 0x3000 // If register is equal to value
+#define OPCODE_REG_IS_NOT_VALUE 0x4000 // If register is not equal to value
+#define OPCODE_REG_IS_REG 0x5000 // If register is equal to other register
+#define OPCODE_REG_IS_NOT_REG 0x9000 // If register is not equal to other registers
+
+#define OPCODE_SET_REG 0x6000 // Set register to value
+#define OPCODE_ADD_TO_REG 0x7000 // Add value to register
+#define OPCODE_SET_INDEX_REG 0xA000 // Set index register
+#define OPCODE_JUMP_OFFSET 0xB000 // Jumps with the offset of V0 (COSMAC VIP implementation)
+#define OPCODE_RANDOM 0xC000 // Sets VX to a random number binary ANDed with NN
+#define OPCODE_DISPLAY 0xD000 // Draw sprite, DXY0 draws a 16x16 one
+
+#define OPCODE_ARITHMETIC 0x8000 // Various logic and arithmetic opcodes 
+    #define OPCODE_SET 0x0 // VX is set to the value of VY
+    #define OPCODE_BINARY_OR 0x1 // VX is set to the binary OR of VX and VY
+    #define OPCODE_BINARY_AND 0x2 // VX is set to the binary AND of VX and VY
+    #define OPCODE_LOGICAL_XOR 0x3 // VX is set to the XOR of VX and VY
+    #define OPCODE_ADD 0x4 // VX is set to VX + VY
+    #define OPCODE_SUBTRACT_XY 0x5 // VX is set to VX - VY
+    #define OPCODE_SUBTRACT_YX 0x7 // VX is set to VY - VX
+    #define OPCODE_SHIFT_RIGHT 0x6 // Sets VX to VY and shifts VX to the right (We are using the COSMAC VIP implementation for now)
+    #define OPCODE_SHIFT_LEFT 0xE // Like OPCODE_SHIFT_RIGHT but we shift left
+
+#define OPCODE_KEY_SKIP 0xE000
+    #define OPCODE_SKIP_IF_KEY 0x9E
+    #define OPCODE_SKIP_IF_NOT_KEY 0xA1
+
+#define OPCODE_F 0xF000 // Group of misc opcodes
+    #define OPCODE_STORE_MEMORY 0x55 // Stores registers to memory
+    #define OPCODE_LOAD_MEMORY 0x65 // Loads registers from memory
+    #define OPCODE_CONVERT_DECIMAL 0x33 // Finds the 3 decimal digits of VX and stores it in memory
+    #define OPCODE_ADD_TO_INDEX 0x1E // Adds VX to index
+    #define OPCODE_GET_DELAY_TIMER 0x07 // Sets VX to current value of delay delayTimer
+    #define OPCODE_SET_DELAY_TIMER 0x15 // Sets delayTimer to VX
+    #define OPCODE_SET_SOUND_TIMER 0x18 // Sets soundTimer to VX
+    #define OPCODE_AWAIT_KEY 0x0A // Traps program in loop until key pressed
+    #define OPCODE_FONT_CHARACTER 0x29 // Sets I to specified character
+    #define OPCODE_BIG_FONT_CHARACTER 0x30 // Sets I to the 8x10 digit (SUPER-CHIP)
+    #define OPCODE_SELECT_PLANES 0x01 // FN01 picks the bit planes the display opcodes act on (XO-CHIP)
+
+#define OPCODE_X(opcode) ((opcode & 0x0F00) >> 8)
+#define OPCODE_Y(opcode) ((opcode & 0x00F0) >> 4)
+#define OPCODE_NNN(opcode) (opcode & 0x0FFF)
+#define OPCODE_NN(opcode) (opcode & 0x00FF)
+#define OPCODE_N(opcode) (opcode & 0x000F)
+
+#endif
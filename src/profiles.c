@@ -0,0 +1,58 @@
+// Quirk profiles and the ROM database that picks one when a ROM is loaded. Each profile's quirks are also
+// defined as QUIRKS_* in core.c, where every interpreter is compiled once per profile; the order here has
+// to match PROFILE_LIST there. Display wait and sprite wrapping aren't emulated by any profile yet.
+
+const profile profiles[] = {
+    { "modern", "No quirks, what most interpreters written in the last decade do", QUIRKS_MODERN },
+    { "vip", "COSMAC VIP, the original interpreter", QUIRKS_VIP },
+    { "schip", "SUPER-CHIP 1.1 and CHIP-48 on the HP48", QUIRKS_SCHIP },
+    { "xochip", "XO-CHIP and Octo's defaults", QUIRKS_XOCHIP },
+};
+const int profileCount = sizeof(profiles) / sizeof(profiles[0]);
+
+_Static_assert(sizeof(profiles) / sizeof(profiles[0]) == PROFILE_COUNT, "PROFILE_LIST and profiles[] have to match");
+
+typedef struct {
+    uint64_t romHash; // FNV-1a of the ROM file
+    const char* profileName;
+} romProfile;
+
+static const romProfile romDatabase[] = {
+    { 0x64e45391ba0238a1, "vip" }, // IBM Logo
+    { 0xc86e8ff63fce668c, "schip" }, // Brix (Andreas Gustafsson, 1990)
+    { 0x4623533b8904c7f1, "schip" }, // Brick (Brix hack, 1990)
+    { 0x25e96e1086ce43cb, "schip" }, // Maze (David Winter)
+    { 0x624b3eed64313f42, "schip" }, // Pong (Paul Vervalin, 1990)
+    { 0x618a84f06fe32861, "schip" }, // Space Invaders (David Winter)
+    { 0x04eb2109dc29b1ab, "schip" }, // Tetris (Fran Dachille, 1991)
+    { 0x56049e83866b207d, "schip" }, // Tic-Tac-Toe (David Winter)
+    { 0xaa0b78218b560bc4, "xochip" }, // Cave Explorer (John Earnest)
+    { 0x8e808448faec1579, "xochip" }, // danm8ku (Octojam)
+    { 0xc43550199874d785, "xochip" }, // Outlaw (John Earnest)
+};
+
+const profile* FindProfile(const char* name)
+{
+    for (int i=0; i<profileCount; i++)
+    {
+        if (!strcmp(name, profiles[i].name)) return &profiles[i];
+    }
+    return NULL;
+}
+
+const profile* DetectProfile(uint64_t romHash)
+{
+    for (size_t i=0; i<sizeof(romDatabase) / sizeof(romDatabase[0]); i++)
+    {
+        if (romDatabase[i].romHash == romHash) return FindProfile(romDatabase[i].profileName);
+    }
+    return NULL;
+}
+
+// Compiled blocks have the old quirks baked in
+void SetProfile(chip8* cpu, const profile* p)
+{
+    if (cpu->profile == p) return;
+    cpu->profile = p;
+    if (cpu->blockCache) FlushBlocks(cpu->blockCache);
+}
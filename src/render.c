@@ -0,0 +1,118 @@
+// Render thread. The emulator publishes every frame it draws and goes straight back to running, the render
+// thread presents the newest one, so a present waiting for vsync never holds up emulation. Frames are passed
+// through a lock-free triple buffer: the emulator fills `back` and swaps it into `middle`, the render thread
+// swaps its `front` with `middle` whenever a fresh frame is waiting there. Neither side ever waits on the
+// other, a frame the renderer didn't get to before the next one came is simply dropped. Each frame carries the
+// rows that changed since the last one the renderer took, so the filters only redo those.
+#include <stdatomic.h>
+
+#define FRAME_FRESH 4 // Set in `middle` while its frame hasn't been taken yet
+
+struct {
+    framebuffer frames[3]; // Copies of the machine's display
+    uint64_t rows[3]; // The machine's dirtyRows, merged over the frames the renderer didn't take
+    uint64_t untaken; // Rows changed since the last frame the renderer is known to have taken, emulator only
+    _Atomic uint32_t middle; // Index of the frame in between, with FRAME_FRESH
+    uint32_t back; // Only the emulator touches this one
+    uint32_t front; // Only the render thread touches this one
+
+    SDL_Thread* thread;
+    SDL_sem* wake; // Posted when there is something new to present
+    SDL_sem* ready; // Posted once the renderer was created, or failed to be
+    atomic_bool running;
+    atomic_bool exposed; // The window needs presenting again even if nothing changed
+    bool software;
+    bool failed;
+
+    // Stats, kept by the emulator
+    uint64_t framesPublished;
+    uint64_t framesDropped; // Replaced by a newer frame before the render thread took them
+} renderState;
+
+// Takes the newest frame into `front`, false if there is none since the last one
+static bool TakeFrame(uint64_t* rows)
+{
+    if (!(atomic_load_explicit(&renderState.middle, memory_order_relaxed) & FRAME_FRESH)) return false;
+    uint32_t previous = atomic_exchange_explicit(&renderState.middle, renderState.front, memory_order_acq_rel);
+    renderState.front = previous & ~FRAME_FRESH;
+    *rows = renderState.rows[renderState.front];
+    return true;
+}
+
+static int RenderThread(void* data)
+{
+    // The renderer belongs to the thread that created it
+    renderState.failed = !CreateRenderer(renderState.software);
+    SDL_SemPost(renderState.ready);
+    if (renderState.failed) return -1;
+
+    while (atomic_load_explicit(&renderState.running, memory_order_acquire))
+    {
+        // While the phosphor is still fading out the last frame, it is shown again every timer tick
+        bool settling = FilterSettling(SDL_state.filter);
+        SDL_SemWaitTimeout(renderState.wake, (settling) ? 1000 / TIMER_HZ : 100);
+        bool exposed = atomic_exchange_explicit(&renderState.exposed, false, memory_order_relaxed);
+        uint64_t rows = 0; // Showing the same frame again only redoes what is still fading
+        if (TakeFrame(&rows) || exposed || settling) UpdateWindowDisplay(&renderState.frames[renderState.front], rows, exposed);
+    }
+    DestroyRenderer();
+    return 0;
+}
+
+void StartRenderThread(bool software)
+{
+    renderState.back = 0;
+    atomic_store(&renderState.middle, 1);
+    renderState.front = 2;
+    renderState.untaken = ~0ull;
+    renderState.software = software;
+    renderState.wake = SDL_CreateSemaphore(0);
+    renderState.ready = SDL_CreateSemaphore(0);
+    atomic_store(&renderState.running, true);
+    atomic_store(&renderState.exposed, true);
+
+    renderState.thread = SDL_CreateThread(RenderThread, "render", NULL);
+    if (renderState.thread == NULL)
+    {
+        printf("Render thread could not be created! SDL_Error: %s\n", SDL_GetError());
+        exit(-1);
+    }
+    SDL_SemWait(renderState.ready);
+    if (renderState.failed) exit(-1);
+}
+
+void StopRenderThread()
+{
+    atomic_store_explicit(&renderState.running, false, memory_order_release);
+    SDL_SemPost(renderState.wake);
+    SDL_WaitThread(renderState.thread, NULL);
+    SDL_DestroySemaphore(renderState.wake);
+    SDL_DestroySemaphore(renderState.ready);
+}
+
+// Hands the machine's display to the render thread, on the emulator's thread
+void PublishFrame(chip8* cpu)
+{
+    // Until the exchange says the renderer took the frame before, this one has to cover its rows as well
+    renderState.frames[renderState.back] = cpu->display;
+    renderState.rows[renderState.back] = renderState.untaken | cpu->dirtyRows;
+    renderState.untaken |= cpu->dirtyRows;
+
+    uint32_t previous = atomic_exchange_explicit(&renderState.middle, renderState.back | FRAME_FRESH, memory_order_acq_rel);
+    renderState.back = previous & ~FRAME_FRESH;
+    renderState.framesPublished++;
+    // Taken, so only this frame is news. The first exchange gets back the empty initial middle instead.
+    if (!(previous & FRAME_FRESH) && renderState.framesPublished > 1) renderState.untaken = cpu->dirtyRows;
+    cpu->dirtyRows = 0;
+    cpu->drawFlag = 0;
+
+    // A fresh frame still waiting means the render thread was already woken for it
+    if (previous & FRAME_FRESH) renderState.framesDropped++;
+    else SDL_SemPost(renderState.wake);
+}
+
+void ExposeWindow()
+{
+    atomic_store_explicit(&renderState.exposed, true, memory_order_relaxed);
+    SDL_SemPost(renderState.wake);
+}
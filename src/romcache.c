@@ -0,0 +1,173 @@
+// ROM cache. Every ROM file is mapped and read once into a pristine memory image, font and program already
+// in place, and kept for the life of the process. Images are keyed by the FNV-1a of the file's contents, so
+// copies of a ROM under different names share one, and never change once made: any number of threads can
+// reset machines from the same image, which is a single copy of aligned memory. Only finding or adding an
+// image takes the lock.
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ROM_CACHE_BUCKETS 256 // Must be a power of two
+
+typedef struct romEntry {
+    romImage* image;
+    char* path; // Path it was loaded from, a later load of the same path doesn't touch the file
+    struct romEntry* next;
+} romEntry;
+
+struct {
+    pthread_mutex_t lock;
+    romEntry* paths[ROM_CACHE_BUCKETS];
+    romImage* images[ROM_CACHE_BUCKETS];
+    uint32_t imageCount;
+} romCache = { PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t HashBytes(const uint8_t* bytes, size_t size) // FNV-1a
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i=0; i<size; i++) hash = (hash ^ bytes[i]) * 0x100000001b3;
+    return hash;
+}
+
+static romImage* FindImage(uint64_t hash, uint32_t size)
+{
+    for (romImage* image = romCache.images[hash & (ROM_CACHE_BUCKETS-1)]; image != NULL; image = image->next)
+    {
+        if (image->hash == hash && image->size == size) return image;
+    }
+    return NULL;
+}
+
+static romImage* ReadImage(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Failed to open file: '%s'\n", path);
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        printf("[ERROR]: '%s' is not a file.\n", path);
+        close(fd);
+        return NULL;
+    }
+    if ((uint64_t)info.st_size > ROM_MAX_SIZE)
+    {
+        printf("[ERROR]: '%s' is %lu bytes, only %d fit in memory.\n", path, (uint64_t)info.st_size, ROM_MAX_SIZE);
+        close(fd);
+        return NULL;
+    }
+
+    uint32_t size = info.st_size;
+    const uint8_t* rom = (const uint8_t*)"";
+    if (size > 0)
+    {
+        rom = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (rom == MAP_FAILED)
+        {
+            printf("[ERROR]: Failed to map '%s'.\n", path);
+            close(fd);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    uint64_t hash = HashBytes(rom, size);
+    romImage* image = FindImage(hash, size);
+    if (image == NULL)
+    {
+        image = aligned_alloc(64, sizeof(romImage));
+        memset(image, 0, sizeof(romImage));
+        memcpy(image->memory, fontSet, sizeof(fontSet));
+        memcpy(&image->memory[0x200], rom, size); // Remember program starts at 0x200 (512)
+        image->hash = hash;
+        image->size = size;
+        image->next = romCache.images[hash & (ROM_CACHE_BUCKETS-1)];
+        romCache.images[hash & (ROM_CACHE_BUCKETS-1)] = image;
+        romCache.imageCount++;
+        printf("Read %u bytes from %s\n", size, path);
+    }
+    if (size > 0) munmap((void*)rom, size);
+    return image;
+}
+
+const romImage* LoadRomImage(const char* path)
+{
+    uint64_t bucket = HashBytes((const uint8_t*)path, strlen(path)) & (ROM_CACHE_BUCKETS-1);
+    pthread_mutex_lock(&romCache.lock);
+
+    romImage* image = NULL;
+    for (romEntry* entry = romCache.paths[bucket]; entry != NULL && image == NULL; entry = entry->next)
+    {
+        if (!strcmp(entry->path, path)) image = entry->image;
+    }
+    if (image == NULL)
+    {
+        image = ReadImage(path);
+        if (image != NULL)
+        {
+            romEntry* entry = malloc(sizeof(romEntry));
+            *entry = (romEntry){ image, strdup(path), romCache.paths[bucket] };
+            romCache.paths[bucket] = entry;
+        }
+    }
+
+    pthread_mutex_unlock(&romCache.lock);
+    return image;
+}
+
+int PreloadRoms(const char* directory)
+{
+    DIR* dir = opendir(directory);
+    if (dir == NULL)
+    {
+        printf("[ERROR]: Failed to open ROM directory: '%s'\n", directory);
+        return -1;
+    }
+
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(entry->d_name);
+        if (length <= 4 || strcmp(entry->d_name + length - 4, ".ch8")) continue;
+
+        char path[strlen(directory) + length + 2];
+        sprintf(path, "%s/%s", directory, entry->d_name);
+        if (LoadRomImage(path) != NULL) count++;
+    }
+    closedir(dir);
+    printf("Preloaded %d ROMs from '%s', %u distinct images cached\n", count, directory, romCache.imageCount);
+    return count;
+}
+
+void ResetMachine(chip8* cpu, const romImage* rom)
+{
+    memcpy(cpu->memory, rom->memory, sizeof(cpu->memory));
+    memset(&cpu->display, 0, sizeof(cpu->display));
+    memset(cpu->V, 0, sizeof(cpu->V));
+    memset(cpu->stack, 0, sizeof(cpu->stack));
+    cpu->opcode = 0;
+    cpu->I = 0;
+    cpu->pc = 0x200;
+    cpu->sp = 0;
+    cpu->planeMask = 1;
+    cpu->keypad = 0;
+    cpu->delayTimer = 0;
+    cpu->soundTimer = 0;
+    cpu->cycles = 0;
+    cpu->ticks = 0;
+    cpu->idleCycles = 0;
+    cpu->halted = 0;
+    cpu->romHash = rom->hash;
+
+    // Everything derived from the old run is stale
+    cpu->dirtyRows = ~0ull;
+    cpu->drawFlag = 1;
+    cpu->dirtyPages = ~0u;
+    if (cpu->blockCache) FlushBlocks(cpu->blockCache);
+}
@@ -0,0 +1,263 @@
+// Savestates and rewind. A savestate is a header followed by a machineState, which holds everything that
+// defines the emulated machine and nothing from the host (keys, block cache, stats). Rewind keeps one
+// machineState per frame in a ring buffer, stored as the XOR against the next frame with the unchanged
+// bytes run-length encoded, so a frame usually costs a few dozen bytes.
+
+#define SAVESTATE_MAGIC "C8STATE"
+#define SAVESTATE_VERSION 4 // 3: memory grew from 4090 to 4096 bytes, 4: hi-res bit planes and the XO-CHIP plane mask
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t stateSize; // sizeof(machineState), catches layout changes that forgot to bump the version
+} saveStateHeader;
+
+typedef struct {
+    uint8_t memory[sizeof(((chip8*)0)->memory)];
+    framebuffer display;
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t pc;
+    uint16_t stack[16];
+    uint16_t opcode;
+    uint8_t sp;
+    uint8_t planeMask;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint8_t halted;
+    uint64_t cycles;
+    uint64_t ticks;
+    uint64_t rngState;
+} machineState;
+
+void CaptureState(const chip8* cpu, machineState* state)
+{
+    memset(state, 0, sizeof(machineState)); // Padding included, the rewind deltas compare raw bytes
+    memcpy(state->memory, cpu->memory, sizeof(state->memory));
+    memcpy(&state->display, &cpu->display, sizeof(state->display));
+    memcpy(state->V, cpu->V, sizeof(state->V));
+    memcpy(state->stack, cpu->stack, sizeof(state->stack));
+    state->I = cpu->I;
+    state->pc = cpu->pc;
+    state->opcode = cpu->opcode;
+    state->sp = cpu->sp;
+    state->planeMask = cpu->planeMask;
+    state->delayTimer = cpu->delayTimer;
+    state->soundTimer = cpu->soundTimer;
+    state->halted = cpu->halted;
+    state->cycles = cpu->cycles;
+    state->ticks = cpu->ticks;
+    state->rngState = cpu->rngState;
+}
+
+void RestoreState(chip8* cpu, const machineState* state)
+{
+    memcpy(cpu->memory, state->memory, sizeof(state->memory));
+    memcpy(&cpu->display, &state->display, sizeof(state->display));
+    memcpy(cpu->V, state->V, sizeof(state->V));
+    memcpy(cpu->stack, state->stack, sizeof(state->stack));
+    cpu->I = state->I;
+    cpu->pc = state->pc;
+    cpu->opcode = state->opcode;
+    cpu->sp = state->sp;
+    cpu->planeMask = state->planeMask;
+    cpu->delayTimer = state->delayTimer;
+    cpu->soundTimer = state->soundTimer;
+    cpu->halted = state->halted;
+    cpu->cycles = state->cycles;
+    cpu->ticks = state->ticks;
+    cpu->rngState = state->rngState;
+
+    // Everything derived from the old state is stale
+    cpu->dirtyRows = ~0ull;
+    cpu->drawFlag = 1;
+    cpu->dirtyPages = ~0u;
+    if (cpu->blockCache) FlushBlocks(cpu->blockCache);
+}
+
+bool SaveState(const chip8* cpu, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        printf("[ERROR]: Failed to open savestate file: '%s'\n", path);
+        return false;
+    }
+
+    saveStateHeader header = { SAVESTATE_MAGIC, SAVESTATE_VERSION, sizeof(machineState) };
+    machineState state;
+    CaptureState(cpu, &state);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&state, sizeof(state), 1, file) == 1;
+    fclose(file);
+
+    if (!ok) printf("[ERROR]: Failed to write savestate: '%s'\n", path);
+    return ok;
+}
+
+bool LoadState(chip8* cpu, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("[ERROR]: Failed to open savestate file: '%s'\n", path);
+        return false;
+    }
+
+    saveStateHeader header;
+    machineState state;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1;
+    if (ok && (memcmp(header.magic, SAVESTATE_MAGIC, sizeof(header.magic)) || header.version != SAVESTATE_VERSION || header.stateSize != sizeof(machineState)))
+    {
+        printf("[ERROR]: '%s' is not a version %d savestate.\n", path, SAVESTATE_VERSION);
+        fclose(file);
+        return false;
+    }
+    ok = ok && fread(&state, sizeof(state), 1, file) == 1;
+    fclose(file);
+
+    if (!ok)
+    {
+        printf("[ERROR]: Savestate is truncated: '%s'\n", path);
+        return false;
+    }
+    RestoreState(cpu, &state);
+    return true;
+}
+
+#define REWIND_BUFFER_SIZE (4 << 20) // Bytes, must be a power of two
+#define REWIND_BUFFER_MASK (REWIND_BUFFER_SIZE - 1)
+
+// Worst case delta: every other byte changed, one 4 byte run header per changed byte
+#define REWIND_MAX_DELTA (sizeof(machineState) * 3 + 8)
+
+// Each entry is [uint32_t size][delta][uint32_t size] so it can be dropped from either end
+struct rewindBuffer {
+    uint8_t* buffer;
+    uint64_t head; // Byte offset where the next entry goes
+    uint64_t tail; // Byte offset of the oldest entry
+    uint32_t frames;
+
+    machineState current; // The most recent frame, the deltas step back from here
+    bool valid;
+
+    uint8_t scratch[REWIND_MAX_DELTA];
+};
+
+rewindBuffer* CreateRewindBuffer()
+{
+    rewindBuffer* history = calloc(1, sizeof(rewindBuffer));
+    history->buffer = malloc(REWIND_BUFFER_SIZE);
+    return history;
+}
+
+void FreeRewindBuffer(rewindBuffer* history)
+{
+    free(history->buffer);
+    free(history);
+}
+
+// Delta format: repeated [uint16_t unchanged bytes][uint16_t changed bytes][changed bytes XORed]
+static uint32_t EncodeDelta(const uint8_t* a, const uint8_t* b, uint32_t size, uint8_t* out)
+{
+    uint32_t length = 0;
+    uint32_t i = 0;
+    while (i < size)
+    {
+        uint32_t same = i;
+        while (same < size && same - i < 0xFFFF && a[same] == b[same]) same++;
+        uint32_t changed = same;
+        while (changed < size && changed - same < 0xFFFF && a[changed] != b[changed]) changed++;
+
+        uint16_t counts[2] = { same - i, changed - same };
+        memcpy(out + length, counts, sizeof(counts));
+        length += sizeof(counts);
+        for (uint32_t j=same; j<changed; j++) out[length++] = a[j] ^ b[j];
+        i = changed;
+    }
+    return length;
+}
+
+static void ApplyDelta(uint8_t* state, const uint8_t* delta, uint32_t length)
+{
+    uint32_t i = 0;
+    uint32_t position = 0;
+    while (i < length)
+    {
+        uint16_t counts[2];
+        memcpy(counts, delta + i, sizeof(counts));
+        i += sizeof(counts);
+        position += counts[0];
+        for (int j=0; j<counts[1]; j++) state[position++] ^= delta[i++];
+    }
+}
+
+static void RingWrite(rewindBuffer* history, uint64_t offset, const void* data, uint32_t size)
+{
+    uint32_t start = offset & REWIND_BUFFER_MASK;
+    uint32_t first = (start + size > REWIND_BUFFER_SIZE) ? REWIND_BUFFER_SIZE - start : size;
+    memcpy(history->buffer + start, data, first);
+    memcpy(history->buffer, (const uint8_t*)data + first, size - first);
+}
+
+static void RingRead(const rewindBuffer* history, uint64_t offset, void* data, uint32_t size)
+{
+    uint32_t start = offset & REWIND_BUFFER_MASK;
+    uint32_t first = (start + size > REWIND_BUFFER_SIZE) ? REWIND_BUFFER_SIZE - start : size;
+    memcpy(data, history->buffer + start, first);
+    memcpy((uint8_t*)data + first, history->buffer, size - first);
+}
+
+// Records the current frame
+void RewindPush(rewindBuffer* history, const chip8* cpu)
+{
+    machineState state;
+    CaptureState(cpu, &state);
+    if (!history->valid)
+    {
+        history->current = state;
+        history->valid = true;
+        return;
+    }
+
+    uint32_t size = EncodeDelta((uint8_t*)&state, (uint8_t*)&history->current, sizeof(machineState), history->scratch);
+    uint32_t entrySize = size + 2*sizeof(uint32_t);
+
+    // Drop the oldest frames until the new one fits
+    while (history->head + entrySize - history->tail > REWIND_BUFFER_SIZE)
+    {
+        uint32_t oldest;
+        RingRead(history, history->tail, &oldest, sizeof(oldest));
+        history->tail += oldest + 2*sizeof(uint32_t);
+        history->frames--;
+    }
+
+    RingWrite(history, history->head, &size, sizeof(size));
+    RingWrite(history, history->head + sizeof(size), history->scratch, size);
+    RingWrite(history, history->head + sizeof(size) + size, &size, sizeof(size));
+    history->head += entrySize;
+    history->frames++;
+    history->current = state;
+}
+
+// Steps the machine back one recorded frame, returns false when there is no history left
+bool RewindStep(rewindBuffer* history, chip8* cpu)
+{
+    if (history->head == history->tail) return false;
+
+    uint32_t size;
+    RingRead(history, history->head - sizeof(size), &size, sizeof(size));
+    history->head -= size + 2*sizeof(uint32_t);
+    history->frames--;
+
+    RingRead(history, history->head + sizeof(size), history->scratch, size);
+    ApplyDelta((uint8_t*)&history->current, history->scratch, size);
+    RestoreState(cpu, &history->current);
+    return true;
+}
+
+void PrintRewindStats(const rewindBuffer* history)
+{
+    printf("Rewind: %u frames (%.1fs) in %.1f KB, %.1f bytes per frame on average\n", history->frames,
+        (double)history->frames / TIMER_HZ, (history->head - history->tail) / 1024.0,
+        history->frames ? (double)(history->head - history->tail) / history->frames : 0.0);
+}
@@ -0,0 +1,381 @@
+// Ahead-of-time recompiler. Takes the basic blocks the core's ROM analysis (disasm.c) finds from 0x200 and
+// writes C source with one labelled block each, the quirks of the ROM's profile baked in. The output is a
+// core (RunAot) that links against libchip8.a together with tools/aotrun.c:
+//
+//     ./aot rom.ch8 rom_aot.c
+//     gcc -O2 rom_aot.c src/tools/aotrun.c -o rom_aot -Isrc -L. -lchip8 -lm -pthread
+//     ./rom_aot --verify --frames 600
+//
+// Control flow that can't be followed statically (00EE, BNNN, FX0A) goes back through a switch on pc, and
+// anything that isn't a known block start is run by the interpreter. Drawing, scrolling and the RNG call the
+// core's helpers for that one instruction (chip8.h), stores are written out inline, so only FX0A and invalid
+// opcodes go through EmulateCycle. A write over translated code switches the translation off for good, from
+// then on everything is interpreted. When the analysis shows no store can reach code (every store's I is
+// known and there is no BNNN) the check is left out.
+#include <time.h>
+
+#include "../chip8.h"
+#include "../opcodes.h"
+
+
+static const romAnalysis* analysis;
+static bool checkStores; // Whether a store could write over translated code
+
+static uint16_t OpcodeAt(const chip8* cpu, uint16_t address)
+{
+    return cpu->memory[address] << 8 | cpu->memory[address+1];
+}
+
+// Whether the opcode runs and goes on, 00FD stops the machine like an invalid one does
+static bool IsValid(uint16_t opcode)
+{
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            return opcode == OPCODE_CLEAR_SCREEN || opcode == OPCODE_RETURN_SUBROUTINE || opcode == OPCODE_SCROLL_RIGHT
+                || opcode == OPCODE_SCROLL_LEFT || opcode == OPCODE_LORES || opcode == OPCODE_HIRES
+                || (opcode & 0xFFF0) == OPCODE_SCROLL_DOWN || (opcode & 0xFFF0) == OPCODE_SCROLL_UP;
+        case OPCODE_ARITHMETIC: return OPCODE_N(opcode) <= 7 || OPCODE_N(opcode) == OPCODE_SHIFT_LEFT;
+        case OPCODE_F:
+            switch (OPCODE_NN(opcode))
+            {
+                case OPCODE_STORE_MEMORY: case OPCODE_LOAD_MEMORY: case OPCODE_CONVERT_DECIMAL: case OPCODE_ADD_TO_INDEX:
+                case OPCODE_GET_DELAY_TIMER: case OPCODE_SET_DELAY_TIMER: case OPCODE_SET_SOUND_TIMER: case OPCODE_AWAIT_KEY:
+                case OPCODE_FONT_CHARACTER: case OPCODE_BIG_FONT_CHARACTER: case OPCODE_SELECT_PLANES:
+                    return true;
+            }
+            return false;
+    }
+    return true;
+}
+
+static bool IsKeySkip(uint16_t opcode)
+{
+    return (opcode & 0xF000) == OPCODE_KEY_SKIP && (OPCODE_NN(opcode) == OPCODE_SKIP_IF_KEY || OPCODE_NN(opcode) == OPCODE_SKIP_IF_NOT_KEY);
+}
+
+static bool IsSkip(uint16_t opcode)
+{
+    switch (opcode & 0xF000)
+    {
+        case OPCODE_REG_IS_VALUE: case OPCODE_REG_IS_NOT_VALUE: case OPCODE_REG_IS_REG: case OPCODE_REG_IS_NOT_REG:
+            return true;
+    }
+    return IsKeySkip(opcode);
+}
+
+static bool InMemory(uint32_t address)
+{
+    return address+1 < MEMORY_SIZE;
+}
+
+static bool IsBlockStart(uint32_t address)
+{
+    return InMemory(address) && (analysis->flags[address] & (ANALYSIS_BLOCK_START | ANALYSIS_CODE)) == (ANALYSIS_BLOCK_START | ANALYSIS_CODE);
+}
+
+// Goes on to a static successor, straight into its block when there is one
+static void EmitGoto(FILE* out, uint16_t target, int count, uint16_t opcode)
+{
+    if (IsBlockStart(target)) fprintf(out, "CHAIN(b_%03x, %d, 0x%04x);", target, count, opcode);
+    else fprintf(out, "EXIT(0x%03x, %d, 0x%04x);", target, count, opcode);
+}
+
+// FX33 and FX55 with the profile's quirks. With checked stores, one that writes over translated code leaves
+// the block right after it, the dispatch then runs everything on the interpreter.
+static void EmitStore(FILE* out, uint16_t address, uint16_t opcode, int count, uint32_t quirks)
+{
+    uint8_t x = OPCODE_X(opcode);
+    int length = (OPCODE_NN(opcode) == OPCODE_STORE_MEMORY) ? x+1 : 3;
+    fprintf(out, "{\n");
+    if (checkStores) fprintf(out, "        bool toCode = WritesCode(cpu, %d);\n", length);
+    fprintf(out, "        uint16_t start = cpu->I;\n        ");
+    if (OPCODE_NN(opcode) == OPCODE_CONVERT_DECIMAL)
+    {
+        fprintf(out, "uint8_t value = V[0x%x]; Store(cpu, start, value / 100); Store(cpu, start + 1u, value / 10 %% 10); Store(cpu, start + 2u, value %% 10);\n", x);
+    }
+    else
+    {
+        for (int i=0; i<=x; i++) fprintf(out, "%sStore(cpu, (uint16_t)(start + %d), V[0x%x]);", i ? " " : "", i, i);
+        fprintf(out, "\n");
+        if (quirks & QUIRK_MEMORY_INCREMENT) fprintf(out, "        cpu->I += %d;\n", length);
+    }
+    fprintf(out, "        MemoryWritten(cpu, start, %d);\n", length);
+    if (checkStores) fprintf(out, "        if (toCode) { codeWritten = true; EXIT(0x%03x, %d, 0x%04x); }\n", address+2, count, opcode);
+    fprintf(out, "    }\n");
+}
+
+// One instruction of a block, `count` is the number of the block's instructions done after it
+static void EmitInstruction(FILE* out, uint16_t address, uint16_t opcode, int count, uint32_t quirks)
+{
+    uint8_t x = OPCODE_X(opcode);
+    uint8_t y = OPCODE_Y(opcode);
+    uint8_t nn = OPCODE_NN(opcode);
+    uint16_t nnn = OPCODE_NNN(opcode);
+
+    char text[32];
+    FormatMnemonic(opcode, text, sizeof(text));
+    fprintf(out, "    // %03x: %04x %s\n    ", address, opcode, text);
+
+    if (!IsValid(opcode))
+    {
+        fprintf(out, "INTERPRET(0x%03x); return done + %d;\n", address, count);
+        return;
+    }
+
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            if (opcode == OPCODE_CLEAR_SCREEN) fprintf(out, "ExecuteClear(cpu);\n");
+            else if (opcode == OPCODE_SCROLL_RIGHT || opcode == OPCODE_SCROLL_LEFT) fprintf(out, "ExecuteScroll(cpu, %d, 0);\n", (opcode == OPCODE_SCROLL_RIGHT) ? 4 : -4);
+            else if (opcode == OPCODE_LORES || opcode == OPCODE_HIRES) fprintf(out, "ExecuteResolution(cpu, %s);\n", (opcode == OPCODE_HIRES) ? "true" : "false");
+            else if (opcode != OPCODE_RETURN_SUBROUTINE) fprintf(out, "ExecuteScroll(cpu, 0, %d);\n", ((opcode & 0xFFF0) == OPCODE_SCROLL_UP) ? -OPCODE_N(opcode) : OPCODE_N(opcode));
+            else fprintf(out, "if (cpu->sp == 0) { INTERPRET(0x%03x); done += %d; goto dispatch; }\n"
+                "    cpu->sp--;\n    EXIT(cpu->stack[cpu->sp], %d, 0x%04x);\n", address, count, count, opcode);
+            return;
+
+        case OPCODE_JUMP: EmitGoto(out, nnn, count, opcode); fprintf(out, "\n"); return;
+
+        case OPCODE_CALL_SUBROUTINE:
+            fprintf(out, "if (cpu->sp >= 16) { INTERPRET(0x%03x); return done + %d; }\n", address, count);
+            fprintf(out, "    cpu->stack[cpu->sp++] = 0x%03x;\n    ", address+2);
+            EmitGoto(out, nnn, count, opcode);
+            fprintf(out, "\n");
+            return;
+
+        case OPCODE_REG_IS_VALUE: fprintf(out, "if (V[0x%x] == 0x%02x) ", x, nn); break;
+        case OPCODE_REG_IS_NOT_VALUE: fprintf(out, "if (V[0x%x] != 0x%02x) ", x, nn); break;
+        case OPCODE_REG_IS_REG: fprintf(out, "if (V[0x%x] == V[0x%x]) ", x, y); break;
+        case OPCODE_REG_IS_NOT_REG: fprintf(out, "if (V[0x%x] != V[0x%x]) ", x, y); break;
+        case OPCODE_SET_REG: fprintf(out, "V[0x%x] = 0x%02x;\n", x, nn); return;
+        case OPCODE_ADD_TO_REG: fprintf(out, "V[0x%x] += 0x%02x;\n", x, nn); return;
+        case OPCODE_SET_INDEX_REG: fprintf(out, "cpu->I = 0x%03x;\n", nnn); return;
+        case OPCODE_RANDOM: fprintf(out, "V[0x%x] = ExecuteRandom(cpu, 0x%02x);\n", x, nn); return;
+        case OPCODE_DISPLAY: fprintf(out, "ExecuteDraw(cpu, 0x%x, 0x%x, %d);\n", x, y, OPCODE_N(opcode)); return;
+
+        case OPCODE_JUMP_OFFSET:
+            fprintf(out, "EXIT(0x%03x + V[0x%x], %d, 0x%04x);\n", nnn, (quirks & QUIRK_JUMP_VX) ? x : 0, count, opcode);
+            return;
+
+        case OPCODE_ARITHMETIC:
+            switch (OPCODE_N(opcode))
+            {
+                case OPCODE_SET: fprintf(out, "V[0x%x] = V[0x%x];\n", x, y); return;
+                case OPCODE_BINARY_OR: fprintf(out, "V[0x%x] |= V[0x%x];", x, y); break;
+                case OPCODE_BINARY_AND: fprintf(out, "V[0x%x] &= V[0x%x];", x, y); break;
+                case OPCODE_LOGICAL_XOR: fprintf(out, "V[0x%x] ^= V[0x%x];", x, y); break;
+                case OPCODE_ADD: fprintf(out, "{ int sum = V[0x%x] + V[0x%x]; V[0x%x] = sum; V[0xF] = sum > 255; }\n", x, y, x); return;
+                case OPCODE_SUBTRACT_XY: fprintf(out, "{ uint8_t vX = V[0x%x], vY = V[0x%x]; V[0x%x] = vX - vY; V[0xF] = vX >= vY; }\n", x, y, x); return;
+                case OPCODE_SUBTRACT_YX: fprintf(out, "{ uint8_t vX = V[0x%x], vY = V[0x%x]; V[0x%x] = vY - vX; V[0xF] = vY >= vX; }\n", x, y, x); return;
+
+                case OPCODE_SHIFT_RIGHT:
+                case OPCODE_SHIFT_LEFT:
+                {
+                    bool right = OPCODE_N(opcode) == OPCODE_SHIFT_RIGHT;
+                    uint8_t source = (quirks & QUIRK_SHIFT_VY) ? y : x;
+                    fprintf(out, "{ uint8_t value = V[0x%x]; V[0x%x] = value %s 1; V[0xF] = value %s; }\n",
+                        source, x, right ? ">>" : "<<", right ? "& 1" : ">> 7");
+                } return;
+            }
+            fprintf(out, (quirks & QUIRK_VF_RESET) ? " V[0xF] = 0;\n" : "\n"); // OR, AND and XOR
+            return;
+
+        case OPCODE_KEY_SKIP:
+            if (OPCODE_NN(opcode) == OPCODE_SKIP_IF_KEY) fprintf(out, "if ((cpu->keypad >> (V[0x%x] & 0xF)) & 1) ", x);
+            else if (OPCODE_NN(opcode) == OPCODE_SKIP_IF_NOT_KEY) fprintf(out, "if (!((cpu->keypad >> (V[0x%x] & 0xF)) & 1)) ", x);
+            else fprintf(out, "// Ignored like the interpreter does\n");
+            break;
+
+        case OPCODE_F:
+            switch (OPCODE_NN(opcode))
+            {
+                case OPCODE_GET_DELAY_TIMER: fprintf(out, "V[0x%x] = cpu->delayTimer;\n", x); return;
+                case OPCODE_SET_DELAY_TIMER: fprintf(out, "cpu->delayTimer = V[0x%x];\n", x); return;
+                case OPCODE_SET_SOUND_TIMER: fprintf(out, "cpu->soundTimer = V[0x%x];\n", x); return;
+                case OPCODE_ADD_TO_INDEX: fprintf(out, "cpu->I += V[0x%x];\n", x); return;
+                case OPCODE_FONT_CHARACTER: fprintf(out, "cpu->I = (V[0x%x] & 0x0F) * 5;\n", x); return;
+                case OPCODE_BIG_FONT_CHARACTER: fprintf(out, "cpu->I = %d + (V[0x%x] & 0x0F) * 10;\n", BIG_FONT_START, x); return;
+                case OPCODE_SELECT_PLANES: fprintf(out, "cpu->planeMask = 0x%x;\n", x & ((1 << DISPLAY_PLANES) - 1)); return;
+                case OPCODE_AWAIT_KEY: fprintf(out, "INTERPRET(0x%03x); done += %d; goto dispatch;\n", address, count); return;
+
+                case OPCODE_CONVERT_DECIMAL: case OPCODE_STORE_MEMORY: EmitStore(out, address, opcode, count, quirks); return;
+
+                case OPCODE_LOAD_MEMORY:
+                    for (int i=0; i<=x; i++)
+                    {
+                        if (quirks & QUIRK_MEMORY_INCREMENT) fprintf(out, "%sV[0x%x] = Load(cpu, cpu->I++);", i ? " " : "", i);
+                        else fprintf(out, "%sV[0x%x] = Load(cpu, (uint16_t)(cpu->I + %d));", i ? " " : "", i, i);
+                    }
+                    fprintf(out, "\n");
+                    return;
+            }
+            return;
+    }
+
+    // The skips, the condition is already written
+    if (IsSkip(opcode))
+    {
+        EmitGoto(out, address+4, count, opcode);
+        fprintf(out, "\n    ");
+        EmitGoto(out, address+2, count, opcode);
+    }
+    fprintf(out, "\n");
+}
+
+static void EmitBlock(FILE* out, const chip8* cpu, const analysisBlock* b)
+{
+    int length = (b->end - b->start) / 2;
+    fprintf(out, "b_%03x:\n", b->start);
+    fprintf(out, "    if (cycles - done < %d) { cpu->pc = 0x%03x; goto step; }\n", length, b->start);
+    for (int i=1; i<=length; i++)
+    {
+        uint16_t address = b->start + (i-1)*2;
+        EmitInstruction(out, address, OpcodeAt(cpu, address), i, cpu->profile->quirks);
+    }
+
+    // Ran into the next block, or off the end of memory
+    if (b->fallsThrough)
+    {
+        fprintf(out, "    ");
+        EmitGoto(out, b->end, length, OpcodeAt(cpu, b->end - 2));
+        fprintf(out, "\n");
+    }
+    fprintf(out, "\n");
+}
+
+static const char* prelude =
+    "// Generated by tools/aot.c, link with tools/aotrun.c and libchip8.a\n"
+    "#include \"chip8.h\"\n"
+    "\n"
+    "#define V cpu->V\n"
+    "#define EXIT(next, count, last) do { cpu->pc = (next); cpu->opcode = (last); done += (count); goto dispatch; } while (0)\n"
+    "#define CHAIN(label, count, last) do { cpu->opcode = (last); done += (count); goto label; } while (0)\n"
+    "#define INTERPRET(address) do { cpu->pc = (address); EmulateCycle(cpu); } while (0)\n"
+    "\n"
+    "// Loads past the end of memory read zeros and stores there are dropped, like the cores\n"
+    "static inline uint8_t Load(const chip8* cpu, uint32_t address) { return (address < MEMORY_SIZE) ? cpu->memory[address] : 0; }\n"
+    "static inline void Store(chip8* cpu, uint32_t address, uint8_t value) { if (address < MEMORY_SIZE) cpu->memory[address] = value; }\n"
+    "\n";
+
+
+int main(int argc, char* args[])
+{
+    char* romPath = NULL;
+    char* outPath = NULL;
+    char* profileName = NULL; // Detected from the ROM when not given
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(args[i], "--profile") && i+1 < argc) profileName = args[++i];
+        else if (romPath == NULL) romPath = args[i];
+        else if (outPath == NULL) outPath = args[i];
+        else printf("[WARNING]: Too many arguments. Ignoring '%s'.\n", args[i]);
+    }
+
+    if (romPath == NULL || outPath == NULL)
+    {
+        printf("Usage: %s [--profile name] rom.ch8 out.c\n", args[0]);
+        return -1;
+    }
+
+    // The machine is only used to load the ROM and pick its profile the way the emulator would
+    chip8* cpu = CreateMachine(&cores[0]);
+    if (!LoadRom(cpu, romPath)) return -1;
+    if (profileName != NULL)
+    {
+        const profile* quirkProfile = FindProfile(profileName);
+        if (quirkProfile == NULL)
+        {
+            printf("[ERROR]: Unknown profile '%s'.\n", profileName);
+            return -1;
+        }
+        SetProfile(cpu, quirkProfile);
+    }
+
+    analysis = AnalyzeRom(cpu);
+    checkStores = analysis->unknownWrites || analysis->codeWrites || analysis->indirectJumps;
+
+    FILE* out = fopen(outPath, "w");
+    if (out == NULL)
+    {
+        printf("[ERROR]: Failed to open output file: '%s'\n", outPath);
+        return -1;
+    }
+
+    fprintf(out, "%s", prelude);
+    if (checkStores) fprintf(out, "static bool codeWritten; // Process wide, aotrun.c only ever runs one translated machine\n\n");
+
+    // The ROM goes along so the program doesn't need the file, and the hash lets aotrun.c check it
+    uint32_t romSize = 0;
+    for (uint32_t i=0x200; i<MEMORY_SIZE; i++)
+    {
+        if (cpu->memory[i]) romSize = i+1 - 0x200;
+    }
+    fprintf(out, "const char* aotProfile = \"%s\";\nconst uint64_t aotRomHash = 0x%016lx;\n", cpu->profile->name, cpu->romHash);
+    fprintf(out, "const uint32_t aotRomSize = %u;\nconst uint8_t aotRom[] = {", romSize);
+    for (uint32_t i=0; i<romSize; i++) fprintf(out, "%s0x%02x,", (i % 16) ? " " : "\n    ", cpu->memory[0x200+i]);
+    fprintf(out, "\n};\n\n");
+
+    if (checkStores)
+    {
+        fprintf(out, "// Bytes that belong to translated instructions\nstatic const uint8_t code[%d] = {", MEMORY_SIZE);
+        for (uint32_t i=0; i<MEMORY_SIZE; i++) fprintf(out, "%s%d,", (i % 32) ? "" : "\n    ", (analysis->flags[i] & ANALYSIS_CODE_BYTE) != 0);
+        fprintf(out, "\n};\n\n");
+
+        fprintf(out,
+            "static bool WritesCode(const chip8* cpu, uint16_t length)\n"
+            "{\n"
+            "    for (uint32_t i=cpu->I; i<(uint32_t)cpu->I+length && i<sizeof(code); i++)\n"
+            "    {\n"
+            "        if (code[i]) return true;\n"
+            "    }\n"
+            "    return false;\n"
+            "}\n"
+            "\n"
+            "// The store the interpreter is about to run at pc, if any\n"
+            "static void CheckStore(const chip8* cpu)\n"
+            "{\n"
+            "    if (cpu->pc+1 >= sizeof(code)) return;\n"
+            "    uint16_t opcode = cpu->memory[cpu->pc] << 8 | cpu->memory[cpu->pc+1];\n"
+            "    if ((opcode & 0xF0FF) == 0xF033 && WritesCode(cpu, 3)) codeWritten = true;\n"
+            "    if ((opcode & 0xF0FF) == 0xF055 && WritesCode(cpu, ((opcode >> 8) & 0xF) + 1)) codeWritten = true;\n"
+            "}\n"
+            "\n");
+    }
+
+    fprintf(out,
+        "uint64_t RunAot(chip8* cpu, uint64_t cycles)\n"
+        "{\n"
+        "    uint64_t done = 0;\n"
+        "\n"
+        "dispatch:\n"
+        "    %s\n"
+        "    {\n"
+        "        switch (cpu->pc)\n"
+        "        {\n", checkStores ? "if (!codeWritten)" : "// Every store was checked at translation time");
+
+    for (uint32_t i=0; i<analysis->blockCount; i++) fprintf(out, "            case 0x%03x: goto b_%03x;\n", analysis->blocks[i].start, analysis->blocks[i].start);
+
+    fprintf(out,
+        "        }\n"
+        "    }\n"
+        "\n"
+        "    // Not the start of a block, or no room for a whole one in this slice\n"
+        "step:\n"
+        "    if (done == cycles) return done;\n"
+        "%s"
+        "    EmulateCycle(cpu);\n"
+        "    done++;\n"
+        "    if (cpu->halted) return done;\n"
+        "    goto dispatch;\n"
+        "\n", checkStores ? "    CheckStore(cpu);\n" : "");
+
+    for (uint32_t i=0; i<analysis->blockCount; i++) EmitBlock(out, cpu, &analysis->blocks[i]);
+    fprintf(out, "}\n");
+    fclose(out);
+
+    printf("Translated %u instructions in %u blocks with the %s profile to '%s'%s\n", analysis->instructions, analysis->blockCount,
+        cpu->profile->name, outPath, checkStores ? ", stores are checked for writes to code" : "");
+    FreeAnalysis((romAnalysis*)analysis);
+    DestroyMachine(cpu);
+    return 0;
+}
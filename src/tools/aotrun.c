@@ -0,0 +1,113 @@
+// Runner for ROMs translated by tools/aot.c, built together with the generated file. Runs the translated
+// core like the headless runner does, or with --verify next to the switch core frame by frame, comparing
+// framebuffer hashes and registers after every frame.
+#include <time.h>
+
+#include "../chip8.h"
+
+// Defined by the generated file
+extern const char* aotProfile;
+extern const uint64_t aotRomHash;
+extern const uint32_t aotRomSize;
+extern const uint8_t aotRom[];
+uint64_t RunAot(chip8* cpu, uint64_t cycles);
+
+static const core aotCore = { "aot", RunAot };
+
+static double Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static chip8* CreateTranslatedMachine(const core* cpuCore, uint64_t seed, uint32_t clockHz)
+{
+    chip8* cpu = CreateMachine(cpuCore);
+    memcpy(&cpu->memory[0x200], aotRom, aotRomSize);
+    cpu->romHash = aotRomHash;
+    SetProfile(cpu, FindProfile(aotProfile));
+    cpu->clockHz = clockHz;
+    SeedRandom(cpu, seed);
+    return cpu;
+}
+
+static bool SameState(const chip8* a, const chip8* b)
+{
+    return a->pc == b->pc && a->I == b->I && a->sp == b->sp && !memcmp(a->V, b->V, 16)
+        && !memcmp(a->stack, b->stack, sizeof(a->stack)) && a->delayTimer == b->delayTimer
+        && a->soundTimer == b->soundTimer && HashDisplay(a) == HashDisplay(b);
+}
+
+static void PrintState(const char* name, const chip8* cpu)
+{
+    printf("  %-6s pc: %03x I: %03x sp: %x display hash: %016lx\n         V:", name, cpu->pc, cpu->I, cpu->sp, HashDisplay(cpu));
+    for (int i=0; i<16; i++) printf(" %02x", cpu->V[i]);
+    printf("\n");
+}
+
+int main(int argc, char* args[])
+{
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    uint64_t seed = time(NULL);
+    uint32_t clockHz = CLOCK_HZ;
+    bool verify = false;
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(args[i], "--cycles") && i+1 < argc) cycles = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--frames") && i+1 < argc) frames = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--ips") && i+1 < argc) clockHz = strtoul(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--seed") && i+1 < argc) seed = strtoull(args[++i], NULL, 10);
+        else if (!strcmp(args[i], "--verify")) verify = true;
+        else printf("[WARNING]: Unknown argument. Ignoring '%s'.\n", args[i]);
+    }
+
+    if ((cycles == 0 && frames == 0) || (verify && frames == 0) || clockHz == 0)
+    {
+        printf("Usage: %s [--ips n] [--seed n] (--cycles n | --frames n | --verify --frames n)\n", args[0]);
+        return -1;
+    }
+
+    chip8* cpu = CreateTranslatedMachine(&aotCore, seed, clockHz);
+    if (!verify)
+    {
+        double start = Now();
+        uint64_t done = frames ? ExecuteFrames(cpu, frames) : ExecuteCycles(cpu, cycles);
+        double seconds = Now() - start;
+        printf("aot core, %s profile: %lu instructions in %.3fs (%.2f M instructions/sec)\n", aotProfile, done, seconds, done / seconds / 1e6);
+        printf("pc: %03x I: %03x display hash: %016lx\n", cpu->pc, cpu->I, HashDisplay(cpu));
+        DestroyMachine(cpu);
+        return 0;
+    }
+
+    chip8* reference = CreateTranslatedMachine(&cores[0], seed, clockHz);
+    double aotSeconds = 0;
+    double referenceSeconds = 0;
+    uint64_t done = 0;
+    uint64_t verified = 0;
+    for (uint64_t frame=1; frame<=frames && !cpu->halted; frame++)
+    {
+        double start = Now();
+        done += ExecuteFrames(cpu, 1);
+        double middle = Now();
+        ExecuteFrames(reference, 1);
+        aotSeconds += middle - start;
+        referenceSeconds += Now() - middle;
+
+        if (!SameState(cpu, reference) || cpu->halted != reference->halted)
+        {
+            printf("[ERROR]: The translation diverged from the switch core in frame %lu (cycle %lu):\n", frame, reference->cycles);
+            PrintState("aot", cpu);
+            PrintState("switch", reference);
+            return 1;
+        }
+        verified++;
+    }
+
+    printf("Verified %lu frames (%lu instructions) against the switch core, the translation was %.2fx as fast\n",
+        verified, done, aotSeconds > 0 ? referenceSeconds / aotSeconds : 0.0);
+    DestroyMachine(reference);
+    DestroyMachine(cpu);
+    return 0;
+}
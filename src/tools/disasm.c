@@ -0,0 +1,137 @@
+// Disassembler over the core's ROM analysis (disasm.c in the library). Lists a ROM with its blocks,
+// subroutines, data and the bytes stores can write, or with --summary just the numbers for each ROM.
+#include <time.h>
+
+#include "../chip8.h"
+
+
+static double Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void PrintListing(const chip8* cpu, const romAnalysis* a)
+{
+    // Up to the last byte of the ROM or of the code, whichever is further
+    uint32_t end = 0x200;
+    for (uint32_t i=0x200; i<MEMORY_SIZE; i++)
+    {
+        if (cpu->memory[i] || (a->flags[i] & ANALYSIS_CODE_BYTE)) end = i+1;
+    }
+
+    uint32_t address = 0x200;
+    while (address < end)
+    {
+        uint8_t flags = a->flags[address];
+        if (flags & ANALYSIS_CODE)
+        {
+            if (flags & ANALYSIS_CALL_TARGET) printf("\nsub_%03x:\n", address);
+            else if (flags & ANALYSIS_BLOCK_START) printf("\nL_%03x:\n", address);
+
+            uint16_t opcode = cpu->memory[address] << 8 | cpu->memory[address+1];
+            char text[32];
+            FormatMnemonic(opcode, text, sizeof(text));
+            uint8_t both = flags | a->flags[address+1];
+            if (both & (ANALYSIS_WRITTEN | ANALYSIS_DATA)) printf("    %03x  %04x  %-20s", address, opcode, text);
+            else printf("    %03x  %04x  %s", address, opcode, text);
+            if (both & ANALYSIS_WRITTEN) printf(" ; written by a store");
+            if (both & ANALYSIS_DATA) printf(" ; read as data");
+            printf("\n");
+            address += 2;
+            continue;
+        }
+
+        // Bytes no instruction starts at, eight to a line and never across an instruction
+        printf("    %03x  db", address);
+        uint8_t kinds = 0;
+        for (int i=0; i<8 && address < end && !(a->flags[address] & ANALYSIS_CODE); i++, address++)
+        {
+            printf(" %02x", cpu->memory[address]);
+            kinds |= a->flags[address];
+        }
+        if (kinds & ANALYSIS_DATA) printf(" ; data");
+        if (kinds & ANALYSIS_WRITTEN) printf(" ; written");
+        printf("\n");
+    }
+}
+
+static void PrintBlocks(const romAnalysis* a)
+{
+    for (uint32_t i=0; i<a->blockCount; i++)
+    {
+        const analysisBlock* b = &a->blocks[i];
+        printf("block %03x-%03x ->", b->start, b->end);
+        for (int s=0; s<b->successorCount; s++) printf(" %03x", b->successors[s]);
+        if (b->dynamic) printf(" (and dynamic)");
+        if (b->fallsThrough) printf(" (falls through)");
+        printf("\n");
+    }
+}
+
+static void PrintSummary(const char* path, const romAnalysis* a, double seconds)
+{
+    uint32_t subroutines = 0, data = 0, written = 0;
+    for (uint32_t i=0; i<MEMORY_SIZE; i++)
+    {
+        subroutines += (a->flags[i] & ANALYSIS_CALL_TARGET) != 0;
+        data += (a->flags[i] & ANALYSIS_DATA) != 0;
+        written += (a->flags[i] & ANALYSIS_WRITTEN) != 0;
+    }
+    printf("%s: %u instructions in %u blocks, %u subroutines, %u data bytes, %u written bytes (%u on code), "
+        "%u stores with an unknown I, %u indirect jumps, %.3fms\n", path, a->instructions, a->blockCount, subroutines, data,
+        written, a->codeWrites, a->unknownWrites, a->indirectJumps, seconds * 1000);
+}
+
+int main(int argc, char* args[])
+{
+    char* profileName = NULL; // Detected from each ROM when not given
+    bool blocks = false;
+    bool summary = false;
+    int first = argc;
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(args[i], "--profile") && i+1 < argc) profileName = args[++i];
+        else if (!strcmp(args[i], "--blocks")) blocks = true;
+        else if (!strcmp(args[i], "--summary")) summary = true;
+        else
+        {
+            first = i;
+            break;
+        }
+    }
+
+    if (first == argc)
+    {
+        printf("Usage: %s [--profile name] [--blocks] [--summary] rom.ch8...\n", args[0]);
+        return -1;
+    }
+    const profile* quirkProfile = (profileName != NULL) ? FindProfile(profileName) : NULL;
+    if (profileName != NULL && quirkProfile == NULL)
+    {
+        printf("[ERROR]: Unknown profile '%s'.\n", profileName);
+        return -1;
+    }
+
+    double total = 0;
+    for (int i=first; i<argc; i++)
+    {
+        chip8* cpu = CreateMachine(&cores[0]);
+        if (!LoadRom(cpu, args[i])) return -1;
+        if (quirkProfile != NULL) SetProfile(cpu, quirkProfile);
+
+        double start = Now();
+        romAnalysis* a = AnalyzeRom(cpu);
+        double seconds = Now() - start;
+        total += seconds;
+
+        if (!summary) PrintListing(cpu, a);
+        if (blocks) PrintBlocks(a);
+        PrintSummary(args[i], a, seconds);
+        FreeAnalysis(a);
+        DestroyMachine(cpu);
+    }
+    if (argc - first > 1) printf("Analyzed %d ROMs in %.3fms\n", argc - first, total * 1000);
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Times the display filters (filters.c) at 1080p and 4K: runs a ROM for a few seconds, then renders every
+// frame it drew through each filter into a buffer of each size and reports the time per frame, once with
+// AVX2 and once with SSE2. Every frame is rendered whole, the frontend only renders the rows that changed.
+#include <time.h>
+
+#include "../chip8.h"
+#include "../filters.c"
+
+#define BENCH_FRAMES 600
+
+static double Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char* args[])
+{
+    if (argc < 2)
+    {
+        printf("[ERROR]: Not enough arguments.\n");
+        printf("Usage: %s rom.ch8\n", args[0]);
+        return -1;
+    }
+
+    chip8* cpu = CreateMachine(FindCore("switch"));
+    if (!LoadRom(cpu, args[1])) return -1;
+    SeedRandom(cpu, 1);
+    framebuffer* frames = malloc(BENCH_FRAMES * sizeof(*frames));
+    for (int i=0; i<BENCH_FRAMES; i++)
+    {
+        ExecuteFrames(cpu, 1);
+        frames[i] = *ReadFramebuffer(cpu);
+    }
+    DestroyMachine(cpu);
+
+    const char* filters[] = { "none", "scanlines", "phosphor", "scale2x", "scale3x", "phosphor,scale3x,scanlines" };
+    const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    for (int s=0; s<2; s++)
+    {
+        int width = sizes[s][0], height = sizes[s][1];
+        uint32_t* pixels = malloc((size_t)width * height * sizeof(uint32_t));
+        printf("%dx%d, ms per frame:\n", width, height);
+        printf("    %-28s %8s %8s\n", "filter", "avx2", "sse2");
+        for (size_t i=0; i<sizeof(filters)/sizeof(filters[0]); i++)
+        {
+            double ms[2] = { -1, -1 };
+            for (int path=0; path<2; path++)
+            {
+                displayFilter* f = CreateFilter(filters[i], width, height);
+                if (f == NULL) return -1;
+                if (path == 0 && !f->avx2)
+                {
+                    FreeFilter(f);
+                    continue;
+                }
+                f->avx2 = path == 0;
+
+                double start = Now();
+                for (int frame=0; frame<BENCH_FRAMES; frame++)
+                {
+                    FilterFrame(f, &frames[frame], ~0ull);
+                    FilterRender(f, pixels, width * sizeof(uint32_t), 0, height);
+                }
+                ms[path] = (Now() - start) * 1000 / BENCH_FRAMES;
+                FreeFilter(f);
+            }
+            printf("    %-28s ", filters[i]);
+            for (int path=0; path<2; path++)
+            {
+                if (ms[path] < 0) printf("%8s ", "-");
+                else printf("%8.3f ", ms[path]);
+            }
+            printf("\n");
+        }
+        free(pixels);
+    }
+    free(frames);
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Decodes a binary trace written with --trace back into the emulator's mnemonic text
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../opcodes.h"
+#include "../trace.h"
+#include "../mnemonic.c"
+
+int main(int argc, char* args[])
+{
+    char* path = NULL;
+    int showRegisters = 0;
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(args[i], "-r")) showRegisters = 1;
+        else path = args[i];
+    }
+
+    if (path == NULL)
+    {
+        printf("Usage: %s [-r] file.trace\n", args[0]);
+        return -1;
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("[ERROR]: Failed to open file: '%s'\n", path);
+        return -1;
+    }
+
+    traceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)))
+    {
+        printf("[ERROR]: '%s' is not a trace file.\n", path);
+        fclose(file);
+        return -1;
+    }
+    if (header.version != TRACE_VERSION || header.recordSize != sizeof(traceRecord))
+    {
+        printf("[ERROR]: Unsupported trace version %u (record size %u).\n", header.version, header.recordSize);
+        fclose(file);
+        return -1;
+    }
+
+    traceRecord records[4096];
+    size_t count;
+    char text[32];
+    while ((count = fread(records, sizeof(traceRecord), 4096, file)) > 0)
+    {
+        for (size_t r=0; r<count; r++)
+        {
+            FormatMnemonic(records[r].opcode, text, sizeof(text));
+            printf("[0x%08x] %04x | %s", records[r].pc, records[r].opcode, text);
+
+            if (showRegisters)
+            {
+                for (int i=0; i<16; i++)
+                {
+                    if (records[r].changed & (1 << i)) printf(" V%X=%02x", i, records[r].V[i]);
+                }
+                printf(" I=%03x", records[r].I);
+            }
+            printf("\n");
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
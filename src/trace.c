@@ -0,0 +1,127 @@
+// Runtime selectable instruction trace. The emulator pushes fixed size records into a lock-free
+// single producer/single consumer ring and a background thread drains it to disk, so the only
+// cost in the hot loop is a memcpy. Use tools/tracedump to turn a trace back into mnemonics.
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+#include "mnemonic.c"
+
+#define TRACE_RING_SIZE (1 << 16) // Records, must be a power of two
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+struct {
+    bool enabled;
+
+    FILE* file;
+    traceRecord* ring;
+    _Atomic uint32_t head; // Next slot the emulator writes, only advanced by the emulator
+    _Atomic uint32_t tail; // Next slot the writer drains, only advanced by the writer
+    _Atomic bool stop;
+    pthread_t writer;
+
+    uint64_t records;
+    uint64_t stalls; // Times the emulator had to wait for the writer to free up space
+} traceState;
+
+static void* TraceWriter(void* arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        uint32_t tail = atomic_load_explicit(&traceState.tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&traceState.head, memory_order_acquire);
+
+        if (head == tail)
+        {
+            if (atomic_load_explicit(&traceState.stop, memory_order_acquire))
+            {
+                // The emulator stops producing before it raises the flag, so one more look is enough
+                if (atomic_load_explicit(&traceState.head, memory_order_acquire) == tail) break;
+                continue;
+            }
+            struct timespec nap = { 0, 1000000 }; // 1ms
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        // Write the filled part of the ring, split in two if it wraps around the end
+        uint32_t start = tail & TRACE_RING_MASK;
+        uint32_t count = head - tail;
+        if (start + count > TRACE_RING_SIZE) count = TRACE_RING_SIZE - start;
+        fwrite(&traceState.ring[start], sizeof(traceRecord), count, traceState.file);
+
+        atomic_store_explicit(&traceState.tail, tail + count, memory_order_release);
+    }
+    return NULL;
+}
+
+bool TraceStart(const char* path)
+{
+    traceState.file = fopen(path, "wb");
+    if (traceState.file == NULL)
+    {
+        printf("[ERROR]: Failed to open trace file: '%s'\n", path);
+        return false;
+    }
+
+    traceHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(traceRecord) };
+    fwrite(&header, sizeof(header), 1, traceState.file);
+
+    traceState.ring = malloc(TRACE_RING_SIZE * sizeof(traceRecord));
+    atomic_store(&traceState.head, 0);
+    atomic_store(&traceState.tail, 0);
+    atomic_store(&traceState.stop, false);
+
+    if (pthread_create(&traceState.writer, NULL, TraceWriter, NULL) != 0)
+    {
+        printf("[ERROR]: Failed to start trace writer thread.\n");
+        fclose(traceState.file);
+        free(traceState.ring);
+        return false;
+    }
+
+    traceState.enabled = true;
+    return true;
+}
+
+void TraceStop()
+{
+    if (!traceState.enabled) return;
+    traceState.enabled = false;
+
+    atomic_store_explicit(&traceState.stop, true, memory_order_release);
+    pthread_join(traceState.writer, NULL);
+
+    fclose(traceState.file);
+    free(traceState.ring);
+    printf("Traced %lu instructions (%lu writer stalls)\n", traceState.records, traceState.stalls);
+}
+
+// Only ever called from the emulation thread
+void TraceRecord(uint16_t pc, uint16_t opcode, const uint8_t* before, uint16_t I, const uint8_t* V)
+{
+    uint32_t head = atomic_load_explicit(&traceState.head, memory_order_relaxed);
+
+    // The ring is full, wait for the writer instead of dropping records
+    if (head - atomic_load_explicit(&traceState.tail, memory_order_acquire) == TRACE_RING_SIZE)
+    {
+        traceState.stalls++;
+        while (head - atomic_load_explicit(&traceState.tail, memory_order_acquire) == TRACE_RING_SIZE) sched_yield();
+    }
+
+    traceRecord* record = &traceState.ring[head & TRACE_RING_MASK];
+    record->pc = pc;
+    record->opcode = opcode;
+    record->I = I;
+    record->changed = 0;
+    for (int i=0; i<16; i++)
+    {
+        if (before[i] != V[i]) record->changed |= 1 << i;
+    }
+    memcpy(record->V, V, 16);
+
+    atomic_store_explicit(&traceState.head, head + 1, memory_order_release);
+    traceState.records++;
+}
@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Trace file layout: a header followed by fixed size records, stored in host (little endian) byte order
+#define TRACE_MAGIC "C8TRACE" // 8 bytes including the terminator
+#define TRACE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+} traceHeader;
+
+typedef struct {
+    uint16_t pc; // Address the instruction was fetched from
+    uint16_t opcode;
+    uint16_t I; // Index register after the instruction
+    uint16_t changed; // Bit n is set if Vn was written with a new value
+    uint8_t V[16]; // Registers after the instruction
+} traceRecord;
+
+#endif
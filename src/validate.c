@@ -0,0 +1,127 @@
+// Differential validation. Runs a candidate core next to the switch core, whose DecodeAndExecute is the
+// reference, on two copies of the same machine fed the same keys, and compares them every `every`
+// instructions: registers, stack, timers and the display. With every > 1 a mismatch is narrowed down by
+// going back to the last states that agreed and stepping both one instruction at a time from there.
+// The reference runs every instruction of its wait loops, so the candidate's idle-loop skipping is checked too.
+
+static bool SameMachine(const chip8* a, const chip8* b)
+{
+    return a->pc == b->pc && a->I == b->I && a->sp == b->sp && !memcmp(a->V, b->V, 16)
+        && !memcmp(a->stack, b->stack, sizeof(a->stack)) && a->delayTimer == b->delayTimer
+        && a->soundTimer == b->soundTimer && a->halted == b->halted && a->cycles == b->cycles
+        && a->planeMask == b->planeMask && a->display.hires == b->display.hires
+        && !memcmp(a->display.planes, b->display.planes, sizeof(a->display.planes));
+}
+
+static void PrintMachineDiff(const chip8* reference, const chip8* candidate)
+{
+    printf("  %-8s %-18s %s\n", "", "reference", candidate->core->name);
+    #define PRINT_DIFF(name, a, b) if ((a) != (b)) printf("  %-8s %-18lx %lx\n", name, (uint64_t)(a), (uint64_t)(b))
+    PRINT_DIFF("pc", reference->pc, candidate->pc);
+    PRINT_DIFF("I", reference->I, candidate->I);
+    for (int i=0; i<16; i++)
+    {
+        char name[8];
+        snprintf(name, sizeof(name), "V%X", i);
+        PRINT_DIFF(name, reference->V[i], candidate->V[i]);
+    }
+    PRINT_DIFF("sp", reference->sp, candidate->sp);
+    for (int i=0; i<16; i++)
+    {
+        char name[12];
+        snprintf(name, sizeof(name), "stack[%d]", i);
+        PRINT_DIFF(name, reference->stack[i], candidate->stack[i]);
+    }
+    PRINT_DIFF("delay", reference->delayTimer, candidate->delayTimer);
+    PRINT_DIFF("sound", reference->soundTimer, candidate->soundTimer);
+    PRINT_DIFF("halted", reference->halted, candidate->halted);
+    PRINT_DIFF("planes", reference->planeMask, candidate->planeMask);
+    PRINT_DIFF("cycles", reference->cycles, candidate->cycles);
+    PRINT_DIFF("display", HashDisplay(reference), HashDisplay(candidate));
+    #undef PRINT_DIFF
+}
+
+static void PrintMismatch(const chip8* reference, const chip8* candidate, uint64_t cycle, uint16_t pc)
+{
+    uint16_t opcode = (pc+1 < sizeof(reference->memory)) ? reference->memory[pc] << 8 | reference->memory[pc+1] : 0;
+    char text[32];
+    FormatMnemonic(opcode, text, sizeof(text));
+    printf("[ERROR]: The %s core diverged from the reference at cycle %lu, running %03x: %04x %s\n", candidate->core->name, cycle, pc, opcode, text);
+    PrintMachineDiff(reference, candidate);
+}
+
+// Steps both machines from the states they last agreed in up to `cycles` instructions, one at a time,
+// and reports the first instruction after which they differ. False if they never do.
+static bool FindMismatch(chip8* reference, chip8* candidate, const machineState* good, uint16_t keys, uint64_t cycles)
+{
+    RestoreState(reference, &good[0]);
+    RestoreState(candidate, &good[1]);
+    SetKeypad(reference, keys);
+    SetKeypad(candidate, keys);
+    for (uint64_t i=0; i<cycles && !reference->halted; i++)
+    {
+        uint64_t cycle = reference->cycles;
+        uint16_t pc = reference->pc;
+        ExecuteCycles(reference, 1);
+        ExecuteCycles(candidate, 1);
+        if (!SameMachine(reference, candidate))
+        {
+            PrintMismatch(reference, candidate, cycle, pc);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ValidateCore(chip8* reference, chip8* candidate, const movie* script, uint64_t cycles, uint64_t every)
+{
+    machineState* good = (every > 1) ? malloc(2 * sizeof(machineState)) : NULL; // Last states that agreed
+    reference->noIdleSkip = true;
+    uint64_t end = reference->cycles + cycles;
+    uint32_t nextEvent = 0;
+    uint16_t keys = reference->keypad;
+    bool same = true;
+    for (;;)
+    {
+        while (script != NULL && nextEvent < script->count && script->events[nextEvent].cycle <= reference->cycles)
+        {
+            keys = script->events[nextEvent++].keys;
+            SetKeypad(reference, keys);
+            SetKeypad(candidate, keys);
+        }
+        if (reference->cycles >= end || reference->halted) break;
+
+        // Stop at the next check, or the next key change so both machines see it at the same cycle
+        uint64_t stop = reference->cycles + every;
+        if (stop > end) stop = end;
+        if (script != NULL && nextEvent < script->count && script->events[nextEvent].cycle < stop) stop = script->events[nextEvent].cycle;
+
+        if (good != NULL)
+        {
+            CaptureState(reference, &good[0]);
+            CaptureState(candidate, &good[1]);
+        }
+        uint64_t cycle = reference->cycles;
+        uint16_t pc = reference->pc;
+        ExecuteCycles(reference, stop - cycle);
+        ExecuteCycles(candidate, stop - cycle);
+        if (SameMachine(reference, candidate)) continue;
+
+        same = false;
+        if (good == NULL) PrintMismatch(reference, candidate, cycle, pc);
+        else
+        {
+            chip8 referenceAfter = *reference;
+            chip8 candidateAfter = *candidate;
+            if (!FindMismatch(reference, candidate, good, keys, stop - cycle))
+            {
+                printf("[ERROR]: The %s core diverged from the reference between cycles %lu and %lu, but not when run one instruction at a time, check its wait-loop skipping:\n",
+                    candidate->core->name, cycle, stop);
+                PrintMachineDiff(&referenceAfter, &candidateAfter);
+            }
+        }
+        break;
+    }
+    free(good);
+    return same;
+}
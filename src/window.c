@@ -1,4 +1,3 @@
-
 void InitWindow(char* title, int width, int height) // Place to toss in SDL functions
 {
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
@@ -13,23 +12,75 @@ void InitWindow(char* title, int width, int height) // Place to toss in SDL func
         printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
         exit(-1);
     }
+}
 
-    SDL_state.renderer = SDL_CreateRenderer(SDL_state.window, -1, SDL_RENDERER_PRESENTVSYNC);
-    if (SDL_state.window == NULL)
+// Called on the render thread, which then owns the renderer and texture, see render.c
+bool CreateRenderer(bool software)
+{
+    SDL_state.renderer = SDL_CreateRenderer(SDL_state.window, -1, (software) ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_PRESENTVSYNC);
+    if (SDL_state.renderer == NULL)
     {
         printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
-        exit(-1);
+        return false;
     }
 
-    SDL_state.texture = SDL_CreateTexture(SDL_state.renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    SDL_state.texture = SDL_CreateTexture(SDL_state.renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, SDL_state.width, SDL_state.height);
     if (SDL_state.texture == NULL)
     {
         printf("Texture could not be created! SDL_Error: %s\n", SDL_GetError());
-        exit(-1);
-    } 
+        SDL_DestroyRenderer(SDL_state.renderer);
+        return false;
+    }
+    return true;
+}
+
+static void AudioCallback(void* data, Uint8* stream, int length)
+{
+    AudioRender((int16_t*)stream, length / sizeof(int16_t));
+}
+
+// Plays the buzzer through the default device, `samples` per callback. Any driver works, SDL_AUDIODRIVER=disk
+// writes the samples to a file instead.
+bool OpenAudio(uint16_t samples, uint32_t clockHz)
+{
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+    {
+        printf("[WARNING]: Audio could not initialize! SDL_Error: %s\n", SDL_GetError());
+        return false;
+    }
+
+    SDL_AudioSpec want = { 0 }, have;
+    want.freq = 48000;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = samples;
+    want.callback = AudioCallback;
+    SDL_state.audio = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if (SDL_state.audio == 0)
+    {
+        printf("[WARNING]: Audio device could not be opened! SDL_Error: %s\n", SDL_GetError());
+        return false;
+    }
+    if (!AudioStart(have.freq, have.samples, clockHz))
+    {
+        SDL_CloseAudioDevice(SDL_state.audio);
+        SDL_state.audio = 0;
+        return false;
+    }
+    printf("Audio: %s driver, %d Hz, %d samples per buffer (%.1fms)\n", SDL_GetCurrentAudioDriver(), have.freq, have.samples, 1000.0 * have.samples / have.freq);
+    SDL_PauseAudioDevice(SDL_state.audio, 0);
+    return true;
+}
+
+void CloseAudio()
+{
+    if (SDL_state.audio == 0) return;
+    SDL_CloseAudioDevice(SDL_state.audio);
+    AudioStop();
 }
 
+void DestroyRenderer() { SDL_DestroyTexture(SDL_state.texture);
+  SDL_DestroyRenderer(SDL_state.renderer); }
 
-void CloseWindow() { SDL_DestroyTexture(SDL_state.texture);
-  SDL_DestroyRenderer(SDL_state.renderer); SDL_DestroyWindow(SDL_state.window);
+void CloseWindow() { SDL_DestroyWindow(SDL_state.window);
   SDL_Quit(); }
@@ -0,0 +1,29 @@
+# Regression suite: runs every core against the reference interpreter on the test ROMs, comparing
+# after every instruction and then every 1000 over a longer run. Needs ./headless from build.sh.
+# 5-quirks waits at its menu, its movie picks CHIP-8 there.
+
+failed=0
+run() {
+    output=$(./headless --seed 1 "$@")
+    status=$?
+    echo "$output" | grep -v '^Read '
+    [ $status -eq 0 ] || failed=1
+}
+
+for core in switch threaded block jit; do
+    echo "$core core..."
+    for rom in 3-corax+ 4-flags test_opcode hires-scroll; do
+        for profile in modern vip schip xochip; do
+            run --core $core --profile $profile --validate 1 --cycles 200000 roms/$rom.ch8
+            run --core $core --profile $profile --validate 1000 --cycles 5000000 roms/$rom.ch8
+        done
+    done
+    run --core $core --validate 1 --replay roms/5-quirks.movie roms/5-quirks.ch8
+    run --core $core --validate 1000 --replay roms/5-quirks.movie roms/5-quirks.ch8
+done
+
+if [ $failed -ne 0 ]; then
+    echo "FAILED"
+    exit 1
+fi
+echo "All cores match the reference"